@@ -0,0 +1,373 @@
+/***********************************************************************
+    seedimg - module based image manipulation library written in modern C++
+    Copyright (C) 2020 telugu-boy, tripulse
+
+    This program is free software : you can redistribute it and /
+    or modify it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation,
+    either version 3 of the License,
+    or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+************************************************************************/
+
+#ifndef SEEDIMG_ALLOCATOR_HPP
+#define SEEDIMG_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SIMG_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// alignment of pixel buffers, enough for any SIMD load and a cache line.
+#ifndef SIMG_ALLOC_ALIGNMENT
+#define SIMG_ALLOC_ALIGNMENT 64
+#endif
+
+// freed buffers pool_allocator keeps around at most, in bytes.
+#ifndef SIMG_POOL_MAX_CACHED
+#define SIMG_POOL_MAX_CACHED (256 * 1024 * 1024)
+#endif
+
+// pool_allocator rounds sizes up to this, so that images of nearly the
+// same size share a bucket.
+#ifndef SIMG_POOL_GRANULARITY
+#define SIMG_POOL_GRANULARITY 4096
+#endif
+
+namespace seedimg {
+/**
+ * @brief Source of the pixel memory of seedimg::img. An image remembers the
+ * allocator its buffer came from and gives the buffer back to it, along
+ * with the size it asked for, when it is destroyed.
+ */
+class allocator {
+public:
+  virtual ~allocator() = default;
+  virtual void *allocate(std::size_t bytes) = 0;
+  virtual void deallocate(void *ptr, std::size_t bytes) noexcept = 0;
+};
+
+/**
+ * @brief std::malloc and std::free, for buffers adopted through
+ * img(w, h, data).
+ */
+class malloc_allocator : public allocator {
+public:
+  static malloc_allocator &instance() {
+    static malloc_allocator alloc;
+    return alloc;
+  }
+
+  void *allocate(std::size_t bytes) override {
+    void *ptr = std::malloc(bytes);
+    if (ptr == nullptr)
+      throw std::bad_alloc();
+    return ptr;
+  }
+  void deallocate(void *ptr, std::size_t) noexcept override { std::free(ptr); }
+};
+
+/**
+ * @brief Hands out buffers aligned to SIMG_ALLOC_ALIGNMENT. This is what
+ * images are allocated with unless set_default_allocator was called.
+ */
+class aligned_allocator : public allocator {
+public:
+  static aligned_allocator &instance() {
+    static aligned_allocator alloc;
+    return alloc;
+  }
+
+  void *allocate(std::size_t bytes) override {
+    // aligned_alloc requires the size to be a multiple of the alignment.
+    bytes = (bytes + SIMG_ALLOC_ALIGNMENT - 1) / SIMG_ALLOC_ALIGNMENT *
+            SIMG_ALLOC_ALIGNMENT;
+    void *ptr = std::aligned_alloc(SIMG_ALLOC_ALIGNMENT,
+                                   bytes == 0 ? SIMG_ALLOC_ALIGNMENT : bytes);
+    if (ptr == nullptr)
+      throw std::bad_alloc();
+    return ptr;
+  }
+  void deallocate(void *ptr, std::size_t) noexcept override { std::free(ptr); }
+};
+
+/**
+ * @brief Does nothing on deallocation, for images over memory that is owned
+ * by someone else.
+ */
+class view_allocator : public allocator {
+public:
+  static view_allocator &instance() {
+    static view_allocator alloc;
+    return alloc;
+  }
+
+  void *allocate(std::size_t) override { throw std::bad_alloc(); }
+  void deallocate(void *, std::size_t) noexcept override {}
+};
+
+/**
+ * @brief Keeps freed buffers in free lists bucketed by size and hands them
+ * out again, so repeatedly creating images of the same size (video frames,
+ * batches of thumbnails, the scratch images of filters) reuses memory that
+ * is already faulted in instead of going to the system allocator.
+ */
+class pool_allocator : public allocator {
+public:
+  /**
+   * @brief Pool shared by the whole process, make it the default with
+   * seedimg::set_default_allocator(seedimg::pool_allocator::instance()).
+   */
+  static pool_allocator &instance() {
+    static pool_allocator alloc;
+    return alloc;
+  }
+
+  /**
+   * @param upstream where buffers come from when no free one fits.
+   * @param max_cached amount of free bytes kept at most, buffers freed past
+   * that go back upstream.
+   */
+  explicit pool_allocator(allocator &upstream = aligned_allocator::instance(),
+                          std::size_t max_cached = SIMG_POOL_MAX_CACHED)
+      : upstream_{upstream}, max_cached_{max_cached} {}
+
+  pool_allocator(pool_allocator const &) = delete;
+  void operator=(pool_allocator const &) = delete;
+
+  ~pool_allocator() override { release(); }
+
+  void *allocate(std::size_t bytes) override {
+    bytes = bucket(bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = free_.find(bytes);
+      if (it != free_.end() && !it->second.empty()) {
+        void *ptr = it->second.back();
+        it->second.pop_back();
+        cached_ -= bytes;
+        return ptr;
+      }
+    }
+    return upstream_.allocate(bytes);
+  }
+
+  void deallocate(void *ptr, std::size_t bytes) noexcept override {
+    if (ptr == nullptr)
+      return;
+    bytes = bucket(bytes);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cached_ + bytes <= max_cached_) {
+        try {
+          free_[bytes].push_back(ptr);
+          cached_ += bytes;
+          return;
+        } catch (...) {
+          // no room to remember it, hand it back instead.
+        }
+      }
+    }
+    upstream_.deallocate(ptr, bytes);
+  }
+
+  /**
+   * @brief Give every cached buffer back to the upstream allocator.
+   */
+  void release() noexcept {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &bucket : free_)
+      for (void *ptr : bucket.second)
+        upstream_.deallocate(ptr, bucket.first);
+    free_.clear();
+    cached_ = 0;
+  }
+
+  std::size_t cached() const noexcept { return cached_; }
+
+private:
+  allocator &upstream_;
+  std::size_t max_cached_;
+  std::size_t cached_ = 0;
+  std::unordered_map<std::size_t, std::vector<void *>> free_;
+  std::mutex mutex_;
+
+  static constexpr std::size_t bucket(std::size_t bytes) noexcept {
+    return (bytes + SIMG_POOL_GRANULARITY - 1) / SIMG_POOL_GRANULARITY *
+           SIMG_POOL_GRANULARITY;
+  }
+};
+} // namespace seedimg
+
+namespace simgdetails {
+/**
+ * @brief A whole file mapped into memory, privately: writing to it never
+ * reaches the file, pages are copied on first write instead. good() is
+ * false if the file couldn't be mapped, or mmap isn't available, and
+ * callers fall back to reading the file.
+ */
+class mapped_file {
+public:
+  explicit mapped_file(const std::string &filename) {
+#ifdef SIMG_HAS_MMAP
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *ptr = ::mmap(nullptr, static_cast<std::size_t>(st.st_size),
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        data_ = static_cast<std::uint8_t *>(ptr);
+        size_ = static_cast<std::size_t>(st.st_size);
+      }
+    }
+    // the mapping stays valid after the descriptor is closed.
+    ::close(fd);
+#else
+    (void)filename;
+#endif
+  }
+
+  mapped_file(mapped_file const &) = delete;
+  void operator=(mapped_file const &) = delete;
+
+  ~mapped_file() { unmap(data_, size_); }
+
+  bool good() const noexcept { return data_ != nullptr; }
+  std::uint8_t *data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+
+  /**
+   * @brief Ask the kernel to read ahead, for files read front to back.
+   */
+  void sequential() const noexcept {
+#ifdef SIMG_HAS_MMAP
+    if (data_ != nullptr)
+      ::madvise(data_, size_, MADV_SEQUENTIAL | MADV_WILLNEED);
+#endif
+  }
+
+  /**
+   * @brief Give up the mapping, which the caller has to unmap.
+   */
+  std::pair<std::uint8_t *, std::size_t> release() noexcept {
+    auto res = std::make_pair(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+    return res;
+  }
+
+  static void unmap(void *ptr, std::size_t size) noexcept {
+#ifdef SIMG_HAS_MMAP
+    if (ptr != nullptr)
+      ::munmap(ptr, size);
+#else
+    (void)ptr;
+    (void)size;
+#endif
+  }
+
+private:
+  std::uint8_t *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+} // namespace simgdetails
+
+namespace seedimg {
+/**
+ * @brief Owns memory mapped files that images point into, so an image can
+ * be backed by a file with no copy at all, e.g. one in the IR dump format.
+ * The mapping is private, so filtering such an image in place doesn't
+ * change the file.
+ */
+class mmap_allocator : public allocator {
+public:
+  static mmap_allocator &instance() {
+    static mmap_allocator alloc;
+    return alloc;
+  }
+
+  /**
+   * @brief Take over the mapping of file, the pixels start offset bytes into
+   * it. The whole file is unmapped once the image is destroyed.
+   */
+  void *adopt(simgdetails::mapped_file &file, std::size_t offset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    void *pixels = file.data() + offset;
+    mappings_.emplace(pixels, std::make_pair(file.data(), file.size()));
+    file.release();
+    return pixels;
+  }
+
+  // can't make new mappings out of thin air.
+  void *allocate(std::size_t) override { throw std::bad_alloc(); }
+
+  void deallocate(void *ptr, std::size_t) noexcept override {
+    std::pair<std::uint8_t *, std::size_t> mapping{nullptr, 0};
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = mappings_.find(ptr);
+      if (it == mappings_.end())
+        return;
+      mapping = it->second;
+      mappings_.erase(it);
+    }
+    simgdetails::mapped_file::unmap(mapping.first, mapping.second);
+  }
+
+private:
+  std::unordered_map<void *, std::pair<std::uint8_t *, std::size_t>>
+      mappings_;
+  std::mutex mutex_;
+};
+} // namespace seedimg
+
+namespace simgdetails {
+// not static: every translation unit has to share the same default.
+inline std::atomic<seedimg::allocator *> &default_allocator_ptr() {
+  static std::atomic<seedimg::allocator *> alloc{
+      &seedimg::aligned_allocator::instance()};
+  return alloc;
+}
+} // namespace simgdetails
+
+namespace seedimg {
+/**
+ * @brief Allocator new images get their pixels from.
+ */
+inline allocator &default_allocator() noexcept {
+  return *simgdetails::default_allocator_ptr().load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Change the allocator new images get their pixels from. Images that
+ * already exist keep using the one they were created with, so the allocator
+ * must outlive them.
+ */
+inline void set_default_allocator(allocator &alloc) noexcept {
+  simgdetails::default_allocator_ptr().store(&alloc, std::memory_order_release);
+}
+} // namespace seedimg
+#endif
@@ -72,6 +72,21 @@ seedimg_imgtype(const std::string &filename) noexcept {
   return seedimg_img_type::unknown;
 }
 
+enum seedimg_img_type seedimg_imgtype(const std::uint8_t *data,
+                                      std::size_t size) noexcept {
+  if (seedimg::modules::png::check(data, size))
+    return seedimg_img_type::png;
+  if (seedimg::modules::jpeg::check(data, size))
+    return seedimg_img_type::jpeg;
+  if (seedimg::modules::webp::check(data, size))
+    return seedimg_img_type::webp;
+  if (seedimg::modules::farbfeld::check(data, size))
+    return seedimg_img_type::farbfeld;
+  if (seedimg::modules::tiff::check(data, size))
+    return seedimg_img_type::tiff;
+  return seedimg_img_type::unknown;
+}
+
 namespace seedimg {
 simg load(const std::string &filename) {
   auto type = seedimg_imgtype(filename);
@@ -96,6 +111,86 @@ simg load(const std::string &filename) {
   }
 }
 
+/**
+ * @brief Decode an encoded image in memory, detecting its format.
+ */
+simg load(const std::uint8_t *data, std::size_t size) {
+  switch (seedimg_imgtype(data, size)) {
+  case seedimg_img_type::png:
+    return seedimg::modules::png::from(data, size);
+  case seedimg_img_type::jpeg:
+    return seedimg::modules::jpeg::from(data, size);
+  case seedimg_img_type::webp:
+    return seedimg::modules::webp::from(data, size);
+  case seedimg_img_type::farbfeld:
+    return seedimg::modules::farbfeld::from(data, size);
+  case seedimg_img_type::tiff: {
+    auto frames = seedimg::modules::tiff::from(data, size, 1);
+    return frames.size() != 0 ? std::move(frames[0]) : nullptr;
+  }
+  default:
+    return nullptr;
+  }
+}
+
+/**
+ * @brief Decode an image shrunk while decoding, no smaller than hint, for
+ * the formats which support it. Other ones are decoded at full size.
+ */
+simg load(const std::string &filename, seedimg::stream::size_hint hint) {
+  switch (seedimg_imgtype(filename).value_or(seedimg_img_type::unknown)) {
+  case seedimg_img_type::png:
+    return seedimg::modules::png::from(filename, hint);
+  case seedimg_img_type::jpeg:
+    return seedimg::modules::jpeg::from(filename, hint);
+  case seedimg_img_type::webp:
+    return seedimg::modules::webp::from(filename, hint);
+  default:
+    return load(filename);
+  }
+}
+
+simg load(const std::uint8_t *data, std::size_t size,
+          seedimg::stream::size_hint hint) {
+  switch (seedimg_imgtype(data, size)) {
+  case seedimg_img_type::png:
+    return seedimg::modules::png::from(data, size, hint);
+  case seedimg_img_type::jpeg:
+    return seedimg::modules::jpeg::from(data, size, hint);
+  case seedimg_img_type::webp:
+    return seedimg::modules::webp::from(data, size, hint);
+  default:
+    return load(data, size);
+  }
+}
+
+/**
+ * @brief Decode only the rectangle between the corners p1 and p2, for the
+ * formats which support it. Other ones are decoded whole and cropped.
+ * @return nullptr if the rectangle isn't inside the image.
+ */
+simg load(const std::string &filename, seedimg::point p1, seedimg::point p2) {
+  switch (seedimg_imgtype(filename).value_or(seedimg_img_type::unknown)) {
+  case seedimg_img_type::jpeg:
+    return seedimg::modules::jpeg::from(filename, p1, p2);
+  case seedimg_img_type::tiff:
+    return seedimg::modules::tiff::from(filename, p1, p2);
+  default:
+    break;
+  }
+  auto whole = load(filename);
+  if (whole == nullptr || std::max(p1.x, p2.x) > whole->width() ||
+      std::max(p1.y, p2.y) > whole->height())
+    return nullptr;
+  const simg_int x = std::min(p1.x, p2.x), y = std::min(p1.y, p2.y);
+  auto res_img =
+      seedimg::make(std::max(p1.x, p2.x) - x, std::max(p1.y, p2.y) - y);
+  for (simg_int j = 0; j < res_img->height(); ++j)
+    std::copy(whole->row(y + j) + x, whole->row(y + j) + x + res_img->width(),
+              res_img->row(j));
+  return res_img;
+}
+
 bool save(const std::string &filename, const simg &image) {
   std::string extension_type{filename.substr(filename.rfind('.') + 1)};
   switch (seedimg_match_ext(extension_type)) {
@@ -20,8 +20,75 @@
 #ifndef SEEDIMG_EXTRAS_HPP
 #define SEEDIMG_EXTRAS_HPP
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <memory>
+#include <seedimg-threadpool.hpp>
+#include <seedimg-utils.hpp>
 #include <seedimg.hpp>
+#include <vector>
+
+namespace simgdetails {
+// every channel has this many copies of its bins, neighbouring pixels count
+// into different copies so that runs of the same value don't stall on the
+// increment before.
+constexpr std::size_t histogram_copies = 4;
+
+// bins are 32-bit and folded into the result before they can overflow.
+constexpr simg_int histogram_flush = simg_int{1} << 30;
+
+// bins[(copy * 4 + channel) * 256 + value]
+typedef std::array<std::uint32_t, histogram_copies * 4 * 256> histogram_bins;
+
+static inline void histogram_fold(histogram_bins &bins,
+                                  std::array<std::size_t, 4 * 256> &res) {
+  for (std::size_t c = 0; c < histogram_copies; ++c)
+    for (std::size_t i = 0; i < 4 * 256; ++i)
+      res[i] += bins[c * 4 * 256 + i];
+  bins.fill(0);
+}
+
+// counts every step-th pixel of the rows [y0, y1) of that step, in the
+// columns [x0, x1).
+static inline void histogram_worker(const seedimg::img &input, simg_int x0,
+                                    simg_int x1, simg_int y0, simg_int y1,
+                                    simg_int step,
+                                    std::array<std::size_t, 4 * 256> &res) {
+  auto bins = std::make_unique<histogram_bins>();
+  bins->fill(0);
+  std::uint32_t *b = bins->data();
+  simg_int counted = 0;
+  for (simg_int y = y0; y < y1; y += step) {
+    const seedimg::pixel *row = input.row(y);
+    simg_int x = x0;
+    // four pixels into four different copies.
+    for (; x + 3 * step < x1; x += 4 * step) {
+      for (std::size_t k = 0; k < 4; ++k) {
+        const seedimg::pixel pix = row[x + k * step];
+        std::uint32_t *copy = b + k * 4 * 256;
+        ++copy[pix.r];
+        ++copy[256 + pix.g];
+        ++copy[512 + pix.b];
+        ++copy[768 + pix.a];
+      }
+    }
+    for (; x < x1; x += step) {
+      const seedimg::pixel pix = row[x];
+      ++b[pix.r];
+      ++b[256 + pix.g];
+      ++b[512 + pix.b];
+      ++b[768 + pix.a];
+    }
+    counted += (x1 - x0 + step - 1) / step;
+    if (counted >= histogram_flush) {
+      histogram_fold(*bins, res);
+      counted = 0;
+    }
+  }
+  histogram_fold(*bins, res);
+}
+} // namespace simgdetails
 
 namespace seedimg {
 namespace extras {
@@ -30,25 +97,65 @@ struct histogram_result {
 };
 
 /**
- * @brief Calculate how many r, g, b, a components total in an image
+ * @brief Calculate how many r, g, b, a components there are in a region of
+ * an image, optionally only looking at a grid of its pixels for a fast
+ * estimate.
  * @param input Input image to do the analysis on.
- * @return a structure of 4 channels as 256-length arrays.
+ * @param p1 one corner of the region.
+ * @param p2 the opposite corner, the region doesn't include its row and
+ * column like with crop.
+ * @param step only every step-th pixel of every step-th row is counted, 1
+ * counts all of them.
+ * @return a structure of 4 channels as 256-length arrays, all zero if the
+ * region is outside the image.
  */
-static inline histogram_result histogram(simg &input) {
-  histogram_result result;
+static inline histogram_result histogram(const simg &input, seedimg::point p1,
+                                         seedimg::point p2,
+                                         simg_int step = 1) {
+  histogram_result result{};
+  const seedimg::point corner{input->width(), input->height()};
+  if (!(seedimg::utils::is_on_rect({0, 0}, corner, p1) &&
+        seedimg::utils::is_on_rect({0, 0}, corner, p2)))
+    return result;
+  step = std::max<simg_int>(step, 1);
+  const simg_int x0 = std::min(p1.x, p2.x), x1 = std::max(p1.x, p2.x);
+  const simg_int y0 = std::min(p1.y, p2.y), y1 = std::max(p1.y, p2.y);
+  if (x0 == x1 || y0 == y1)
+    return result;
 
-  for (simg_int y = 0; y < input->height(); ++y) {
-    for (simg_int x = 0; x < input->width(); ++x) {
-      auto &pix = input->pixel(x, y);
+  // one band of rows per thread, each with private bins, summed at the end.
+  auto &pool = simgdetails::thread_pool::instance();
+  const simg_int rows = (y1 - y0 + step - 1) / step;
+  const simg_int per_band =
+      (rows + static_cast<simg_int>(pool.size()) - 1) / pool.size();
+  const auto bands = seedimg::utils::split_range(rows, per_band);
+  std::vector<std::array<std::size_t, 4 * 256>> partial(bands.size());
+  pool.parallel_for(bands.size(), [&](std::size_t i) {
+    partial[i].fill(0);
+    simgdetails::histogram_worker(*input, x0, x1, y0 + bands[i].first * step,
+                                  y0 + bands[i].second * step, step,
+                                  partial[i]);
+  });
 
-      ++result.r[pix.r];
-      ++result.g[pix.g];
-      ++result.b[pix.b];
-      ++result.a[pix.a];
+  for (const auto &part : partial) {
+    for (std::size_t v = 0; v < 256; ++v) {
+      result.r[v] += part[v];
+      result.g[v] += part[256 + v];
+      result.b[v] += part[512 + v];
+      result.a[v] += part[768 + v];
     }
   }
   return result;
 }
+
+/**
+ * @brief Calculate how many r, g, b, a components total in an image
+ * @param input Input image to do the analysis on.
+ * @return a structure of 4 channels as 256-length arrays.
+ */
+static inline histogram_result histogram(const simg &input) {
+  return histogram(input, {0, 0}, {input->width(), input->height()});
+}
 } // namespace seedimg::extras
 } // namespace seedimg
 #endif
@@ -0,0 +1,25 @@
+// mean of [y - r + 1, y + r] clipped to the column, through a tile of
+// columns in local memory. the alpha of the input is kept.
+__kernel void box_blur_cols(int width, int height, int r, __local uchar4* tile,
+                            __global const uchar4* inp_pix, __global uchar4* res_pix) {
+    const int lx = get_local_id(0), ly = get_local_id(1);
+    const int lw = get_local_size(0), lh = get_local_size(1);
+    const int x = get_global_id(0), y = get_global_id(1);
+    const int span = lh + 2 * r - 1;
+    const int y0 = get_group_id(1) * lh - r + 1;
+
+    if (x < width)
+        for (int j = ly; j < span; j += lh) {
+            const int sy = y0 + j;
+            tile[j * lw + lx] = sy >= 0 && sy < height ? inp_pix[sy * width + x] : (uchar4)(0);
+        }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (x >= width || y >= height)
+        return;
+
+    uint3 sum = (uint3)(0);
+    for (int j = 0; j < 2 * r; ++j)
+        sum += convert_uint3(tile[(ly + j) * lw + lx].xyz);
+    const uint count = min(y + r, height - 1) - max(y - r + 1, 0) + 1;
+    res_pix[y * width + x] = (uchar4)(convert_uchar3(sum / count), inp_pix[y * width + x].w);
+}
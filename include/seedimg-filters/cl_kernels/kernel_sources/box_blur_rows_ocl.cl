@@ -0,0 +1,26 @@
+// mean of [x - r + 1, x + r] clipped to the row. a work group loads the
+// pixels its rows need into local memory once, the alpha of the input is
+// kept.
+__kernel void box_blur_rows(int width, int height, int r, __local uchar4* tile,
+                            __global const uchar4* inp_pix, __global uchar4* res_pix) {
+    const int lx = get_local_id(0), lw = get_local_size(0);
+    const int x = get_global_id(0), y = get_global_id(1);
+    const int span = lw + 2 * r - 1;
+    const int x0 = get_group_id(0) * lw - r + 1;
+    __local uchar4* line = tile + get_local_id(1) * span;
+
+    if (y < height)
+        for (int i = lx; i < span; i += lw) {
+            const int sx = x0 + i;
+            line[i] = sx >= 0 && sx < width ? inp_pix[y * width + sx] : (uchar4)(0);
+        }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (x >= width || y >= height)
+        return;
+
+    uint3 sum = (uint3)(0);
+    for (int i = 0; i < 2 * r; ++i)
+        sum += convert_uint3(line[lx + i].xyz);
+    const uint count = min(x + r, width - 1) - max(x - r + 1, 0) + 1;
+    res_pix[y * width + x] = (uchar4)(convert_uchar3(sum / count), inp_pix[y * width + x].w);
+}
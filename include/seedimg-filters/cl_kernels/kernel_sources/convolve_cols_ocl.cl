@@ -0,0 +1,26 @@
+inline int conv_border(int c, int n) { return (int)(abs(c) % (uint)n); }
+
+// vertical pass of a separable convolution over the output of
+// convolve_rows, back to pixels with the alpha of the input.
+__kernel void convolve_cols(int width, int height, int taps, int origin,
+                            __constant float* weights, __local float4* tile,
+                            __global const float4* rows, __global const uchar4* inp_pix,
+                            __global uchar4* res_pix) {
+    const int lx = get_local_id(0), ly = get_local_id(1);
+    const int lw = get_local_size(0), lh = get_local_size(1);
+    const int x = get_global_id(0), y = get_global_id(1);
+    const int span = lh + taps - 1;
+    const int y0 = get_group_id(1) * lh - origin;
+
+    if (x < width)
+        for (int j = ly; j < span; j += lh)
+            tile[j * lw + lx] = rows[conv_border(y0 + j, height) * width + x];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (x >= width || y >= height)
+        return;
+
+    float4 acc = (float4)(0.0f);
+    for (int t = 0; t < taps; ++t)
+        acc += weights[t] * tile[(ly + t) * lw + lx];
+    res_pix[y * width + x] = (uchar4)(convert_uchar3_sat(acc.xyz), inp_pix[y * width + x].w);
+}
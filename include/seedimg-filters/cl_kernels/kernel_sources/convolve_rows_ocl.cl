@@ -0,0 +1,27 @@
+// coordinates left of the image are mirrored, the ones right of it wrap
+// around, same as on the CPU.
+inline int conv_border(int c, int n) { return (int)(abs(c) % (uint)n); }
+
+// horizontal pass of a separable convolution into rgb floats, res(x) is the
+// sum of weights[t] * inp(x + t - origin).
+__kernel void convolve_rows(int width, int height, int taps, int origin,
+                            __constant float* weights, __local float4* tile,
+                            __global const uchar4* inp_pix, __global float4* res_pix) {
+    const int lx = get_local_id(0), lw = get_local_size(0);
+    const int x = get_global_id(0), y = get_global_id(1);
+    const int span = lw + taps - 1;
+    const int x0 = get_group_id(0) * lw - origin;
+    __local float4* line = tile + get_local_id(1) * span;
+
+    if (y < height)
+        for (int i = lx; i < span; i += lw)
+            line[i] = convert_float4(inp_pix[y * width + conv_border(x0 + i, width)]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (x >= width || y >= height)
+        return;
+
+    float4 acc = (float4)(0.0f);
+    for (int t = 0; t < taps; ++t)
+        acc += weights[t] * line[lx + t];
+    res_pix[y * width + x] = acc;
+}
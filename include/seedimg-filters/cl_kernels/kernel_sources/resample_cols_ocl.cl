@@ -0,0 +1,16 @@
+// vertical pass of a resize over the output of resample_rows, rounded back
+// to pixels.
+__kernel void resample_cols(int width, int src_height, int height, int taps,
+                            __global const int* first, __global const float* weights,
+                            __global const float4* rows, __global uchar4* res_pix) {
+    const int x = get_global_id(0), y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    __global const float4* src = rows + first[y] * width + x;
+    __global const float* w = weights + y * taps;
+    float4 acc = (float4)(0.0f);
+    for (int t = 0; t < taps; ++t)
+        acc += w[t] * src[t * width];
+    res_pix[y * width + x] = convert_uchar4_sat_rte(acc);
+}
@@ -0,0 +1,16 @@
+// horizontal pass of a resize into rgba floats. output column x is the sum
+// of weights[x * taps + t] * inp(first[x] + t).
+__kernel void resample_rows(int src_width, int width, int height, int taps,
+                            __global const int* first, __global const float* weights,
+                            __global const uchar4* inp_pix, __global float4* res_pix) {
+    const int x = get_global_id(0), y = get_global_id(1);
+    if (x >= width || y >= height)
+        return;
+
+    __global const uchar4* src = inp_pix + y * src_width + first[x];
+    __global const float* w = weights + x * taps;
+    float4 acc = (float4)(0.0f);
+    for (int t = 0; t < taps; ++t)
+        acc += w[t] * convert_float4(src[t]);
+    res_pix[y * width + x] = acc;
+}
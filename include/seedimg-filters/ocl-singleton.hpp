@@ -25,33 +25,125 @@
 #endif
 
 #include <CL/cl2.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <seedimg-profile.hpp>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 
+// types of devices the OpenCL filters may run on. GPUs are preferred over
+// accelerators, which are preferred over CPUs, e.g. PoCL.
+#ifndef SIMG_OCL_DEVICE_TYPE
+#define SIMG_OCL_DEVICE_TYPE CL_DEVICE_TYPE_ALL
+#endif
+
 namespace simgdetails {
+// FNV-1a, keys the cached program binaries.
+static inline std::uint64_t ocl_hash(const std::string &str) noexcept {
+  std::uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : str) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// directory compiled programs are cached in: $SIMG_OCL_CACHE_DIR if it is
+// set, where empty turns the cache off, otherwise seedimg-ocl in the cache
+// directory of the user.
+static inline std::filesystem::path ocl_cache_dir() {
+#ifdef SIMG_OCL_NO_CACHE
+  return {};
+#else
+  if (const char *dir = std::getenv("SIMG_OCL_CACHE_DIR"))
+    return dir;
+  for (const char *var : {"XDG_CACHE_HOME", "LOCALAPPDATA"})
+    if (const char *dir = std::getenv(var); dir != nullptr && *dir != '\0')
+      return std::filesystem::path(dir) / "seedimg-ocl";
+  if (const char *dir = std::getenv("HOME"); dir != nullptr && *dir != '\0')
+    return std::filesystem::path(dir) / ".cache" / "seedimg-ocl";
+  return {};
+#endif
+}
+
 class ocl_singleton {
 public:
   std::vector<cl::Platform> all_platforms;
   cl::Platform platform;
+  // devices of the platform, best first. the context spans all of them, so
+  // buffers and kernels can be used on any.
   std::vector<cl::Device> all_devices;
   cl::Context context;
+  // device and queue filters run on by default.
   cl::Device device;
-  cl::Program::Sources sources;
-  cl::Program program;
   cl::CommandQueue queue;
 
+  // kernels built so far, see kernel().
   std::unordered_map<std::string, cl::Kernel> kernels;
 
-  static ocl_singleton &instance(std::size_t plat = 0, std::size_t dev = 0) {
-    static ocl_singleton singleton(plat, dev);
+  static ocl_singleton &instance(std::size_t plat = 0, std::size_t dev = 0,
+                                 cl_device_type type = SIMG_OCL_DEVICE_TYPE) {
+    static ocl_singleton singleton(plat, dev, type);
     return singleton;
   }
 
   ocl_singleton(ocl_singleton const &) = delete;
   void operator=(ocl_singleton const &) = delete;
 
+  /**
+   * @brief Another queue on the same device, commands on separate queues
+   * may run at the same time.
+   */
+  cl::CommandQueue make_queue() const { return make_queue(device); }
+
+  /**
+   * @brief A queue on any of all_devices. It records the device times of
+   * kernels if profiling is set, SIMG_OCL_PROFILING is defined or a
+   * profiling sink is installed when it is made, that costs a little on
+   * some drivers.
+   */
+  cl::CommandQueue make_queue(const cl::Device &on,
+                              bool profiling = false) const {
+#ifdef SIMG_OCL_PROFILING
+    profiling = true;
+#endif
+    if (profiling || seedimg::profile::enabled())
+      return {context, on, CL_QUEUE_PROFILING_ENABLE};
+    return {context, on};
+  }
+
+  /**
+   * @brief The kernel called name, its program is built the first time it
+   * is asked for, from the binary cache if it has it.
+   * @throws std::out_of_range if there is no such kernel.
+   */
+  cl::Kernel &kernel(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = kernels.find(name);
+    if (it != kernels.end())
+      return it->second;
+    const char *src = source(name);
+    if (src == nullptr)
+      throw std::out_of_range("No OpenCL kernel named " + name);
+    return kernels.emplace(name, cl::Kernel{build(name, src), name.c_str()})
+        .first->second;
+  }
+
 private:
-  ocl_singleton(std::size_t plat, std::size_t dev) {
+  std::mutex mutex_;
+  // what binaries are only valid for, hashed along with the source.
+  std::string device_key_;
+
+  ocl_singleton(std::size_t plat, std::size_t dev, cl_device_type type) {
     // get all platforms (drivers), e.g. NVIDIA
     cl::Platform::get(&all_platforms);
     if (all_platforms.size() == 0) {
@@ -63,15 +155,39 @@ private:
               << std::endl;
 #endif
 
-    platform.getDevices(CL_DEVICE_TYPE_GPU, &all_devices);
+    platform.getDevices(type, &all_devices);
     if (all_devices.size() == 0) {
-      throw std::runtime_error("No GPUs found");
+      throw std::runtime_error("No OpenCL devices found");
     }
-    device = all_devices[dev];
-    context = {device};
+    std::stable_sort(all_devices.begin(), all_devices.end(),
+                     [](const cl::Device &a, const cl::Device &b) {
+                       return device_rank(a) < device_rank(b);
+                     });
+    device = all_devices.at(dev);
+    context = {all_devices};
+
+    queue = make_queue();
+
+    device_key_ = platform.getInfo<CL_PLATFORM_NAME>() + '\n' +
+                  platform.getInfo<CL_PLATFORM_VERSION>() + '\n';
+    for (const auto &d : all_devices)
+      device_key_ += d.getInfo<CL_DEVICE_NAME>() + '\n' +
+                     d.getInfo<CL_DEVICE_VERSION>() + '\n' +
+                     d.getInfo<CL_DRIVER_VERSION>() + '\n';
+  }
 
-    queue = {context, device};
+  static int device_rank(const cl::Device &d) {
+    const cl_device_type type = d.getInfo<CL_DEVICE_TYPE>();
+    if (type & CL_DEVICE_TYPE_GPU)
+      return 0;
+    if (type & CL_DEVICE_TYPE_ACCELERATOR)
+      return 1;
+    if (type & CL_DEVICE_TYPE_CPU)
+      return 2;
+    return 3;
+  }
 
+  static const char *source(const std::string &name) noexcept {
     static constexpr const char *const kernels_src[] = {
 #include "cl_kernels/apply_mat_kernel.clh"
         ,
@@ -83,27 +199,120 @@ private:
         ,
 #include "cl_kernels/brightness_a_kernel.clh"
         ,
+#include "cl_kernels/box_blur_rows_kernel.clh"
+        ,
+#include "cl_kernels/box_blur_cols_kernel.clh"
+        ,
+#include "cl_kernels/convolve_rows_kernel.clh"
+        ,
+#include "cl_kernels/convolve_cols_kernel.clh"
+        ,
+#include "cl_kernels/resample_rows_kernel.clh"
+        ,
+#include "cl_kernels/resample_cols_kernel.clh"
+        ,
     };
 
-    static constexpr const char *const kernels_names[]{"apply_mat", "rgb2hsv",
-                                                       "hsv2rgb", "saturation_hsv", "brightness_a"};
+    static constexpr const char *const kernels_names[]{
+        "apply_mat",     "rgb2hsv",       "hsv2rgb",       "saturation_hsv",
+        "brightness_a",  "box_blur_rows", "box_blur_cols", "convolve_rows",
+        "convolve_cols", "resample_rows", "resample_cols"};
+
+    for (std::size_t i = 0; i < std::size(kernels_names); ++i)
+      if (name == kernels_names[i])
+        return kernels_src[i];
+    return nullptr;
+  }
+
+  cl::Program build(const std::string &name, const char *src) {
+    std::filesystem::path file = ocl_cache_dir();
+    if (!file.empty()) {
+      char key[17];
+      std::snprintf(key, sizeof(key), "%016llx",
+                    static_cast<unsigned long long>(
+                        ocl_hash(device_key_ + src)));
+      file /= name + '-' + key + ".bin";
+      cl::Program program;
+      if (load_binary(file, program))
+        return program;
+    }
 
-    // didn't use emplace back because it's slower as they're not
-    // large. std::pair<const char*, ::size_t> is the definition of
+    // std::pair<const char*, ::size_t> is the definition of
     // cl::Program::Sources.
-    for (auto &kernel : kernels_src)
-      sources.push_back({kernel, std::strlen(kernel)});
-
-    program = {context, sources};
-    if (program.build({device}) != CL_SUCCESS) {
-      throw std::runtime_error(
-          "Error building: " +
-          program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
+    cl::Program program{context,
+                        cl::Program::Sources{{src, std::strlen(src)}}};
+    if (program.build(all_devices) != CL_SUCCESS) {
+      std::string log;
+      for (const auto &d : all_devices)
+        log += program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(d);
+      throw std::runtime_error("Error building: " + log);
+    }
+    if (!file.empty())
+      save_binary(program, file);
+    return program;
+  }
+
+  // a missing, stale or corrupt binary is a miss, the driver rejects the
+  // last two.
+  bool load_binary(const std::filesystem::path &file,
+                   cl::Program &program) const {
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+      return false;
+    // one binary per device, each after its size.
+    cl::Program::Binaries binaries(all_devices.size());
+    for (auto &binary : binaries) {
+      std::uint64_t size = 0;
+      if (!in.read(reinterpret_cast<char *>(&size), sizeof(size)) ||
+          size == 0 || size > (1u << 30))
+        return false;
+      binary.resize(static_cast<std::size_t>(size));
+      if (!in.read(reinterpret_cast<char *>(binary.data()),
+                   static_cast<std::streamsize>(size)))
+        return false;
     }
+    cl_int err = CL_SUCCESS;
+    std::vector<cl_int> status;
+    program = cl::Program(context, all_devices, binaries, &status, &err);
+    return err == CL_SUCCESS && program.build(all_devices) == CL_SUCCESS;
+  }
+
+  // failing to cache only costs the next start a build.
+  void save_binary(const cl::Program &program,
+                   const std::filesystem::path &file) const {
+    cl_int err = CL_SUCCESS;
+    const auto binaries = program.getInfo<CL_PROGRAM_BINARIES>(&err);
+    if (err != CL_SUCCESS || binaries.size() != all_devices.size())
+      return;
+    for (const auto &binary : binaries)
+      if (binary.empty())
+        return;
 
-    for (auto &name : kernels_names) {
-      kernels[name] = {program, name};
+    std::error_code ec;
+    std::filesystem::create_directories(file.parent_path(), ec);
+    if (ec)
+      return;
+    // written aside and renamed over, so that processes starting at the
+    // same time never read half of a binary.
+    auto tmp = file;
+    tmp += ".tmp" + std::to_string(std::random_device{}());
+    {
+      std::ofstream out(tmp, std::ios::binary);
+      for (const auto &binary : binaries) {
+        const std::uint64_t size = binary.size();
+        out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        out.write(reinterpret_cast<const char *>(binary.data()),
+                  static_cast<std::streamsize>(binary.size()));
+      }
+      if (!out) {
+        out.close();
+        std::filesystem::remove(tmp, ec);
+        return;
+      }
     }
+    std::filesystem::rename(tmp, file, ec);
+    if (ec)
+      std::filesystem::remove(tmp, ec);
   }
 };
 } // namespace simgdetails
@@ -0,0 +1,420 @@
+/***********************************************************************
+    seedimg - module based image manipulation library written in modern C++
+    Copyright (C) 2020 telugu-boy, tripulse
+
+    This program is free software : you can redistribute it and /
+    or modify it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation,
+    either version 3 of the License,
+    or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+************************************************************************/
+#ifndef SEEDIMG_FILTERS_CONVOLUTION_H
+#define SEEDIMG_FILTERS_CONVOLUTION_H
+
+// Convolution engine behind seedimg::filters::convolution. Three strategies,
+// all reading from the input and writing to a separate output:
+//  - direct: every band of rows is loaded once into float rows that are
+//    already extended past the left and right edge, so the per tap loop is
+//    a branch free multiply-add over a whole row.
+//  - separable: rank-1 kernels are split into a row and a column vector and
+//    run as two 1-D passes over the same extended rows.
+//  - fft: kernels with at least SIMG_CONV_FFT_TAPS taps are applied with
+//    overlap-save on square tiles, two channels packed per complex transform.
+//
+// Edges are handled while rows are loaded: coordinates left of/above the
+// image are mirrored and the ones right of/below it wrap around.
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <optional>
+#include <seedimg-utils.hpp>
+#include <seedimg.hpp>
+#include <vector>
+
+// kernels with at least this many taps, which are not separable, are
+// applied in the frequency domain.
+#ifndef SIMG_CONV_FFT_TAPS
+#define SIMG_CONV_FFT_TAPS 49
+#endif
+
+namespace simgdetails::conv {
+/**
+ * @brief Normalised and flipped kernel, so that output(x, y) is the sum of
+ * taps[dy * w + dx] * input(x + dx - ox, y + dy - oy).
+ */
+struct kernel2d {
+  simg_int w, h;
+  simg_int ox, oy;
+  std::vector<float> taps;
+};
+
+// returns nothing if the kernel is empty or its rows differ in length.
+static inline std::optional<kernel2d>
+prepare_kernel(const std::vector<std::vector<float>> &kernel) {
+  if (kernel.size() == 0 || kernel[0].size() == 0)
+    return std::nullopt;
+  for (const auto &r : kernel)
+    if (r.size() != kernel[0].size())
+      return std::nullopt;
+
+  kernel2d res;
+  res.w = kernel[0].size();
+  res.h = kernel.size();
+  // approximated the center coordinate of kernel, for a symmetric one
+  // the origin is the current pixel.
+  res.ox = res.w / 2;
+  res.oy = res.h / 2;
+
+  float neg_sum = 0.0f, pos_sum = 0.0f;
+  for (const auto &r : kernel)
+    for (auto e : r)
+      if (std::signbit(e))
+        neg_sum -= e;
+      else
+        pos_sum += e;
+
+  // flip the kernel both vertically and horizontally +
+  // normalise all the elements.
+  res.taps.assign(res.w * res.h, 0.0f);
+  for (simg_int y = 0; y < res.h; ++y)
+    for (simg_int x = 0; x < res.w; ++x)
+      if (kernel[y][x] != 0.0f)
+        res.taps[(res.h - y - 1) * res.w + (res.w - x - 1)] =
+            kernel[y][x] / (std::signbit(kernel[y][x]) ? neg_sum : pos_sum);
+  return res;
+}
+
+// splits a rank-1 kernel into the column vector (first) and the row vector
+// (second) whose outer product it is.
+static inline std::optional<std::pair<std::vector<float>, std::vector<float>>>
+separate(const kernel2d &k) {
+  simg_int py = 0, px = 0;
+  float peak = 0.0f;
+  for (simg_int y = 0; y < k.h; ++y)
+    for (simg_int x = 0; x < k.w; ++x)
+      if (std::fabs(k.taps[y * k.w + x]) > peak) {
+        peak = std::fabs(k.taps[y * k.w + x]);
+        py = y;
+        px = x;
+      }
+  if (peak == 0.0f)
+    return std::nullopt;
+
+  std::vector<float> col(k.h), row(k.w);
+  for (simg_int y = 0; y < k.h; ++y)
+    col[y] = k.taps[y * k.w + px];
+  for (simg_int x = 0; x < k.w; ++x)
+    row[x] = k.taps[py * k.w + x] / k.taps[py * k.w + px];
+
+  const float tolerance = peak * 1e-5f;
+  for (simg_int y = 0; y < k.h; ++y)
+    for (simg_int x = 0; x < k.w; ++x)
+      if (std::fabs(k.taps[y * k.w + x] - col[y] * row[x]) > tolerance)
+        return std::nullopt;
+  return std::make_pair(std::move(col), std::move(row));
+}
+
+// where coordinate c of an axis of n pixels is read from.
+static inline simg_int border(long long c, simg_int n) noexcept {
+  return static_cast<simg_int>(static_cast<unsigned long long>(std::llabs(c)) %
+                               n);
+}
+
+// border(i - origin, n) for i in [0, n + k - 1).
+static inline std::vector<simg_int> border_map(simg_int n, simg_int k,
+                                               simg_int origin) {
+  std::vector<simg_int> map(n + k - 1);
+  for (simg_int i = 0; i < map.size(); ++i)
+    map[i] = border(static_cast<long long>(i) - static_cast<long long>(origin),
+                    n);
+  return map;
+}
+
+// converts input row src into rgb floats, extended by k.w - 1 pixels
+// according to xmap. the interior is a plain copy, only the edges are
+// looked up.
+static inline void load_row(const seedimg::pixel *src, float *dst,
+                            const std::vector<simg_int> &xmap, simg_int width,
+                            simg_int ox) {
+  const simg_int ext = xmap.size();
+  for (simg_int i = 0; i < std::min(ox, ext); ++i) {
+    const auto &p = src[xmap[i]];
+    dst[i * 3] = p.r;
+    dst[i * 3 + 1] = p.g;
+    dst[i * 3 + 2] = p.b;
+  }
+  float *mid = dst + ox * 3;
+  for (simg_int x = 0; x < width; ++x) {
+    mid[x * 3] = src[x].r;
+    mid[x * 3 + 1] = src[x].g;
+    mid[x * 3 + 2] = src[x].b;
+  }
+  for (simg_int i = ox + width; i < ext; ++i) {
+    const auto &p = src[xmap[i]];
+    dst[i * 3] = p.r;
+    dst[i * 3 + 1] = p.g;
+    dst[i * 3 + 2] = p.b;
+  }
+}
+
+// acc[i] += w * src[i] for a row of rgb floats.
+static inline void madd_row(float *acc, const float *src, float w,
+                            simg_int n) {
+  for (simg_int i = 0; i < n; ++i)
+    acc[i] += w * src[i];
+}
+
+// rgb floats back to pixels, alpha is taken from the input.
+static inline void store_row(const float *acc, const seedimg::pixel *alpha,
+                             seedimg::pixel *dst, simg_int width) {
+  using seedimg::utils::clamp;
+  for (simg_int x = 0; x < width; ++x)
+    dst[x] = {{static_cast<std::uint8_t>(clamp(acc[x * 3], 0, 255))},
+              {static_cast<std::uint8_t>(clamp(acc[x * 3 + 1], 0, 255))},
+              {static_cast<std::uint8_t>(clamp(acc[x * 3 + 2], 0, 255))},
+              alpha[x].a};
+}
+
+// bands of output rows for the direct and separable paths, sized so that the
+// extended float rows they need stay in L2.
+static inline std::vector<std::pair<simg_int, simg_int>>
+bands(const simg &input, const kernel2d &k) {
+  const simg_int row_bytes = (input->width() + k.w - 1) * 3 * sizeof(float);
+  simg_int rows = SIMG_L2_CACHE_SIZE / row_bytes;
+  rows = rows > k.h - 1 ? rows - (k.h - 1) : 1;
+  // each band reloads k.h - 1 rows of its neighbours, keep that overhead
+  // below half.
+  return seedimg::utils::split_range(input->height(), std::max(rows, k.h));
+}
+
+static inline void direct(simg &input, simg &output, const kernel2d &k) {
+  const simg_int width = input->width();
+  const auto xmap = border_map(width, k.w, k.ox);
+  const auto ymap = border_map(input->height(), k.h, k.oy);
+  const simg_int stride = xmap.size() * 3;
+  const auto work = bands(input, k);
+
+  thread_pool::instance().parallel_for(work.size(), [&](std::size_t b) {
+    const auto [start, end] = work[b];
+    const simg_int nrows = end - start + k.h - 1;
+    std::vector<float> rows(nrows * stride);
+    std::vector<float> acc(width * 3);
+    for (simg_int j = 0; j < nrows; ++j)
+      load_row(input->row(ymap[start + j]), rows.data() + j * stride, xmap,
+               width, k.ox);
+
+    for (simg_int y = start; y < end; ++y) {
+      std::fill(acc.begin(), acc.end(), 0.0f);
+      const float *base = rows.data() + (y - start) * stride;
+      for (simg_int dy = 0; dy < k.h; ++dy)
+        for (simg_int dx = 0; dx < k.w; ++dx) {
+          const float w = k.taps[dy * k.w + dx];
+          if (w != 0.0f)
+            madd_row(acc.data(), base + dy * stride + dx * 3, w, width * 3);
+        }
+      store_row(acc.data(), input->row(y), output->row(y), width);
+    }
+  });
+}
+
+static inline void separable(simg &input, simg &output, const kernel2d &k,
+                             const std::vector<float> &col,
+                             const std::vector<float> &row) {
+  const simg_int width = input->width();
+  const auto xmap = border_map(width, k.w, k.ox);
+  const auto ymap = border_map(input->height(), k.h, k.oy);
+  const simg_int stride = xmap.size() * 3;
+  const auto work = bands(input, k);
+
+  thread_pool::instance().parallel_for(work.size(), [&](std::size_t b) {
+    const auto [start, end] = work[b];
+    const simg_int nrows = end - start + k.h - 1;
+    std::vector<float> line(stride);
+    std::vector<float> hpass(nrows * width * 3, 0.0f);
+    std::vector<float> acc(width * 3);
+
+    // horizontal pass over every row the band needs.
+    for (simg_int j = 0; j < nrows; ++j) {
+      load_row(input->row(ymap[start + j]), line.data(), xmap, width, k.ox);
+      float *dst = hpass.data() + j * width * 3;
+      for (simg_int dx = 0; dx < k.w; ++dx)
+        if (row[dx] != 0.0f)
+          madd_row(dst, line.data() + dx * 3, row[dx], width * 3);
+    }
+
+    // vertical pass.
+    for (simg_int y = start; y < end; ++y) {
+      std::fill(acc.begin(), acc.end(), 0.0f);
+      const float *base = hpass.data() + (y - start) * width * 3;
+      for (simg_int dy = 0; dy < k.h; ++dy)
+        if (col[dy] != 0.0f)
+          madd_row(acc.data(), base + dy * width * 3, col[dy], width * 3);
+      store_row(acc.data(), input->row(y), output->row(y), width);
+    }
+  });
+}
+
+/**
+ * @brief In place radix-2 transform of a power of two amount of points.
+ */
+class fft_plan {
+public:
+  explicit fft_plan(std::size_t n) : n_{n}, rev_(n), twiddle_(n / 2) {
+    std::size_t bits = 0;
+    while ((std::size_t{1} << bits) < n)
+      ++bits;
+    for (std::size_t i = 0; i < n; ++i) {
+      std::size_t r = 0;
+      for (std::size_t b = 0; b < bits; ++b)
+        if (i & (std::size_t{1} << b))
+          r |= std::size_t{1} << (bits - b - 1);
+      rev_[i] = r;
+    }
+    const double pi = std::acos(-1.0);
+    for (std::size_t i = 0; i < n / 2; ++i)
+      twiddle_[i] = std::polar(1.0f, static_cast<float>(-2.0 * pi * i / n));
+  }
+
+  std::size_t size() const noexcept { return n_; }
+
+  // unscaled, the inverse transform does not divide by n.
+  void run(std::complex<float> *data, bool inverse) const noexcept {
+    for (std::size_t i = 0; i < n_; ++i)
+      if (i < rev_[i])
+        std::swap(data[i], data[rev_[i]]);
+    const float sign = inverse ? -1.0f : 1.0f;
+    for (std::size_t len = 2; len <= n_; len <<= 1) {
+      const std::size_t half = len / 2, step = n_ / len;
+      for (std::size_t i = 0; i < n_; i += len)
+        for (std::size_t j = 0; j < half; ++j) {
+          // spelled out, std::complex multiplication checks for infinities.
+          const float wr = twiddle_[j * step].real();
+          const float wi = sign * twiddle_[j * step].imag();
+          auto &a = data[i + j], &b = data[i + j + half];
+          const float tr = b.real() * wr - b.imag() * wi;
+          const float ti = b.real() * wi + b.imag() * wr;
+          b = {a.real() - tr, a.imag() - ti};
+          a = {a.real() + tr, a.imag() + ti};
+        }
+    }
+  }
+
+  // 2-D transform of an n * n row major block. the columns are transformed
+  // all at once, a butterfly between two whole rows at a time, so that every
+  // access is contiguous.
+  void run2d(std::complex<float> *data, bool inverse) const noexcept {
+    for (std::size_t y = 0; y < n_; ++y)
+      run(data + y * n_, inverse);
+
+    for (std::size_t i = 0; i < n_; ++i)
+      if (i < rev_[i])
+        std::swap_ranges(data + i * n_, data + (i + 1) * n_,
+                         data + rev_[i] * n_);
+    const float sign = inverse ? -1.0f : 1.0f;
+    for (std::size_t len = 2; len <= n_; len <<= 1) {
+      const std::size_t half = len / 2, step = n_ / len;
+      for (std::size_t i = 0; i < n_; i += len)
+        for (std::size_t j = 0; j < half; ++j) {
+          const float wr = twiddle_[j * step].real();
+          const float wi = sign * twiddle_[j * step].imag();
+          auto *a = reinterpret_cast<float *>(data + (i + j) * n_);
+          auto *b = reinterpret_cast<float *>(data + (i + j + half) * n_);
+          for (std::size_t x = 0; x < 2 * n_; x += 2) {
+            const float tr = b[x] * wr - b[x + 1] * wi;
+            const float ti = b[x] * wi + b[x + 1] * wr;
+            b[x] = a[x] - tr;
+            b[x + 1] = a[x + 1] - ti;
+            a[x] += tr;
+            a[x + 1] += ti;
+          }
+        }
+    }
+  }
+
+private:
+  std::size_t n_;
+  std::vector<std::size_t> rev_;
+  std::vector<std::complex<float>> twiddle_;
+};
+
+static inline void fft(simg &input, simg &output, const kernel2d &k) {
+  // tiles 4 times the kernel size waste little on the overlap.
+  std::size_t n = 128;
+  while (n < 4 * static_cast<std::size_t>(std::max(k.w, k.h)))
+    n <<= 1;
+  const fft_plan plan(n);
+  const simg_int tile_w = n - k.w + 1, tile_h = n - k.h + 1;
+  const simg_int width = input->width(), height = input->height();
+
+  // the tiles are correlated with the kernel, which in the frequency domain
+  // is a product with the conjugate of its spectrum.
+  std::vector<std::complex<float>> spectrum(n * n);
+  for (simg_int y = 0; y < k.h; ++y)
+    for (simg_int x = 0; x < k.w; ++x)
+      spectrum[y * n + x] = k.taps[y * k.w + x];
+  plan.run2d(spectrum.data(), false);
+  const float scale = 1.0f / static_cast<float>(n * n);
+  for (auto &c : spectrum)
+    c = std::conj(c) * scale;
+
+  const simg_int tiles_x = (width + tile_w - 1) / tile_w;
+  const simg_int tiles_y = (height + tile_h - 1) / tile_h;
+  thread_pool::instance().parallel_for(tiles_x * tiles_y, [&](std::size_t t) {
+    const simg_int x0 = (t % tiles_x) * tile_w, y0 = (t / tiles_x) * tile_h;
+    // real kernel, so red and green share one transform as the real and
+    // imaginary part, blue gets the other one.
+    std::vector<std::complex<float>> rg(n * n), bl(n * n);
+    for (std::size_t v = 0; v < n; ++v) {
+      const auto *src = input->row(border(
+          static_cast<long long>(y0 + v) - static_cast<long long>(k.oy),
+          height));
+      for (std::size_t u = 0; u < n; ++u) {
+        const auto &p = src[border(static_cast<long long>(x0 + u) -
+                                       static_cast<long long>(k.ox),
+                                   width)];
+        rg[v * n + u] = {static_cast<float>(p.r), static_cast<float>(p.g)};
+        bl[v * n + u] = static_cast<float>(p.b);
+      }
+    }
+    plan.run2d(rg.data(), false);
+    plan.run2d(bl.data(), false);
+    for (std::size_t i = 0; i < n * n; ++i) {
+      const float sr = spectrum[i].real(), si = spectrum[i].imag();
+      rg[i] = {rg[i].real() * sr - rg[i].imag() * si,
+               rg[i].real() * si + rg[i].imag() * sr};
+      bl[i] = {bl[i].real() * sr - bl[i].imag() * si,
+               bl[i].real() * si + bl[i].imag() * sr};
+    }
+    plan.run2d(rg.data(), true);
+    plan.run2d(bl.data(), true);
+
+    using seedimg::utils::clamp;
+    const simg_int x1 = std::min(x0 + tile_w, width);
+    const simg_int y1 = std::min(y0 + tile_h, height);
+    for (simg_int y = y0; y < y1; ++y) {
+      const auto *alpha = input->row(y);
+      auto *dst = output->row(y);
+      for (simg_int x = x0; x < x1; ++x) {
+        const std::size_t i = (y - y0) * n + (x - x0);
+        dst[x] = {
+            {static_cast<std::uint8_t>(clamp(rg[i].real(), 0, 255))},
+            {static_cast<std::uint8_t>(clamp(rg[i].imag(), 0, 255))},
+            {static_cast<std::uint8_t>(clamp(bl[i].real(), 0, 255))},
+            alpha[x].a};
+      }
+    }
+  });
+}
+} // namespace simgdetails::conv
+
+#endif
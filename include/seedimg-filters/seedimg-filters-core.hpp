@@ -25,8 +25,16 @@
 #include <cmath>
 #include <cstring>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <seedimg-filters/seedimg-filters-convolution.hpp>
+#include <seedimg-filters/seedimg-filters-resample.hpp>
+#include <seedimg-filters/seedimg-filters-simd.hpp>
+#include <seedimg-profile.hpp>
+#include <seedimg-stream.hpp>
 #include <seedimg-utils.hpp>
 #include <seedimg.hpp>
+#include <tuple>
 
 const float PI = 4 * std::atan(1.0f);
 
@@ -61,17 +69,22 @@ static inline smat generate_hue_mat(float angle) {
           0.072f + cosr * 0.928f + sinr * 0.072f};
 }
 
+// composes matrices so that applying the result with apply_mat is the same
+// as applying mats[0], mats[1], ... in order. pixels are row vectors, so
+// this is mats[0] * mats[1] * ...
 template <typename T> constexpr fsmat compose_fsmats(const T &mats) {
   fsmat res = mats[0];
   for (std::size_t l = 1; l < mats.size(); l++) {
+    fsmat prod{};
     for (std::size_t i = 0; i < 4; i++) {
       for (std::size_t j = 0; j < 4; j++) {
         float sum = 0.0;
         for (std::size_t k = 0; k < 4; k++)
-          sum += mats[l][i * 4 + k] * res[k * 4 + j];
-        res[i * 4 + j] = sum;
+          sum += res[i * 4 + k] * mats[l][k * 4 + j];
+        prod[i * 4 + j] = sum;
       }
     }
+    res = prod;
   }
   return res;
 }
@@ -79,14 +92,16 @@ template <typename T> constexpr fsmat compose_fsmats(const T &mats) {
 template <typename T> constexpr smat compose_smats(const T &mats) {
   smat res = mats[0];
   for (std::size_t l = 1; l < mats.size(); l++) {
+    smat prod{};
     for (std::size_t i = 0; i < 3; i++) {
       for (std::size_t j = 0; j < 3; j++) {
         float sum = 0.0;
         for (std::size_t k = 0; k < 3; k++)
-          sum += mats[l][i * 3 + k] * res[k * 3 + j];
-        res[i * 3 + j] = sum;
+          sum += res[i * 3 + k] * mats[l][k * 3 + j];
+        prod[i * 3 + j] = sum;
       }
     }
+    res = prod;
   }
   return res;
 }
@@ -119,49 +134,27 @@ constexpr fsmat to_fsmat(const smat &mat) {
 } // namespace seedimg
 
 namespace simgdetails {
+// pixel bytes a filter reading img and writing an image as large touches,
+// for profiling.
+static inline std::size_t io_bytes(const simg &img) noexcept {
+  return 2 * img->width() * img->height() * sizeof(seedimg::pixel);
+}
+
+// rows are contiguous, so a band of them is handed to the kernel as a
+// single span.
 static inline void apply_mat_worker(simg &inp_img, simg &res_img,
                                     simg_int start, simg_int end,
                                     const seedimg::fsmat &mat) {
-  for (; start < end; ++start) {
-    for (simg_int x = 0; x < inp_img->width(); ++x) {
-      seedimg::pixel pix = inp_img->pixel(x, start);
-      res_img->pixel(x, start).r =
-          static_cast<std::uint8_t>(seedimg::utils::clamp(
-              mat[0] * pix.r + mat[4] * pix.g + mat[8] * pix.b + mat[12], 0,
-              seedimg::img::MAX_PIXEL_VALUE));
-      res_img->pixel(x, start).g =
-          static_cast<std::uint8_t>(seedimg::utils::clamp(
-              mat[1] * pix.r + mat[5] * pix.g + mat[9] * pix.b + mat[13], 0,
-              seedimg::img::MAX_PIXEL_VALUE));
-      res_img->pixel(x, start).b =
-          static_cast<std::uint8_t>(seedimg::utils::clamp(
-              mat[2] * pix.r + mat[6] * pix.g + mat[10] * pix.b + mat[14], 0,
-              seedimg::img::MAX_PIXEL_VALUE));
-    }
-  }
+  simd::apply_mat_best()(inp_img->row(start), res_img->row(start),
+                         (end - start) * inp_img->width(), mat);
 }
 
 static inline void apply_mat_lut_worker(simg &inp_img, simg &res_img,
                                         simg_int start, simg_int end,
                                         const seedimg::slut<seedimg::smat> &lut,
                                         const std::array<float, 3> vec) {
-  for (; start < end; ++start) {
-    for (simg_int x = 0; x < inp_img->width(); ++x) {
-      seedimg::pixel pix = inp_img->pixel(x, start);
-      res_img->pixel(x, start).r =
-          static_cast<std::uint8_t>(seedimg::utils::clamp(
-              vec[0] + lut[0][pix.r] + lut[3][pix.g] + lut[6][pix.b], 0,
-              seedimg::img::MAX_PIXEL_VALUE));
-      res_img->pixel(x, start).g =
-          static_cast<std::uint8_t>(seedimg::utils::clamp(
-              vec[1] + lut[1][pix.r] + lut[4][pix.g] + lut[7][pix.b], 0,
-              seedimg::img::MAX_PIXEL_VALUE));
-      res_img->pixel(x, start).b =
-          static_cast<std::uint8_t>(seedimg::utils::clamp(
-              vec[2] + lut[2][pix.r] + lut[5][pix.g] + lut[8][pix.b], 0,
-              seedimg::img::MAX_PIXEL_VALUE));
-    }
-  }
+  simd::apply_mat_lut_best()(inp_img->row(start), res_img->row(start),
+                             (end - start) * inp_img->width(), lut, vec);
 }
 
 static inline void grayscale_worker_luminosity(simg &inp_img, simg &res_img,
@@ -259,146 +252,108 @@ static inline void pixel_add_worker(simg &image, simg &other,
   }
 }
 
-static inline void horizontal_blur_i_single_worker(simg &inp_img, simg &res_img,
-                                                   simg_int start, simg_int end,
-                                                   unsigned int blur_level) {
+// mean of the pixels in [i - r + 1, i + r] clipped to [0, n), along rows for
+// the horizontal pass and along columns for the vertical one. both passes
+// run over whole rows: the vertical one keeps a running sum per column and
+// channel, which every row of the band is added to and subtracted from.
+
+// vertical pass over output rows [start, end). row(y) is input row y.
+template <typename Rows>
+static inline void box_blur_columns(Rows &&row, seedimg::pixel *const *out,
+                                    simg_int width, simg_int height,
+                                    simg_int start, simg_int end, simg_int r) {
+  std::vector<std::uint32_t> sums(width * 4, 0);
+  simg_int lo = start > r - 1 ? start - r + 1 : 0;
+  simg_int hi = std::min(start + r, height - 1);
+  for (simg_int y = lo; y <= hi; ++y)
+    simd::box_sum_add(sums.data(), row(y), width);
   for (simg_int y = start; y < end; ++y) {
-    simg_int r = 0, g = 0, b = 0;
-    for (simg_int i = 0; i <= blur_level; ++i) {
-      auto pix = inp_img->pixel(i, y);
-      r += pix.r;
-      g += pix.g;
-      b += pix.b;
-    }
-    res_img->pixel(0, y) = {{static_cast<std::uint8_t>(r / (blur_level + 1))},
-                            {static_cast<std::uint8_t>(g / (blur_level + 1))},
-                            {static_cast<std::uint8_t>(b / (blur_level + 1))},
-                            inp_img->pixel(0, y).a};
-    for (simg_int x = 1; x < blur_level; ++x) {
-      simg_int sbl = x + blur_level + 1;
-      auto pix = inp_img->pixel(x + blur_level, y);
-      r += pix.r;
-      g += pix.g;
-      b += pix.b;
-      res_img->pixel(x, y) = {{static_cast<std::uint8_t>(r / sbl)},
-                              {static_cast<std::uint8_t>(g / sbl)},
-                              {static_cast<std::uint8_t>(b / sbl)},
-                              inp_img->pixel(x, y).a};
-    }
-    for (simg_int x = blur_level; x < inp_img->width() - blur_level; ++x) {
-      auto pix = inp_img->pixel(x + blur_level, y);
-      auto prev = inp_img->pixel(x - blur_level, y);
-      r = static_cast<simg_int>(std::max(
-          static_cast<int_fast64_t>(0), static_cast<int_fast64_t>(r) +
-                                            static_cast<int_fast64_t>(pix.r) -
-                                            static_cast<int_fast64_t>(prev.r)));
-      g = static_cast<simg_int>(std::max(
-          static_cast<int_fast64_t>(0), static_cast<int_fast64_t>(g) +
-                                            static_cast<int_fast64_t>(pix.g) -
-                                            static_cast<int_fast64_t>(prev.g)));
-      b = static_cast<simg_int>(std::max(
-          static_cast<int_fast64_t>(0), static_cast<int_fast64_t>(b) +
-                                            static_cast<int_fast64_t>(pix.b) -
-                                            static_cast<int_fast64_t>(prev.b)));
-
-      res_img->pixel(x, y) = {{static_cast<std::uint8_t>(r / (2 * blur_level))},
-                              {static_cast<std::uint8_t>(g / (2 * blur_level))},
-                              {static_cast<std::uint8_t>(b / (2 * blur_level))},
-                              inp_img->pixel(x, y).a};
-    }
-    for (simg_int x = inp_img->width() - blur_level; x < inp_img->width();
-         ++x) {
-      simg_int ebl = inp_img->width() - x + blur_level - 1;
-      auto pix = inp_img->pixel(x - blur_level, y);
-      r -= pix.r;
-      g -= pix.g;
-      b -= pix.b;
-      res_img->pixel(x, y) = {{static_cast<std::uint8_t>(r / ebl)},
-                              {static_cast<std::uint8_t>(g / ebl)},
-                              {static_cast<std::uint8_t>(b / ebl)},
-                              inp_img->pixel(x, y).a};
+    if (y > start) {
+      if (y + r < height) {
+        simd::box_sum_add(sums.data(), row(y + r), width);
+        hi = y + r;
+      }
+      if (y >= r) {
+        simd::box_sum_sub(sums.data(), row(y - r), width);
+        lo = y - r + 1;
+      }
     }
+    simd::box_sum_store(sums.data(), static_cast<std::uint32_t>(hi - lo + 1),
+                        row(y), out[y - start], width);
   }
 }
 
-static inline void vertical_blur_i_single_worker(simg &inp_img, simg &res_img,
-                                                 simg_int start, simg_int end,
-                                                 unsigned int blur_level) {
-  for (simg_int x = start; x < end; ++x) {
-    simg_int r = 0, g = 0, b = 0;
-    for (simg_int i = 0; i <= blur_level; ++i) {
-      auto pix = inp_img->pixel(x, i);
-      r += pix.r;
-      g += pix.g;
-      b += pix.b;
-    }
-    res_img->pixel(x, 0) = {{static_cast<std::uint8_t>(r / (blur_level + 1))},
-                            {static_cast<std::uint8_t>(g / (blur_level + 1))},
-                            {static_cast<std::uint8_t>(b / (blur_level + 1))},
-                            inp_img->pixel(x, 0).a};
-    for (simg_int y = 1; y < blur_level; ++y) {
-      simg_int sbl = y + blur_level + 1;
-      auto pix = inp_img->pixel(x, y + blur_level);
-      r += pix.r;
-      g += pix.g;
-      b += pix.b;
-      res_img->pixel(x, y) = {{static_cast<std::uint8_t>(r / sbl)},
-                              {static_cast<std::uint8_t>(g / sbl)},
-                              {static_cast<std::uint8_t>(b / sbl)},
-                              inp_img->pixel(x, y).a};
-    }
-    for (simg_int y = blur_level; y < inp_img->height() - blur_level; ++y) {
-      auto pix = inp_img->pixel(x, y + blur_level);
-      auto prev = inp_img->pixel(x, y - blur_level);
-      r = static_cast<simg_int>(std::max(
-          static_cast<int_fast64_t>(0), static_cast<int_fast64_t>(r) +
-                                            static_cast<int_fast64_t>(pix.r) -
-                                            static_cast<int_fast64_t>(prev.r)));
-      g = static_cast<simg_int>(std::max(
-          static_cast<int_fast64_t>(0), static_cast<int_fast64_t>(g) +
-                                            static_cast<int_fast64_t>(pix.g) -
-                                            static_cast<int_fast64_t>(prev.g)));
-      b = static_cast<simg_int>(std::max(
-          static_cast<int_fast64_t>(0), static_cast<int_fast64_t>(b) +
-                                            static_cast<int_fast64_t>(pix.b) -
-                                            static_cast<int_fast64_t>(prev.b)));
-
-      res_img->pixel(x, y) = {{static_cast<std::uint8_t>(r / (2 * blur_level))},
-                              {static_cast<std::uint8_t>(g / (2 * blur_level))},
-                              {static_cast<std::uint8_t>(b / (2 * blur_level))},
-                              inp_img->pixel(x, y).a};
-    }
-    for (simg_int y = inp_img->height() - blur_level; y < inp_img->height();
-         ++y) {
-      simg_int ebl = inp_img->height() - y + blur_level - 1;
-      auto pix = inp_img->pixel(x, y - blur_level);
-      r -= pix.r;
-      g -= pix.g;
-      b -= pix.b;
-      res_img->pixel(x, y) = {{static_cast<std::uint8_t>(r / ebl)},
-                              {static_cast<std::uint8_t>(g / ebl)},
-                              {static_cast<std::uint8_t>(b / ebl)},
-                              inp_img->pixel(x, y).a};
-    }
-  }
+// rows of a band of the vertical pass, at least twice the halo of rows the
+// band has to read from its neighbours.
+static inline std::vector<std::pair<simg_int, simg_int>>
+box_blur_bands(const simg &img, simg_int r) {
+  const simg_int row_bytes =
+      std::max<simg_int>(img->width() * sizeof(seedimg::pixel), 1);
+  const simg_int rows = SIMG_L2_CACHE_SIZE / (4 * row_bytes);
+  return seedimg::utils::split_range(img->height(), std::max(rows, 4 * r));
 }
 
-static inline void horizontal_blur_single_i(simg &inp_img, simg &res_img,
-                                            unsigned int blur_level) {
-  seedimg::utils::hrz_thread(horizontal_blur_i_single_worker, inp_img, res_img,
-                             blur_level);
-}
+// the horizontal pass of a band is kept in this many bytes at most,
+// otherwise the two passes go through the whole image one after the other.
+#ifndef SIMG_BLUR_FUSE_BYTES
+#define SIMG_BLUR_FUSE_BYTES (8 * SIMG_L2_CACHE_SIZE)
+#endif
 
-static inline void vertical_blur_single_i(simg &inp_img, simg &res_img,
-                                          unsigned int blur_level) {
-  seedimg::utils::vrt_thread(vertical_blur_i_single_worker, inp_img, res_img,
-                             blur_level);
-}
+/**
+ * @brief One box blur pass of radius r from inp_img into res_img,
+ * horizontal, vertical or both. inp_img is used as scratch space and may be
+ * swapped with res_img, the result always ends up in res_img.
+ */
+static inline void box_blur(simg &inp_img, simg &res_img, simg_int r,
+                            bool horizontal, bool vertical) {
+  auto &pool = thread_pool::instance();
+  const simg_int width = inp_img->width(), height = inp_img->height();
+
+  if (!vertical) {
+    auto start_end = seedimg::utils::start_end_rows(inp_img);
+    pool.parallel_for(start_end.size(), [&](std::size_t i) {
+      for (simg_int y = start_end[i].first; y < start_end[i].second; ++y)
+        simd::box_blur_row(inp_img->row(y), res_img->row(y), width, r);
+    });
+    return;
+  }
+
+  const auto bands = box_blur_bands(inp_img, r);
+  const simg_int band_rows = bands[0].second + 2 * r;
+  if (!horizontal || band_rows * width * sizeof(seedimg::pixel) >
+                         SIMG_BLUR_FUSE_BYTES) {
+    if (horizontal) {
+      box_blur(inp_img, res_img, r, true, false);
+      std::swap(inp_img, res_img);
+    }
+    pool.parallel_for(bands.size(), [&](std::size_t i) {
+      const auto [start, end] = bands[i];
+      std::vector<seedimg::pixel *> out(end - start);
+      for (simg_int y = start; y < end; ++y)
+        out[y - start] = res_img->row(y);
+      box_blur_columns([&](simg_int y) { return inp_img->row(y); },
+                       out.data(), width, height, start, end, r);
+    });
+    return;
+  }
 
-static inline void box_blur_single(simg &inp_img, simg &res_img,
-                                   unsigned int blur_level) {
-  horizontal_blur_single_i(inp_img, res_img, blur_level);
-  vertical_blur_single_i(res_img, inp_img, blur_level);
+  // fused: every band blurs the rows it needs horizontally into a buffer
+  // that stays in cache, then blurs that vertically into the output.
+  pool.parallel_for(bands.size(), [&](std::size_t i) {
+    const auto [start, end] = bands[i];
+    const simg_int first = start > r - 1 ? start - r + 1 : 0;
+    const simg_int last = std::min(end + r, height);
+    std::vector<seedimg::pixel> rows((last - first) * width);
+    for (simg_int y = first; y < last; ++y)
+      simd::box_blur_row(inp_img->row(y), rows.data() + (y - first) * width,
+                         width, r);
+    std::vector<seedimg::pixel *> out(end - start);
+    for (simg_int y = start; y < end; ++y)
+      out[y - start] = res_img->row(y);
+    box_blur_columns(
+        [&](simg_int y) { return rows.data() + (y - first) * width; },
+        out.data(), width, height, start, end, r);
+  });
 }
 
 static inline unsigned int clamped_blur_level(unsigned int blur_level,
@@ -439,6 +394,109 @@ static inline std::uint8_t diff(std::uint8_t a, std::uint8_t b) {
   return static_cast<std::uint8_t>(std::abs(int(a) - int(b)));
 }
 
+// output is walked in tiles of this many pixels squared, small enough that
+// the input rows a tile reads stay in L1.
+constexpr simg_int rotate_tile = 16;
+
+// rotates output rows [start, end) a quarter turn, res(x, y) is
+// inp(y, h - 1 - x) clockwise and inp(w - 1 - y, x) counter clockwise.
+// every 4x4 block of a tile is transposed in registers.
+static inline void rotate_worker(simg &inp_img, simg &res_img, simg_int start,
+                                 simg_int end, bool cw) {
+  const simg_int iw = inp_img->width(), ih = inp_img->height();
+  const simg_int width = res_img->width();
+  auto source = [&](simg_int x, simg_int y) -> const seedimg::pixel & {
+    return cw ? inp_img->pixel(y, ih - x - 1) : inp_img->pixel(iw - y - 1, x);
+  };
+
+  for (simg_int ty = start; ty < end; ty += rotate_tile) {
+    const simg_int y1 = std::min(ty + rotate_tile, end);
+    for (simg_int tx = 0; tx < width; tx += rotate_tile) {
+      const simg_int x1 = std::min(tx + rotate_tile, width);
+      simg_int by = ty;
+      for (; by + 4 <= y1; by += 4) {
+        simg_int bx = tx;
+        for (; bx + 4 <= x1; bx += 4) {
+          if (cw) {
+            simd::transpose4({inp_img->row(ih - bx - 1) + by,
+                              inp_img->row(ih - bx - 2) + by,
+                              inp_img->row(ih - bx - 3) + by,
+                              inp_img->row(ih - bx - 4) + by},
+                             {res_img->row(by) + bx, res_img->row(by + 1) + bx,
+                              res_img->row(by + 2) + bx,
+                              res_img->row(by + 3) + bx});
+          } else {
+            simd::transpose4(
+                {inp_img->row(bx) + (iw - by - 4),
+                 inp_img->row(bx + 1) + (iw - by - 4),
+                 inp_img->row(bx + 2) + (iw - by - 4),
+                 inp_img->row(bx + 3) + (iw - by - 4)},
+                {res_img->row(by + 3) + bx, res_img->row(by + 2) + bx,
+                 res_img->row(by + 1) + bx, res_img->row(by) + bx});
+          }
+        }
+        for (; bx < x1; ++bx)
+          for (simg_int y = by; y < by + 4; ++y)
+            res_img->pixel(bx, y) = source(bx, y);
+      }
+      for (; by < y1; ++by)
+        for (simg_int x = tx; x < x1; ++x)
+          res_img->pixel(x, by) = source(x, by);
+    }
+  }
+}
+
+static inline void rotate_quarter(simg &inp_img, simg &res_img, bool cw) {
+  // bands are whole tiles tall, see start_end_rows.
+  const simg_int row_bytes =
+      std::max<simg_int>(res_img->width() * sizeof(seedimg::pixel), 1);
+  simg_int rows = SIMG_L2_CACHE_SIZE / (4 * row_bytes);
+  rows = std::max(rows - rows % rotate_tile, rotate_tile);
+  const auto start_end = seedimg::utils::split_range(res_img->height(), rows);
+  thread_pool::instance().parallel_for(start_end.size(), [&](std::size_t i) {
+    rotate_worker(inp_img, res_img, start_end[i].first, start_end[i].second,
+                  cw);
+  });
+}
+
+// transposes a square image in place, block (x, y) is swapped with block
+// (y, x). a task takes one row of tiles, right of the diagonal, together
+// with the column of tiles they are swapped with, so no two tasks touch the
+// same block.
+static inline void transpose_square_i(simg &img) {
+  const simg_int n = img->width();
+  const simg_int ntiles = (n + rotate_tile - 1) / rotate_tile;
+  thread_pool::instance().parallel_for(ntiles, [&](std::size_t t) {
+    const simg_int ty = t * rotate_tile;
+    const simg_int y1 = std::min(ty + rotate_tile, n);
+    for (simg_int tx = ty; tx < n; tx += rotate_tile) {
+      const simg_int x1 = std::min(tx + rotate_tile, n);
+      for (simg_int by = ty; by < y1; by += 4) {
+        for (simg_int bx = tx == ty ? by : tx; bx < x1; bx += 4) {
+          if (bx + 4 <= n && by + 4 <= n) {
+            seedimg::pixel a[4][4], b[4][4];
+            simd::transpose4({img->row(by) + bx, img->row(by + 1) + bx,
+                              img->row(by + 2) + bx, img->row(by + 3) + bx},
+                             {a[0], a[1], a[2], a[3]});
+            simd::transpose4({img->row(bx) + by, img->row(bx + 1) + by,
+                              img->row(bx + 2) + by, img->row(bx + 3) + by},
+                             {b[0], b[1], b[2], b[3]});
+            for (simg_int i = 0; i < 4; ++i) {
+              std::copy(a[i], a[i] + 4, img->row(bx + i) + by);
+              std::copy(b[i], b[i] + 4, img->row(by + i) + bx);
+            }
+          } else {
+            for (simg_int y = by; y < std::min(by + 4, n); ++y)
+              for (simg_int x = std::max(bx, y + 1); x < std::min(bx + 4, n);
+                   ++x)
+                std::swap(img->pixel(x, y), img->pixel(y, x));
+          }
+        }
+      }
+    }
+  });
+}
+
 } // namespace simgdetails
 
 namespace seedimg::filters {
@@ -453,6 +511,7 @@ static constexpr smat const GRAYSCALE_LUM_MAT = {0.2126f, 0.2126f, 0.2126f,
 // save unnecessary files.
 // Current list: sepia, rotate_hue, grayscale
 static inline void apply_mat(simg &inp_img, simg &res_img, const fsmat &mat) {
+  simgdetails::profile_scope prof("apply_mat", simgdetails::io_bytes(inp_img));
   seedimg::utils::hrz_thread(simgdetails::apply_mat_worker, inp_img, res_img,
                              mat);
 }
@@ -470,6 +529,8 @@ static inline void apply_mat_i(simg &inp_img, const smat &mat) {
 static inline void apply_mat_lut(simg &inp_img, simg &res_img,
                                  const seedimg::slut<seedimg::smat> &lut,
                                  const lutvec &vec = {0, 0, 0}) {
+  simgdetails::profile_scope prof("apply_mat_lut",
+                                  simgdetails::io_bytes(inp_img));
   seedimg::utils::hrz_thread(simgdetails::apply_mat_lut_worker, inp_img,
                              res_img, lut, vec);
 }
@@ -481,6 +542,7 @@ static inline void apply_mat_lut_i(simg &inp_img,
 
 static inline void grayscale(simg &inp_img, simg &res_img,
                              bool luminosity = true) {
+  simgdetails::profile_scope prof("grayscale", simgdetails::io_bytes(inp_img));
   if (luminosity) {
     seedimg::utils::hrz_thread(simgdetails::grayscale_worker_luminosity,
                                inp_img, res_img);
@@ -495,10 +557,12 @@ static inline void grayscale_i(simg &inp_img, bool luminosity = true) {
 }
 
 static inline void invert(simg &inp_img, simg &res_img) {
+  simgdetails::profile_scope prof("invert", simgdetails::io_bytes(inp_img));
   seedimg::utils::hrz_thread(simgdetails::invert_worker, inp_img, res_img);
 }
 static inline void invert_a(simg &inp_img, simg &res_img,
                             bool invert_alpha_only = false) {
+  simgdetails::profile_scope prof("invert_a", simgdetails::io_bytes(inp_img));
   if (invert_alpha_only) {
     seedimg::utils::hrz_thread(simgdetails::invert_worker_alpha_only, inp_img,
                                res_img);
@@ -512,14 +576,16 @@ static inline void invert_a_i(simg &inp_img, bool invert_alpha_only = false) {
   invert_a(inp_img, inp_img, invert_alpha_only);
 }
 
+/**
+ * @brief Rotate an image a quarter turn clockwise, res_img must be
+ * inp_img's height wide and its width tall.
+ */
 static inline void rotate_cw(simg &inp_img, simg &res_img) {
-  for (simg_int y = 0; y < res_img->height(); ++y) {
-    for (simg_int x = 0; x < res_img->width(); ++x) {
-      res_img->pixel(x, y) = inp_img->pixel(res_img->height() - y - 1, x);
-    }
-  }
+  simgdetails::profile_scope prof("rotate_cw", simgdetails::io_bytes(inp_img));
+  simgdetails::rotate_quarter(inp_img, res_img, true);
 }
 static inline void rotate_180(simg &inp_img, simg &res_img) {
+  simgdetails::profile_scope prof("rotate_180", simgdetails::io_bytes(inp_img));
   for (simg_int y = 0; y < inp_img->height(); ++y) {
     for (simg_int x = 0; x < inp_img->width(); ++x) {
       res_img->pixel(x, y) =
@@ -527,38 +593,72 @@ static inline void rotate_180(simg &inp_img, simg &res_img) {
     }
   }
 }
+/**
+ * @brief Rotate an image a quarter turn counter clockwise, res_img must be
+ * inp_img's height wide and its width tall.
+ */
 static inline void rotate_ccw(simg &inp_img, simg &res_img) {
-  for (simg_int y = 0; y < res_img->height(); ++y) {
-    for (simg_int x = 0; x < res_img->width(); ++x) {
-      res_img->pixel(x, y) = inp_img->pixel(y, x);
-    }
-  }
+  simgdetails::profile_scope prof("rotate_ccw", simgdetails::io_bytes(inp_img));
+  simgdetails::rotate_quarter(inp_img, res_img, false);
 }
 
 static inline void rotate_cw_i(simg &inp_img) {
+  simgdetails::profile_scope prof("rotate_cw_i",
+                                  simgdetails::io_bytes(inp_img));
+  if (inp_img->width() == inp_img->height()) {
+    // a transpose followed by mirroring every row.
+    simgdetails::transpose_square_i(inp_img);
+    auto start_end = seedimg::utils::start_end_rows(inp_img);
+    simgdetails::thread_pool::instance().parallel_for(
+        start_end.size(), [&](std::size_t i) {
+          for (simg_int y = start_end[i].first; y < start_end[i].second; ++y)
+            std::reverse(inp_img->row(y), inp_img->row(y) + inp_img->width());
+        });
+    return;
+  }
   simg res_img = seedimg::make(inp_img->height(), inp_img->width());
   rotate_cw(inp_img, res_img);
   inp_img.reset(res_img.release());
 }
 
 static inline void rotate_180_i(simg &inp_img) {
+  simgdetails::profile_scope prof("rotate_180_i",
+                                  simgdetails::io_bytes(inp_img));
   // reverse each row
   std::reverse(inp_img->data(),
                inp_img->data() + inp_img->width() * inp_img->height());
 }
 static inline void rotate_ccw_i(simg &inp_img) {
+  simgdetails::profile_scope prof("rotate_ccw_i",
+                                  simgdetails::io_bytes(inp_img));
+  if (inp_img->width() == inp_img->height()) {
+    // a transpose followed by swapping the order of the rows.
+    simgdetails::transpose_square_i(inp_img);
+    const simg_int n = inp_img->height();
+    auto start_end =
+        seedimg::utils::split_range(n / 2, simgdetails::rotate_tile);
+    simgdetails::thread_pool::instance().parallel_for(
+        start_end.size(), [&](std::size_t i) {
+          for (simg_int y = start_end[i].first; y < start_end[i].second; ++y)
+            std::swap_ranges(inp_img->row(y), inp_img->row(y) + n,
+                             inp_img->row(n - y - 1));
+        });
+    return;
+  }
   simg res_img = seedimg::make(inp_img->height(), inp_img->width());
   rotate_ccw(inp_img, res_img);
   inp_img.reset(res_img.release());
 }
 
 static inline void v_mirror(simg &inp_img, simg &res_img) {
+  simgdetails::profile_scope prof("v_mirror", simgdetails::io_bytes(inp_img));
   for (simg_int y = 0; y < inp_img->height(); ++y) {
     std::copy(inp_img->row(y), inp_img->row(y) + inp_img->width(),
               res_img->row(res_img->height() - y - 1));
   }
 }
 static inline void h_mirror(simg &inp_img, simg &res_img) {
+  simgdetails::profile_scope prof("h_mirror", simgdetails::io_bytes(inp_img));
   for (simg_int y = 0; y < res_img->height(); ++y) {
     for (simg_int x = 0; x < res_img->width(); ++x) {
       res_img->pixel(inp_img->width() - x - 1, y) = inp_img->pixel(x, y);
@@ -566,6 +666,7 @@ static inline void h_mirror(simg &inp_img, simg &res_img) {
   }
 }
 static inline void v_mirror_i(simg &inp_img) {
+  simgdetails::profile_scope prof("v_mirror_i", simgdetails::io_bytes(inp_img));
   simg_int h = inp_img->height();
   simg_int w = inp_img->width();
   seedimg::pixel *row = new seedimg::pixel[w];
@@ -582,6 +683,7 @@ static inline void v_mirror_i(simg &inp_img) {
   delete[] row;
 }
 static inline void h_mirror_i(simg &inp_img) {
+  simgdetails::profile_scope prof("h_mirror_i", simgdetails::io_bytes(inp_img));
   for (simg_int y = 0; y < inp_img->height(); ++y) {
     std::reverse(inp_img->row(y), inp_img->row(y) + inp_img->width());
   }
@@ -589,6 +691,7 @@ static inline void h_mirror_i(simg &inp_img) {
 
 static inline bool crop(simg &inp_img, simg &res_img, seedimg::point p1,
                         seedimg::point p2) {
+  simgdetails::profile_scope prof("crop", simgdetails::io_bytes(res_img));
   if (p1 == seedimg::point{0, 0} &&
       p2 == seedimg::point{inp_img->width(), inp_img->height()}) {
     return true;
@@ -612,6 +715,7 @@ static inline bool crop(simg &inp_img, simg &res_img, seedimg::point p1,
 }
 
 static inline bool crop_i(simg &inp_img, seedimg::point p1, seedimg::point p2) {
+  simgdetails::profile_scope prof("crop_i", simgdetails::io_bytes(inp_img));
   seedimg::uimg *unmanaged = static_cast<seedimg::uimg *>(inp_img.get());
   if (p1 == seedimg::point{0, 0} &&
       p2 == seedimg::point{unmanaged->width(), unmanaged->height()}) {
@@ -626,76 +730,78 @@ static inline bool crop_i(simg &inp_img, seedimg::point p1, seedimg::point p2) {
 
   auto dims = seedimg::utils::get_rect_dimensions(p1, p2);
 
-  // width is dims.x, height is dims.y.
+  // width is dims.x, height is dims.y. the old buffer may be borrowed or
+  // mapped, so the cropped one always comes from the default allocator.
+  auto &alloc = seedimg::default_allocator();
+  auto *cropped = static_cast<seedimg::pixel *>(
+      alloc.allocate(dims.x * dims.y * sizeof(seedimg::pixel)));
   for (simg_int y = 0; y < dims.y; ++y) {
-    std::memmove(unmanaged->data() + y * dims.x,
-                 unmanaged->row(y + least_crop_y) + least_crop_x,
-                 dims.x * sizeof(seedimg::pixel));
+    std::memcpy(cropped + y * dims.x,
+                unmanaged->row(y + least_crop_y) + least_crop_x,
+                dims.x * sizeof(seedimg::pixel));
   }
 
+  unmanaged->get_allocator().deallocate(
+      unmanaged->data(),
+      unmanaged->width() * unmanaged->height() * sizeof(seedimg::pixel));
+  unmanaged->set_data(cropped);
+  unmanaged->set_allocator(alloc);
   unmanaged->set_width(dims.x);
   unmanaged->set_height(dims.y);
-
-  auto *tmp = static_cast<seedimg::pixel *>(
-      std::realloc(unmanaged->data(), unmanaged->width() * unmanaged->height() *
-                                          sizeof(seedimg::pixel)));
-  if (tmp == nullptr)
-    throw std::bad_alloc{};
-  unmanaged->set_data(tmp);
   return true;
 }
 
 static inline void blur_i(simg &inp_img, unsigned int blur_level,
                           std::uint8_t it = 3) {
+  simgdetails::profile_scope prof("blur_i",
+                                  simgdetails::io_bytes(inp_img) * it);
   if (blur_level == 0)
     return;
   blur_level = simgdetails::clamped_blur_level(blur_level, inp_img->width(),
                                                inp_img->height());
-  auto res_img = seedimg::make(inp_img->width(), inp_img->height());
+  auto res_img = std::make_unique<seedimg::img>(
+      inp_img->width(), inp_img->height(), inp_img->colourspace());
   for (std::uint8_t i = 0; i < it; ++i) {
-    simgdetails::box_blur_single(inp_img, res_img, blur_level);
+    simgdetails::box_blur(inp_img, res_img, blur_level, true, true);
+    std::swap(inp_img, res_img);
   }
 }
 
 static inline void h_blur_i(simg &inp_img, unsigned int blur_level,
                             std::uint8_t it = 3) {
+  simgdetails::profile_scope prof("h_blur_i",
+                                  simgdetails::io_bytes(inp_img) * it);
   if (blur_level == 0)
     return;
   blur_level = simgdetails::clamped_blur_level(blur_level, inp_img->width(),
                                                inp_img->height());
-  auto res_img = seedimg::make(inp_img->width(), inp_img->height());
+  auto res_img = std::make_unique<seedimg::img>(
+      inp_img->width(), inp_img->height(), inp_img->colourspace());
   for (std::uint8_t i = 0; i < it; ++i) {
-    if (i % 2 == 0) {
-      simgdetails::horizontal_blur_single_i(inp_img, res_img, blur_level);
-    } else {
-      simgdetails::horizontal_blur_single_i(res_img, inp_img, blur_level);
-    }
+    simgdetails::box_blur(inp_img, res_img, blur_level, true, false);
+    std::swap(inp_img, res_img);
   }
-  if (it % 2 == 0 || it == 1)
-    inp_img.reset(res_img.release());
 }
 
 static inline void v_blur_i(simg &inp_img, unsigned int blur_level,
                             std::uint8_t it = 3) {
+  simgdetails::profile_scope prof("v_blur_i",
+                                  simgdetails::io_bytes(inp_img) * it);
   if (blur_level == 0)
     return;
   blur_level = simgdetails::clamped_blur_level(blur_level, inp_img->width(),
                                                inp_img->height());
-
-  auto res_img = seedimg::make(inp_img->width(), inp_img->height());
+  auto res_img = std::make_unique<seedimg::img>(
+      inp_img->width(), inp_img->height(), inp_img->colourspace());
   for (std::uint8_t i = 0; i < it; ++i) {
-    if (i % 2 == 0) {
-      simgdetails::vertical_blur_single_i(inp_img, res_img, blur_level);
-    } else {
-      simgdetails::vertical_blur_single_i(res_img, inp_img, blur_level);
-    }
+    simgdetails::box_blur(inp_img, res_img, blur_level, false, true);
+    std::swap(inp_img, res_img);
   }
-
-  if (it % 2 == 0 || it == 1)
-    inp_img.reset(res_img.release());
 }
 
 void difference(simg &input, simg &output, simg &other, bool alpha = false) {
+  simgdetails::profile_scope prof("difference",
+                                  simgdetails::io_bytes(input) * 3 / 2);
   using namespace simgdetails;
   for (simg_int y = 0; y < input->height(); ++y) {
     if (alpha) {
@@ -723,79 +829,74 @@ void difference_i(simg &img, simg &other, bool alpha = false) {
   difference(img, img, other, alpha);
 }
 
-/** Apply a square kernel convolution to an image.
- * NOTE: if weren't a square kernel, the image stays intact.
+/** Apply a kernel convolution to an image.
+ * NOTE: if the rows of the kernel differ in length, the image is copied
+ * intact.
  * NOTE: alpha is passed-as it is, it's not convoluted.
+ * NOTE: input and output may be the same image.
  */
-static inline void convolution(simg &input,
-                               std::vector<std::vector<float>> kernel) {
-  if (kernel.size() == 0 || kernel[0].size() == 0)
+static inline void convolution(simg &input, simg &output,
+                               const std::vector<std::vector<float>> &kernel) {
+  // every band reads the rows around its own, which other bands would
+  // already have overwritten. convolve into a scratch image instead.
+  if (input->data() == output->data()) {
+    auto res_img = std::make_unique<seedimg::img>(
+        input->width(), input->height(), input->colourspace());
+    convolution(input, res_img, kernel);
+    std::copy(res_img->data(),
+              res_img->data() + res_img->width() * res_img->height(),
+              output->data());
     return;
+  }
+  simgdetails::profile_scope prof("convolution", simgdetails::io_bytes(input));
+  auto k = simgdetails::conv::prepare_kernel(kernel);
+  if (!k) {
+    if (input != output)
+      std::copy(input->data(),
+                input->data() + input->width() * input->height(),
+                output->data());
+    return;
+  }
 
-  simg_int kw = kernel[0].size();
-  simg_int kh = kernel.size();
-
-  float neg_sum = 0.0f, pos_sum = 0.0f;
-
-  for (const auto &r : kernel)
-    for (auto e : r)
-      if (std::signbit(e))
-        neg_sum -= e;
-      else
-        pos_sum += e;
-
-  // approximated the center coordinate of kernel, for a symmetric one
-  // the origin is the current pixel.
-  simg_int ko_x = kw / 2, ko_y = kh / 2;
-
-  // normalised kernel.
-  std::vector<std::vector<float>> norm_kernel(kh, std::vector<float>(kw, 0.0));
-
-  // flip the kernel both vertically and horizontally +
-  // normalise all the elements.
-  for (simg_int y = 0; y < kh; ++y)
-    for (simg_int x = 0; x < kw; ++x)
-      norm_kernel[kh - y - 1][kw - x - 1] =
-          kernel[y][x] / (std::signbit(kernel[y][x]) ? neg_sum : pos_sum);
-
-  for (simg_int y = 0; y < input->height(); ++y) {
-    for (simg_int x = 0; x < input->width(); ++x) {
-      struct {
-        float r = 0, g = 0, b = 0, a = 0;
-      } o;
-
-      for (std::size_t dy = 0; dy < kh; ++dy) {
-        for (std::size_t dx = 0; dx < kw; ++dx) {
-          // When the 2D sliding window is at the edge of the image plane,
-          // the edges of the kernel fall outside the bound, to conceal that
-          // a mixture of wrapping and mirroring is used.
-          auto pix = input->pixel(
-              static_cast<simg_int>(
-                  static_cast<unsigned long long>(std::llabs(
-                      static_cast<long long>(x) + static_cast<long long>(dx) -
-                      static_cast<long long>(ko_x))) %
-                  input->width()),
-              static_cast<simg_int>(
-                  static_cast<unsigned long long>(std::llabs(
-                      static_cast<long long>(y) + static_cast<long long>(dy) -
-                      static_cast<long long>(ko_y))) %
-                  input->height()));
-
-          o.r += static_cast<float>(pix.r) * norm_kernel[dy][dx];
-          o.g += static_cast<float>(pix.g) * norm_kernel[dy][dx];
-          o.b += static_cast<float>(pix.b) * norm_kernel[dy][dx];
-          // o.a += static_cast<float>(pix.a) * norm_kernel[dy][dx];
-        }
-      }
-
-      using namespace seedimg::utils;
+  // rank-1 kernels are the cheapest as two 1-D passes, big dense ones in
+  // the frequency domain.
+  if (auto vectors = simgdetails::conv::separate(*k))
+    simgdetails::conv::separable(input, output, *k, vectors->first,
+                                 vectors->second);
+  else if (k->w * k->h >= SIMG_CONV_FFT_TAPS)
+    simgdetails::conv::fft(input, output, *k);
+  else
+    simgdetails::conv::direct(input, output, *k);
+}
+static inline void convolution(simg &input,
+                               const std::vector<std::vector<float>> &kernel) {
+  // the result replaces input, it has to stay in the same colourspace.
+  auto res_img = std::make_unique<seedimg::img>(
+      input->width(), input->height(), input->colourspace());
+  convolution(input, res_img, kernel);
+  input.reset(res_img.release());
+}
 
-      input->pixel(x, y) = {{static_cast<std::uint8_t>(clamp(o.r, 0, 255))},
-                            {static_cast<std::uint8_t>(clamp(o.g, 0, 255))},
-                            {static_cast<std::uint8_t>(clamp(o.b, 0, 255))},
-                            static_cast<std::uint8_t>(clamp(o.a, 0, 255))};
-    }
-  }
+/**
+ * @brief Resample inp_img to the dimensions of res_img, in two separable
+ * passes with fixed point weights. Exact 2x and 4x shrinks with the area
+ * filter take a faster path which averages blocks of pixels.
+ */
+static inline void
+resize(simg &inp_img, simg &res_img,
+       resample_filter filter = resample_filter::bicubic) {
+  simgdetails::profile_scope prof(
+      "resize", (inp_img->width() * inp_img->height() +
+                 res_img->width() * res_img->height()) *
+                    sizeof(seedimg::pixel));
+  simgdetails::resample::resize(inp_img, res_img, filter);
+}
+static inline void
+resize_i(simg &image, simg_int width, simg_int height,
+         resample_filter filter = resample_filter::bicubic) {
+  auto res_img = seedimg::make(width, height);
+  resize(image, res_img, filter);
+  image.reset(res_img.release());
 }
 
 constexpr seedimg::fsmat generate_brightness_mat(float intensity) {
@@ -816,6 +917,7 @@ static inline void brightness_i(simg &image, int intensity) {
 }
 
 static inline void brightness_a(simg &input, simg &output, int intensity) {
+  simgdetails::profile_scope prof("brightness_a", simgdetails::io_bytes(input));
   seedimg::utils::hrz_thread(simgdetails::brightness_alpha_worker, input,
                              output, intensity);
 }
@@ -826,15 +928,18 @@ static inline void brightness_a_i(simg &image, int intensity) {
 static inline void blend(std::pair<simg &, const std::uint8_t> input,
                          std::pair<simg &, const std::uint8_t> other,
                          simg &output) {
+  simgdetails::profile_scope prof("blend",
+                                  simgdetails::io_bytes(input.first) * 3 / 2);
   if (input.first->width() != other.first->width() ||
       input.first->height() != other.first->height())
     return;
 
-  // reduce the image gain as needed.
+  // reduce the image gain as needed. other is scaled into a copy, it may
+  // be shared with other calls running at the same time.
+  auto scaled = seedimg::make(other.first->width(), other.first->height());
   brightness_a(input.first, output, input.second);
-  brightness_a_i(other.first, other.second);
-  seedimg::utils::hrz_thread(simgdetails::pixel_add_worker, output,
-                             other.first);
+  brightness_a(other.first, scaled, other.second);
+  seedimg::utils::hrz_thread(simgdetails::pixel_add_worker, output, scaled);
 }
 static inline void blend_i(std::pair<simg &, const std::uint8_t> input,
                            std::pair<simg &, const std::uint8_t> other) {
@@ -892,6 +997,7 @@ constexpr seedimg::fsmat generate_saturation_mat(float mul) {
 
 // HSV colourspace filters
 static inline void saturation(simg &inp_img, simg &res_img, float mul) {
+  simgdetails::profile_scope prof("saturation", simgdetails::io_bytes(inp_img));
   if (inp_img->colourspace() == seedimg::colourspaces::hsv) {
     seedimg::utils::hrz_thread(simgdetails::saturation_worker, inp_img, res_img,
                                mul);
@@ -1063,6 +1169,7 @@ static constexpr seedimg::slut<seedimg::smat> const ycbcr_bt601_rgb_lut =
     seedimg::utils::gen_lut(ycbcr_bt601_rgb_mat);
 
 static inline void rgb(simg &inp_img, simg &res_img) {
+  simgdetails::profile_scope prof("cconv::rgb", simgdetails::io_bytes(inp_img));
   if (inp_img->colourspace() == seedimg::colourspaces::rgb) {
     return;
   } else if (inp_img->colourspace() == seedimg::colourspaces::hsv) {
@@ -1082,6 +1189,7 @@ static inline void rgb(simg &inp_img, simg &res_img) {
 static inline void rgb_i(simg &inp_img) { rgb(inp_img, inp_img); }
 
 static inline void hsv(simg &inp_img, simg &res_img) {
+  simgdetails::profile_scope prof("cconv::hsv", simgdetails::io_bytes(inp_img));
   if (inp_img->colourspace() == seedimg::colourspaces::hsv) {
     return;
   } else if (inp_img->colourspace() == seedimg::colourspaces::rgb) {
@@ -1099,6 +1207,8 @@ static inline void hsv_i(simg &inp_img) { hsv(inp_img, inp_img); }
 
 static inline void ycbcr(simg &inp_img, simg &res_img,
                          seedimg::colourspaces type) {
+  simgdetails::profile_scope prof("cconv::ycbcr",
+                                  simgdetails::io_bytes(inp_img));
   if (inp_img->colourspace() == seedimg::colourspaces::ycbcr_jpeg ||
       inp_img->colourspace() == seedimg::colourspaces::ycbcr_bt601) {
     return;
@@ -1122,7 +1232,152 @@ static inline void ycbcr_i(simg &inp_img, seedimg::colourspaces type) {
 
 } // namespace seedimg::filters::cconv
 
+namespace simgdetails {
+// a filter restricted to rows [start, end), this is what the workers above
+// look like once their extra arguments are bound.
+typedef std::function<void(simg &, simg &, simg_int, simg_int)> row_filter;
+
+/**
+ * @brief A filter queued in a filterchain. Besides the bound call itself it
+ * may describe the filter as a colour matrix, or as a row-local worker, for
+ * the colourspace the image is in when the chain reaches it. Steps that can
+ * do neither are opaque and always run through func.
+ */
+struct chain_step {
+  std::function<void(simg &, simg &)> func;
+  std::function<std::optional<seedimg::fsmat>(seedimg::colourspaces)> mat;
+  std::function<row_filter(seedimg::colourspaces)> rows;
+};
+
+// the steps below recognise filters by address, anything else is opaque.
+template <class F, class... Args>
+static inline void describe_step(chain_step &, F &&, Args &&...) {}
+
+template <class A>
+static inline void describe_step(chain_step &step,
+                                 void (*func)(simg &, simg &, const seedimg::fsmat &),
+                                 A &&mat) {
+  if (func != static_cast<void (*)(simg &, simg &, const seedimg::fsmat &)>(
+                  seedimg::filters::apply_mat))
+    return;
+  seedimg::fsmat m = mat;
+  step.mat = [m](seedimg::colourspaces) { return std::optional{m}; };
+}
+
+template <class A>
+static inline void describe_step(chain_step &step,
+                                 void (*func)(simg &, simg &, const seedimg::smat &),
+                                 A &&mat) {
+  if (func != static_cast<void (*)(simg &, simg &, const seedimg::smat &)>(
+                  seedimg::filters::apply_mat))
+    return;
+  seedimg::fsmat m = seedimg::filters::to_fsmat(mat);
+  step.mat = [m](seedimg::colourspaces) { return std::optional{m}; };
+}
+
+static inline void describe_step(chain_step &step,
+                                 void (*func)(simg &, simg &)) {
+  using namespace seedimg::filters;
+  if (func == sepia) {
+    step.mat = [](seedimg::colourspaces) {
+      return std::optional{to_fsmat(SEPIA_MAT)};
+    };
+  } else if (func == invert) {
+    step.rows = [](seedimg::colourspaces) -> row_filter {
+      return invert_worker;
+    };
+  }
+}
+
+template <class A>
+static inline void describe_step(chain_step &step,
+                                 void (*func)(simg &, simg &, int), A &&arg) {
+  using namespace seedimg::filters;
+  const int v = static_cast<int>(arg);
+  if (func == brightness) {
+    step.mat = [v](seedimg::colourspaces) {
+      return std::optional{generate_brightness_mat(v)};
+    };
+  } else if (func == rotate_hue) {
+    step.mat = [v](seedimg::colourspaces) {
+      return std::optional{to_fsmat(generate_hue_mat(v))};
+    };
+  } else if (func == brightness_a) {
+    step.rows = [v](seedimg::colourspaces) -> row_filter {
+      return [v](simg &i, simg &o, simg_int s, simg_int e) {
+        brightness_alpha_worker(i, o, s, e, v);
+      };
+    };
+  }
+}
+
+template <class A>
+static inline void describe_step(chain_step &step,
+                                 void (*func)(simg &, simg &, float), A &&arg) {
+  using namespace seedimg::filters;
+  const float v = static_cast<float>(arg);
+  if (func == contrast) {
+    step.mat = [v](seedimg::colourspaces) {
+      return std::optional{generate_contrast_mat(v)};
+    };
+  } else if (func == saturation) {
+    // same split as saturation() itself.
+    step.mat = [v](seedimg::colourspaces cs) -> std::optional<seedimg::fsmat> {
+      if (cs == seedimg::colourspaces::hsv)
+        return std::nullopt;
+      return generate_saturation_mat(v);
+    };
+    step.rows = [v](seedimg::colourspaces cs) -> row_filter {
+      if (cs != seedimg::colourspaces::hsv)
+        return nullptr;
+      return [v](simg &i, simg &o, simg_int s, simg_int e) {
+        saturation_worker(i, o, s, e, v);
+      };
+    };
+  }
+}
+
+template <class A>
+static inline void describe_step(chain_step &step,
+                                 void (*func)(simg &, simg &, bool), A &&arg) {
+  using namespace seedimg::filters;
+  const bool v = static_cast<bool>(arg);
+  if (func == grayscale) {
+    step.rows = [v](seedimg::colourspaces) -> row_filter {
+      if (v)
+        return grayscale_worker_luminosity;
+      return grayscale_worker_average;
+    };
+  } else if (func == invert_a) {
+    step.rows = [v](seedimg::colourspaces) -> row_filter {
+      if (v)
+        return invert_worker_alpha_only;
+      return invert_worker_alpha;
+    };
+  }
+}
+
+template <class L, class V>
+static inline void
+describe_step(chain_step &step,
+              void (*func)(simg &, simg &, const seedimg::slut<seedimg::smat> &,
+                           const seedimg::lutvec &),
+              L &&lut, V &&vec) {
+  if (func != seedimg::filters::apply_mat_lut)
+    return;
+  // the table is large, share one copy between the step and its workers.
+  auto table = std::make_shared<seedimg::slut<seedimg::smat>>(lut);
+  seedimg::lutvec v = vec;
+  step.rows = [table, v](seedimg::colourspaces) -> row_filter {
+    return [table, v](simg &i, simg &o, simg_int s, simg_int e) {
+      apply_mat_lut_worker(i, o, s, e, *table, v);
+    };
+  };
+}
+} // namespace simgdetails
+
 namespace seedimg::filters {
+class graph;
 
 /**
  * @brief Lazily evaluated linear chain of filters wrapping I/O based
@@ -1134,9 +1389,79 @@ namespace seedimg::filters {
  */
 class filterchain {
 private:
-  std::vector<std::function<void(simg &, simg &)>> filters;
+  // builds its linear runs out of the steps of filterchains.
+  friend class graph;
+
+  std::vector<simgdetails::chain_step> filters;
+  bool fuse, compose;
+
+  // runs the steps in [first, last) from a single pass over the image, band
+  // by band, so every band goes through all of them while it's in cache.
+  // consecutive colour matrices are composed into one if compose is set.
+  // otherwise every step still rounds and clamps, like it does on its own.
+  void eval_fused(simg &img, std::size_t first, std::size_t last) {
+    simgdetails::profile_scope prof("filterchain", simgdetails::io_bytes(img));
+    const auto cs = img->colourspace();
+    std::vector<simgdetails::row_filter> stages;
+    std::vector<seedimg::fsmat> mats;
+
+    auto flush_mats = [&] {
+      if (mats.empty())
+        return;
+      seedimg::fsmat m = compose_fsmats(mats);
+      stages.push_back([m](simg &i, simg &o, simg_int s, simg_int e) {
+        simgdetails::apply_mat_worker(i, o, s, e, m);
+      });
+      mats.clear();
+    };
+
+    for (std::size_t i = first; i < last; ++i) {
+      auto m = filters[i].mat ? filters[i].mat(cs) : std::nullopt;
+      if (m && !compose) {
+        const seedimg::fsmat mat = *m;
+        stages.push_back([mat](simg &i, simg &o, simg_int s, simg_int e) {
+          simgdetails::apply_mat_worker(i, o, s, e, mat);
+        });
+      } else if (m) {
+        // apply_mat leaves alpha alone, keep the homogeneous column intact
+        // so that offsets compose.
+        (*m)[3] = (*m)[7] = (*m)[11] = 0.0f;
+        (*m)[15] = 1.0f;
+        mats.push_back(*m);
+      } else {
+        flush_mats();
+        stages.push_back(filters[i].rows(cs));
+      }
+    }
+    flush_mats();
+
+    seedimg::utils::hrz_thread(
+        [&stages](simg &i, simg &o, simg_int s, simg_int e) {
+          for (const auto &stage : stages)
+            stage(i, o, s, e);
+        },
+        img, img);
+  }
+
+  // whether the step can take part in a fused pass for the colourspace.
+  bool fusable(std::size_t i, seedimg::colourspaces cs) const {
+    const auto &f = filters[i];
+    return (f.mat && f.mat(cs)) || (f.rows && f.rows(cs));
+  }
 
 public:
+  /**
+   * @param fuse whether consecutive colour matrix and per-pixel filters are
+   * run together in a single pass over the image, which gives the same
+   * result as running them one by one.
+   * @param compose whether consecutive colour matrices of a fused pass are
+   * also multiplied into one. That skips the rounding and clamping between
+   * them, so values which saturate in between come out different, e.g.
+   * brightness +100 then -100 doesn't clip bright pixels anymore.
+   */
+  filterchain(bool fuse = true, bool compose = false)
+      : fuse{fuse}, compose{compose} {}
+
   /**
    * @brief Push a function to end of the queue that follows the idioms of
    * seedimg filter-function definitions. It will bind any number of additional
@@ -1144,19 +1469,37 @@ public:
    *
    * @note Due to limitation with C++ parameter packs, default arguments of
    * filter function also must be specified when adding.
+   * @note eval on an animation calls func on several frames at once, from
+   * different threads, so it must not keep state between calls unguarded.
    *
    * @param func a callable object.
    * @param args custom arguments to pass to callable.
    */
   template <class F, class... Args>
   filterchain &add(F &&func, Args &&... args) {
-    filters.push_back(std::bind(func, std::placeholders::_1,
-                                std::placeholders::_2,
-                                std::forward<Args>(args)...));
+    simgdetails::chain_step step;
+    if constexpr (std::is_function_v<std::remove_pointer_t<std::decay_t<F>>>)
+      simgdetails::describe_step(step, static_cast<std::decay_t<F>>(func),
+                                 args...);
+    step.func = std::bind(func, std::placeholders::_1, std::placeholders::_2,
+                          std::forward<Args>(args)...);
+    filters.push_back(std::move(step));
 
     return *this;
   }
 
+  /**
+   * @brief Push a colour matrix to the end of the queue, same as adding
+   * apply_mat with it.
+   */
+  filterchain &add_mat(const fsmat &mat) {
+    simgdetails::chain_step step;
+    step.func = [mat](simg &i, simg &o) { apply_mat(i, o, mat); };
+    step.mat = [mat](seedimg::colourspaces) { return std::optional{mat}; };
+    filters.push_back(std::move(step));
+    return *this;
+  }
+
   /**
    * @brief Pop-off the most recently added filter in queue.
    */
@@ -1173,11 +1516,36 @@ public:
    * @param output output of the accumulated result.
    */
   filterchain &eval(const simg &in, simg &out) {
-    // copy all pixels first into output, for "f(out, out)" to work.
-    std::copy(in->data(), in->data() + in->width() * in->height(), out->data());
+    std::size_t i = 0;
+    if (in != out) {
+      // a first filter which can't be fused reads in and writes out by
+      // itself, so it needn't cope with both being the same image.
+      if (!filters.empty() && !(fuse && fusable(0, in->colourspace()))) {
+        filters[0].func(const_cast<simg &>(in), out);
+        i = 1;
+      } else {
+        // copy all pixels first into output, for "f(out, out)" to work.
+        std::copy(in->data(), in->data() + in->width() * in->height(),
+                  out->data());
+      }
+    }
 
-    for (const auto &f : filters)
-      f(out, out);
+    for (; i < filters.size();) {
+      // matrix and per-pixel filters keep the colourspace as it is, so the
+      // one the run starts in holds for all of it.
+      const auto cs = out->colourspace();
+      std::size_t j = i;
+      while (fuse && j < filters.size() && fusable(j, cs))
+        ++j;
+
+      if (j == i) {
+        filters[i].func(out, out);
+        ++i;
+      } else {
+        eval_fused(out, i, j);
+        i = j;
+      }
+    }
 
     return *this;
   }
@@ -1187,23 +1555,51 @@ public:
     return *this;
   }
 
+  /**
+   * @brief Whether every filter in the queue works on each pixel on its own,
+   * so that the chain can be run on any part of an image.
+   */
+  bool
+  row_local(seedimg::colourspaces cs = seedimg::colourspaces::rgb) const {
+    for (std::size_t i = 0; i < filters.size(); ++i)
+      if (!fusable(i, cs))
+        return false;
+    return true;
+  }
+
+  /**
+   * @brief Stream an image from src through the chain into dst, a strip of
+   * rows at a time. See seedimg::stream::pipe.
+   * @return false if the chain isn't row_local, or reading or writing failed.
+   */
+  bool eval(seedimg::stream::reader &src, seedimg::stream::writer &dst,
+            simg_int rows = SIMG_STREAM_ROWS) {
+    if (!row_local())
+      return false;
+    return seedimg::stream::pipe(
+        src, dst, [this](simg &strip) { eval(strip); }, rows);
+  }
+
   /**
    * @brief Same effect as a single image but evalualtes on multiple frames,
-   * and does it inplace to avoid temporary allocations.
-   *
-   * @remark Should we do it I/O based here?
+   * and does it inplace to avoid temporary allocations. Frames are filtered
+   * concurrently, as many at a time as there are threads, so the filters
+   * must be safe to call from several threads at once on different frames.
+   * Those of seedimg are, they only read the images passed besides the one
+   * filtered, but a custom filter modifying a shared argument is not.
    *
    * @param imgs images to transform (inplace).
    * @param start index to start with.
    * @param end index to end with (0 = imgs.size() - 1).
    */
   filterchain &eval(anim &imgs, simg_int start = 0, simg_int end = 0) {
-    end = end ? end : imgs.size();
+    if (end == 0 || end > imgs.size())
+      end = imgs.size();
     if (end <= start) // if nothing to do or invalid range.
       return *this;
 
-    for (simg_int i = start; i < end; ++i)
-      eval(imgs[i]);
+    seedimg::utils::frame_thread(start, end,
+                                 [&](simg_int i) { eval(imgs[i]); });
     return *this;
   }
 };
@@ -1227,14 +1623,24 @@ public:
    *
    * @note Due to limitation with C++ parameter packs, default arguments of
    * filter function also must be specified when adding.
+   * @note eval on an animation calls func on several frames at once, from
+   * different threads, so it must not keep state between calls unguarded.
+   * @note Arguments passed as lvalues are bound by reference and must
+   * outlive the chain, temporaries are moved into it.
    *
    * @param func a callable object.
    * @param args custom arguments to pass to callable.
    */
   template <class F, class... Args>
   filterchain_i &add(F &&func, Args &&... args) {
-    filters.push_back([&](simg &input) -> void {
-      std::invoke(func, input, std::forward<Args>(args)...);
+    // shared, so that std::function can copy it even if an argument can
+    // only be moved.
+    auto bound = std::make_shared<std::tuple<std::decay_t<F>, Args...>>(
+        std::forward<F>(func), std::forward<Args>(args)...);
+    filters.push_back([bound](simg &input) {
+      std::apply(
+          [&input](auto &f, auto &... a) { std::invoke(f, input, a...); },
+          *bound);
     });
 
     return *this;
@@ -1262,7 +1668,8 @@ public:
   }
 
   /**
-   * @brief Same effect as a single image but evalualtes on multiple frames.
+   * @brief Same effect as a single image but evalualtes on multiple frames,
+   * concurrently like filterchain::eval does.
    *
    * @param imgs images to transform (inplace).
    * @param start index to start with.
@@ -1274,8 +1681,8 @@ public:
     if (end <= start) // if nothing to do or invalid range.
       return *this;
 
-    for (simg_int i = start; i < end; ++i)
-      eval(imgs[i]);
+    seedimg::utils::frame_thread(start, end,
+                                 [&](simg_int i) { eval(imgs[i]); });
     return *this;
   }
 };
@@ -0,0 +1,382 @@
+/***********************************************************************
+    seedimg - module based image manipulation library written in modern C++
+    Copyright (C) 2020 telugu-boy, tripulse
+
+    This program is free software : you can redistribute it and /
+    or modify it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation,
+    either version 3 of the License,
+    or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+************************************************************************/
+
+#ifndef SEEDIMG_FILTERS_GRAPH_HPP
+#define SEEDIMG_FILTERS_GRAPH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <seedimg-filters/seedimg-filters-core.hpp>
+#include <seedimg-threadpool.hpp>
+#include <seedimg.hpp>
+
+namespace seedimg::filters {
+/**
+ * @brief Lazily evaluated graph of filters. Nodes are images: inputs, or
+ * the result of a filter on other nodes. Nothing runs until eval, which
+ * only runs what the requested nodes depend on.
+ *
+ * Runs of single input filters whose intermediate results nobody else reads
+ * are evaluated as one filterchain, so colour matrix and per-pixel filters
+ * run in a single pass over the image like there. Filters that don't depend
+ * on each other run in parallel. Intermediate images are recycled once all
+ * their readers ran, and a filter overwrites its input instead of taking a
+ * new image when it is the last one reading it.
+ *
+ * @note Like with filterchain, filters must keep the dimensions of images.
+ */
+class graph {
+public:
+  typedef std::size_t node;
+
+  /**
+   * @brief Add an image as an input. It is only read, and must outlive the
+   * evaluation.
+   */
+  node input(const simg &img) {
+    graph_node n;
+    n.source = &img;
+    n.width = img->width();
+    n.height = img->height();
+    nodes.push_back(std::move(n));
+    return nodes.size() - 1;
+  }
+
+  /**
+   * @brief Add an I/O based filter on in, called as
+   * func(input, output, args...) like filterchain::add. Filters that aren't
+   * colour matrices or per-pixel always get an output image separate from
+   * their input.
+   */
+  template <class F, class... Args>
+  node add(node in, F &&func, Args &&... args) {
+    filterchain chain;
+    chain.add(std::forward<F>(func), std::forward<Args>(args)...);
+    return add_step(in, std::move(chain.filters.back()));
+  }
+
+  /**
+   * @brief Add a colour matrix on in, same as adding apply_mat with it.
+   */
+  node add_mat(node in, const fsmat &mat) {
+    filterchain chain;
+    chain.add_mat(mat);
+    return add_step(in, std::move(chain.filters.back()));
+  }
+
+  /**
+   * @brief Add a filter of two images of the same dimensions, called as
+   * func(a, b, output). output may be the same image as a, b must not be
+   * modified.
+   */
+  node combine(node a, node b,
+               std::function<void(simg &, simg &, simg &)> func) {
+    return add_binary(a, b,
+                      [func](simg &i, simg &o, simg &out, bool) {
+                        func(i, o, out);
+                      });
+  }
+
+  /**
+   * @brief Same as filters::blend, but neither input is modified.
+   */
+  node blend(node a, std::uint8_t a_gain, node b, std::uint8_t b_gain) {
+    return add_binary(a, b, [a_gain, b_gain](simg &i, simg &o, simg &out,
+                                             bool o_writable) {
+      brightness_a(i, out, a_gain);
+      simg scratch;
+      simg *other = &o;
+      if (o_writable) {
+        brightness_a_i(o, b_gain);
+      } else {
+        scratch = seedimg::make(o->width(), o->height());
+        brightness_a(o, scratch, b_gain);
+        other = &scratch;
+      }
+      seedimg::utils::hrz_thread(simgdetails::pixel_add_worker, out, *other);
+    });
+  }
+
+  /**
+   * @brief Same as filters::difference.
+   */
+  node difference(node a, node b, bool alpha = false) {
+    return add_binary(a, b, [alpha](simg &i, simg &o, simg &out, bool) {
+      seedimg::filters::difference(i, out, o, alpha);
+    });
+  }
+
+  /**
+   * @brief Evaluate the requested nodes.
+   * @return their images, in the same order.
+   */
+  std::vector<simg> eval(const std::vector<node> &outputs) {
+    for (node out : outputs)
+      check(out);
+    plan p = make_plan(outputs);
+
+    for (const auto &wave : p.waves) {
+      // decide where every task writes before running any of them, the
+      // buffers freed by the previous wave are up for grabs.
+      for (std::size_t t : wave)
+        assign(p, p.tasks[t]);
+      simgdetails::thread_pool::instance().parallel_for(
+          wave.size(), [&](std::size_t i) { run(p, p.tasks[wave[i]]); });
+      for (std::size_t t : wave)
+        for (node in : p.tasks[t].inputs)
+          release(p, in);
+    }
+
+    std::vector<simg> res;
+    for (node out : outputs) {
+      auto &v = p.values[out];
+      if (v.slot != no_slot && p.refs[out] == 1) {
+        res.push_back(std::move(p.slots[v.slot]));
+      } else {
+        // inputs, and nodes requested more than once, are copied.
+        res.push_back(seedimg::make(*value(p, out)));
+        p.refs[out] -= 1;
+      }
+    }
+    return res;
+  }
+
+  simg eval(node out) { return std::move(eval(std::vector<node>{out})[0]); }
+
+private:
+  typedef std::function<void(simg &, simg &, simg &, bool)> binary_filter;
+  static constexpr std::size_t no_slot = static_cast<std::size_t>(-1);
+
+  struct graph_node {
+    const simg *source = nullptr;
+    std::vector<node> inputs;
+    simgdetails::chain_step step;
+    binary_filter binary;
+    simg_int width = 0, height = 0;
+  };
+
+  // a filterchain of the steps of nodes, or a single binary filter.
+  struct task {
+    std::vector<node> nodes;
+    std::vector<node> inputs;
+    bool in_place = false, input_writable = false;
+  };
+
+  struct value_ref {
+    const simg *source = nullptr;
+    std::size_t slot = no_slot;
+  };
+
+  struct plan {
+    std::vector<task> tasks;
+    std::vector<std::vector<std::size_t>> waves;
+    // the image of every node which is read by a task or requested.
+    std::vector<value_ref> values;
+    // amount of reads of that image left, requests count as one.
+    std::vector<std::size_t> refs;
+    std::vector<simg> slots;
+    std::vector<std::size_t> free_slots;
+  };
+
+  std::vector<graph_node> nodes;
+
+  void check(node n) const {
+    if (n >= nodes.size())
+      throw std::out_of_range{"Node is not part of the graph"};
+  }
+
+  node add_step(node in, simgdetails::chain_step step) {
+    check(in);
+    graph_node n;
+    n.inputs = {in};
+    n.step = std::move(step);
+    n.width = nodes[in].width;
+    n.height = nodes[in].height;
+    nodes.push_back(std::move(n));
+    return nodes.size() - 1;
+  }
+
+  node add_binary(node a, node b, binary_filter func) {
+    check(a);
+    check(b);
+    if (nodes[a].width != nodes[b].width || nodes[a].height != nodes[b].height)
+      throw std::invalid_argument{"Images must have the same dimensions"};
+    graph_node n;
+    n.inputs = {a, b};
+    n.binary = std::move(func);
+    n.width = nodes[a].width;
+    n.height = nodes[a].height;
+    nodes.push_back(std::move(n));
+    return nodes.size() - 1;
+  }
+
+  bool unary(node n) const {
+    return !nodes[n].binary && nodes[n].source == nullptr;
+  }
+
+  // a filter that is neither a colour matrix nor per-pixel, e.g. a
+  // convolution, which may read pixels its output already overwrote.
+  bool opaque(node n) const {
+    return unary(n) && !nodes[n].step.mat && !nodes[n].step.rows;
+  }
+
+  plan make_plan(const std::vector<node> &outputs) const {
+    plan p;
+    p.values.resize(nodes.size());
+    p.refs.assign(nodes.size(), 0);
+
+    // nodes the outputs depend on, everything else is never run. nodes only
+    // depend on ones added before them.
+    std::vector<bool> live(nodes.size(), false);
+    std::vector<std::size_t> readers(nodes.size(), 0);
+    for (node out : outputs)
+      live[out] = true;
+    for (node n = nodes.size(); n-- > 0;) {
+      if (!live[n])
+        continue;
+      for (node in : nodes[n].inputs) {
+        live[in] = true;
+        ++readers[in];
+      }
+    }
+
+    std::vector<bool> requested(nodes.size(), false);
+    for (node out : outputs) {
+      requested[out] = true;
+      ++p.refs[out];
+    }
+
+    // a unary node continues the task of its input if it is the only one
+    // reading it, and nobody asked for the input itself. opaque nodes start
+    // a task of their own, which gets separate input and output images.
+    std::vector<std::size_t> task_of(nodes.size(), no_slot);
+    std::vector<std::size_t> depth(nodes.size(), 0);
+    for (node n = 0; n < nodes.size(); ++n) {
+      if (!live[n] || nodes[n].source != nullptr)
+        continue;
+      const node first = nodes[n].inputs[0];
+      if (unary(n) && !opaque(n) && unary(first) && readers[first] == 1 &&
+          !requested[first]) {
+        task_of[n] = task_of[first];
+        p.tasks[task_of[n]].nodes.push_back(n);
+        depth[n] = depth[first];
+        continue;
+      }
+      task t;
+      t.nodes = {n};
+      t.inputs = nodes[n].inputs;
+      for (node in : t.inputs) {
+        ++p.refs[in];
+        depth[n] = std::max(depth[n], depth[in] + 1);
+      }
+      task_of[n] = p.tasks.size();
+      p.tasks.push_back(std::move(t));
+    }
+
+    // tasks of the same depth only read what earlier depths produced.
+    for (std::size_t t = 0; t < p.tasks.size(); ++t) {
+      const std::size_t d = depth[p.tasks[t].nodes.back()];
+      if (p.waves.size() < d)
+        p.waves.resize(d);
+      p.waves[d - 1].push_back(t);
+    }
+
+    for (node n = 0; n < nodes.size(); ++n)
+      if (nodes[n].source != nullptr)
+        p.values[n].source = nodes[n].source;
+    return p;
+  }
+
+  simg *value(plan &p, node n) const {
+    const auto &v = p.values[n];
+    if (v.source != nullptr)
+      return const_cast<simg *>(v.source);
+    return &p.slots[v.slot];
+  }
+
+  std::size_t acquire(plan &p, simg_int width, simg_int height) const {
+    for (auto it = p.free_slots.begin(); it != p.free_slots.end(); ++it) {
+      const auto &img = p.slots[*it];
+      if (img->width() == width && img->height() == height) {
+        const std::size_t slot = *it;
+        p.free_slots.erase(it);
+        return slot;
+      }
+    }
+    p.slots.push_back(seedimg::make(width, height));
+    return p.slots.size() - 1;
+  }
+
+  // whether the task is the last reader of n and may overwrite it.
+  bool last_reader(const plan &p, const task &t, node n) const {
+    return p.values[n].slot != no_slot && p.refs[n] == 1 &&
+           std::count(t.inputs.begin(), t.inputs.end(), n) == 1;
+  }
+
+  void assign(plan &p, task &t) const {
+    const node out = t.nodes.back();
+    const node first = t.inputs[0];
+    t.in_place = last_reader(p, t, first) && !opaque(t.nodes.front());
+    if (t.inputs.size() > 1)
+      t.input_writable = last_reader(p, t, t.inputs[1]);
+    if (t.in_place) {
+      // the input's image is handed over, release won't free it.
+      p.values[out].slot = p.values[first].slot;
+      p.values[first].slot = no_slot;
+    } else {
+      p.values[out].slot = acquire(p, nodes[out].width, nodes[out].height);
+    }
+  }
+
+  void run(plan &p, const task &t) const {
+    const node out = t.nodes.back();
+    simg &res = p.slots[p.values[out].slot];
+    simg &inp = t.in_place ? res : *value(p, t.inputs[0]);
+    // recycled images may still be in the colourspace of their last use.
+    static_cast<seedimg::uimg *>(res.get())
+        ->set_colourspace(inp->colourspace());
+
+    if (t.inputs.size() > 1) {
+      nodes[out].binary(inp, *value(p, t.inputs[1]), res, t.input_writable);
+      return;
+    }
+
+    filterchain chain;
+    for (node n : t.nodes)
+      chain.filters.push_back(nodes[n].step);
+    chain.eval(inp, res);
+  }
+
+  void release(plan &p, node n) const {
+    if (--p.refs[n] != 0)
+      return;
+    auto &v = p.values[n];
+    if (v.slot != no_slot) {
+      p.free_slots.push_back(v.slot);
+      v.slot = no_slot;
+    }
+  }
+};
+} // namespace seedimg::filters
+#endif
@@ -25,6 +25,15 @@
 
 #define SIMG_OCL_BUF_PADDING sizeof(seedimg::pixel) * SIMG_OCL_LOCAL_WG_SIZE
 
+// work group of 2-D kernels when SIMG_OCL_NO_AUTOTUNE is defined, and the
+// first one the autotuner tries.
+#ifndef SIMG_OCL_LOCAL_WG_X
+#define SIMG_OCL_LOCAL_WG_X 16
+#endif
+#ifndef SIMG_OCL_LOCAL_WG_Y
+#define SIMG_OCL_LOCAL_WG_Y 8
+#endif
+
 #ifndef CL_HPP_MINIMUM_OPENCL_VERSION
 #define CL_HPP_MINIMUM_OPENCL_VERSION 100
 #endif
@@ -42,8 +51,11 @@
 #include <seedimg-filters/seedimg-filters-core.hpp>
 #include <seedimg-utils.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <functional>
+#include <memory>
 
 namespace seedimg::filters {
 namespace ocl {
@@ -52,13 +64,15 @@ namespace ocl {
 static inline void write_img_1d(cl::CommandQueue &queue, simg &inp_img,
                                 cl::Buffer &inp_img_buf,
                                 bool blocking = false) {
+  const std::size_t bytes =
+      sizeof(seedimg::pixel) * inp_img->width() * inp_img->height();
+  simgdetails::profile_scope prof("upload", bytes, "ocl");
   cl_uchar4 *inp = static_cast<cl_uchar4 *>(queue.enqueueMapBuffer(
       inp_img_buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
       seedimg::utils::round_up(sizeof(seedimg::pixel) * inp_img->width() *
                                    inp_img->height(),
                                SIMG_OCL_BUF_PADDING)));
-  std::memcpy(inp, inp_img->data(),
-              sizeof(seedimg::pixel) * inp_img->width() * inp_img->height());
+  std::memcpy(inp, inp_img->data(), bytes);
   queue.enqueueUnmapMemObject(inp_img_buf, inp);
   if (blocking)
     queue.finish();
@@ -66,20 +80,53 @@ static inline void write_img_1d(cl::CommandQueue &queue, simg &inp_img,
 
 static inline void read_img_1d(cl::CommandQueue &queue, simg &res_img,
                                cl::Buffer &res_img_buf, bool blocking = false) {
+  const std::size_t bytes =
+      sizeof(seedimg::pixel) * res_img->width() * res_img->height();
+  simgdetails::profile_scope prof("download", bytes, "ocl");
   cl_uchar4 *res = static_cast<cl_uchar4 *>(queue.enqueueMapBuffer(
       res_img_buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
       seedimg::utils::round_up(sizeof(seedimg::pixel) * res_img->width() *
                                    res_img->height(),
                                SIMG_OCL_BUF_PADDING)));
-  std::memcpy(res_img->data(), res,
-              sizeof(seedimg::pixel) * res_img->width() * res_img->height());
+  std::memcpy(res_img->data(), res, bytes);
   queue.enqueueUnmapMemObject(res_img_buf, res);
   if (blocking)
     queue.finish();
 }
 
-static inline void init_ocl_singleton(std::size_t plat, std::size_t dev) {
-  simgdetails::ocl_singleton::instance(plat, dev);
+// non-blocking counterparts of the above, for pipelining: the pixels of the
+// image must stay alive, and the ones uploaded unchanged, until done
+// completes. wait is the events the transfer waits for.
+static inline void enqueue_write_img_1d(cl::CommandQueue &queue,
+                                        const simg &inp_img,
+                                        cl::Buffer &inp_img_buf,
+                                        const std::vector<cl::Event> *wait,
+                                        cl::Event *done) {
+  queue.enqueueWriteBuffer(
+      inp_img_buf, CL_FALSE, 0,
+      sizeof(seedimg::pixel) * inp_img->width() * inp_img->height(),
+      inp_img->data(), wait, done);
+}
+
+static inline void enqueue_read_img_1d(cl::CommandQueue &queue, simg &res_img,
+                                       cl::Buffer &res_img_buf,
+                                       const std::vector<cl::Event> *wait,
+                                       cl::Event *done) {
+  queue.enqueueReadBuffer(
+      res_img_buf, CL_FALSE, 0,
+      sizeof(seedimg::pixel) * res_img->width() * res_img->height(),
+      res_img->data(), wait, done);
+}
+
+/**
+ * @brief Pick the platform and its dev-th device to run on, among devices
+ * of the given types, GPUs first, then accelerators, then CPUs. Must be
+ * called before any OpenCL filter to have an effect.
+ */
+static inline void
+init_ocl_singleton(std::size_t plat, std::size_t dev,
+                   cl_device_type type = SIMG_OCL_DEVICE_TYPE) {
+  simgdetails::ocl_singleton::instance(plat, dev, type);
 }
 static inline cl::Context &get_context() {
   return simgdetails::ocl_singleton::instance().context;
@@ -88,7 +135,165 @@ static inline cl::CommandQueue &get_queue() {
   return simgdetails::ocl_singleton::instance().queue;
 }
 static inline cl::Kernel &get_kernel(const std::string &kernel_name) {
-  return simgdetails::ocl_singleton::instance().kernels.at(kernel_name);
+  return simgdetails::ocl_singleton::instance().kernel(kernel_name);
+}
+static inline cl::CommandQueue make_queue() {
+  return simgdetails::ocl_singleton::instance().make_queue();
+}
+static inline cl::CommandQueue make_queue(const cl::Device &device,
+                                          bool profiling = false) {
+  return simgdetails::ocl_singleton::instance().make_queue(device, profiling);
+}
+static inline const std::vector<cl::Device> &get_devices() {
+  return simgdetails::ocl_singleton::instance().all_devices;
+}
+
+/**
+ * @brief An image that lives in device memory, so that several filters can
+ * run on it without it going back and forth between host and device.
+ * Filters on it are only enqueued, on the queue of the image, download
+ * waits for them. Images on separate queues are processed concurrently.
+ */
+class device_img {
+public:
+  device_img(simg_int width, simg_int height,
+             seedimg::colourspaces space = seedimg::colourspaces::rgb,
+             cl::CommandQueue queue = get_queue())
+      : width_{width}, height_{height}, colourspace_{space},
+        queue_{std::move(queue)},
+        buffer_{get_context(), CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                padded_bytes()} {}
+
+  /**
+   * @brief Allocate a device image of the same size as img and upload it.
+   */
+  explicit device_img(simg &img)
+      : device_img(img->width(), img->height(), img->colourspace()) {
+    upload(img);
+  }
+
+  device_img(device_img const &) = delete;
+  void operator=(device_img const &) = delete;
+  device_img(device_img &&) = default;
+  device_img &operator=(device_img &&) = default;
+
+  /**
+   * @brief Copy img, which has the same dimensions, to the device.
+   */
+  void upload(simg &img) {
+    write_img_1d(queue_, img, buffer_);
+    colourspace_ = img->colourspace();
+  }
+
+  /**
+   * @brief Enqueue copying img to the device without waiting for it, img
+   * must stay alive and unchanged until done completes.
+   * @param wait events the copy waits for, e.g. the ones of other queues.
+   */
+  void upload_async(const simg &img,
+                    const std::vector<cl::Event> *wait = nullptr,
+                    cl::Event *done = nullptr) {
+    enqueue_write_img_1d(queue_, img, buffer_, wait, done);
+    colourspace_ = img->colourspace();
+  }
+
+  /**
+   * @brief Wait for the filters enqueued on the image and copy it back into
+   * img, which has the same dimensions.
+   */
+  void download(simg &img) {
+    read_img_1d(queue_, img, buffer_);
+    static_cast<seedimg::uimg *>(img.get())->set_colourspace(colourspace_);
+  }
+
+  /**
+   * @brief Enqueue copying the image back into img after the filters
+   * enqueued so far, without waiting for it. img must stay alive until done
+   * completes.
+   */
+  void download_async(simg &img, const std::vector<cl::Event> *wait = nullptr,
+                      cl::Event *done = nullptr) {
+    enqueue_read_img_1d(queue_, img, buffer_, wait, done);
+    static_cast<seedimg::uimg *>(img.get())->set_colourspace(colourspace_);
+  }
+
+  simg download() {
+    auto img = seedimg::make(width_, height_);
+    download(img);
+    return img;
+  }
+
+  cl::Buffer &buffer() noexcept { return buffer_; }
+  cl::CommandQueue &queue() noexcept { return queue_; }
+  simg_int width() const noexcept { return width_; }
+  simg_int height() const noexcept { return height_; }
+  simg_int pixels() const noexcept { return width_ * height_; }
+  seedimg::colourspaces colourspace() const noexcept { return colourspace_; }
+  void set_colourspace(seedimg::colourspaces space) noexcept {
+    colourspace_ = space;
+  }
+
+private:
+  simg_int width_, height_;
+  seedimg::colourspaces colourspace_;
+  cl::CommandQueue queue_;
+  cl::Buffer buffer_;
+
+  // kernels run in whole work groups, the tail of the last one lands in
+  // the padding.
+  std::size_t padded_bytes() const noexcept {
+    return seedimg::utils::round_up(sizeof(seedimg::pixel) * width_ * height_,
+                                    SIMG_OCL_BUF_PADDING);
+  }
+};
+
+// throws if an enqueue failed, the output would silently be stale otherwise.
+static inline void check_enqueue(cl_int err, cl::Kernel &kern) {
+  if (err != CL_SUCCESS)
+    throw std::runtime_error("Error enqueueing " +
+                             kern.getInfo<CL_KERNEL_FUNCTION_NAME>() + ": " +
+                             std::to_string(err));
+}
+
+// enqueues kern. when profiling, it is waited for so that its event can
+// tell how long it ran on the device, bytes is what it reads and writes.
+static inline void enqueue_kernel(cl::CommandQueue &queue, cl::Kernel &kern,
+                                  const cl::NDRange &global,
+                                  const cl::NDRange &local, std::size_t bytes) {
+  if (!seedimg::profile::enabled()) {
+    check_enqueue(
+        queue.enqueueNDRangeKernel(kern, cl::NullRange, global, local), kern);
+    return;
+  }
+
+  namespace ch = std::chrono;
+  const auto start = ch::steady_clock::now();
+  cl::Event event;
+  check_enqueue(queue.enqueueNDRangeKernel(kern, cl::NullRange, global, local,
+                                           nullptr, &event),
+                kern);
+  event.wait();
+  const auto wall = ch::steady_clock::now() - start;
+
+  // zero if the queue wasn't created with CL_QUEUE_PROFILING_ENABLE.
+  cl_int err_start = CL_SUCCESS, err_end = CL_SUCCESS;
+  const cl_ulong dev_start =
+      event.getProfilingInfo<CL_PROFILING_COMMAND_START>(&err_start);
+  const cl_ulong dev_end =
+      event.getProfilingInfo<CL_PROFILING_COMMAND_END>(&err_end);
+  const bool timed = err_start == CL_SUCCESS && err_end == CL_SUCCESS &&
+                     dev_end >= dev_start;
+
+  const auto name = kern.getInfo<CL_KERNEL_FUNCTION_NAME>();
+  try {
+    seedimg::profile::emit(
+        {name.c_str(), "ocl",
+         static_cast<std::uint64_t>(
+             ch::duration_cast<ch::nanoseconds>(wall).count()),
+         timed ? dev_end - dev_start : 0, bytes});
+  } catch (...) {
+    // same as profile_scope, the sink must not fail the filter.
+  }
 }
 
 // To avoid code duplication, this takes a callback that enqueues an execution
@@ -97,29 +302,17 @@ static inline cl::Kernel &get_kernel(const std::string &kernel_name) {
 // accepts them or else undefined behavior
 void default_exec_callback(cl::CommandQueue &queue, cl::Kernel &kern,
                            std::size_t amt, bool blocking, ...) {
-  /*
-    std::cout << "start" << std::endl;
-    for (int i = 0; i < 60; i++) {
-      std::cout << i << std::endl;
-      queue.enqueueNDRangeKernel(kern, cl::NullRange, cl::NDRange(amt),
-                                 cl::NDRange(SIMG_OCL_LOCAL_WG_SIZE));
-      queue.finish();
-    }
-    std::cout << "end" << std::endl;
-    if (blocking)
-      queue.finish();*/
-
-  queue.enqueueNDRangeKernel(kern, cl::NullRange, cl::NDRange(amt),
-                             cl::NDRange(64));
+  enqueue_kernel(queue, kern, cl::NDRange(amt),
+                 cl::NDRange(SIMG_OCL_LOCAL_WG_SIZE),
+                 2 * sizeof(seedimg::pixel) * amt);
   if (blocking)
     queue.finish();
-} // namespace ocl
+}
 
 template <typename Func, typename... Args>
 void exec_ocl_callback_1d(simg &inp_img, simg &res_img, cl::Buffer *inp_buf,
                           cl::Buffer *res_buf, const std::string &kernel_name,
                           Func &&callback, Args &&... kernel_args) {
-  namespace ch = std::chrono;
   const auto &context = get_context();
   auto &queue = get_queue();
 
@@ -138,14 +331,7 @@ void exec_ocl_callback_1d(simg &inp_img, simg &res_img, cl::Buffer *inp_buf,
     res_img_buf = res_buf;
   }
 
-  auto start = ch::steady_clock::now();
   write_img_1d(queue, inp_img, *inp_img_buf);
-  queue.finish();
-  auto end = ch::steady_clock::now();
-
-  std::cout << "write:"
-            << ch::duration_cast<ch::milliseconds>(end - start).count()
-            << std::endl;
 
   cl::Kernel &kern = get_kernel(kernel_name);
 
@@ -157,27 +343,15 @@ void exec_ocl_callback_1d(simg &inp_img, simg &res_img, cl::Buffer *inp_buf,
   kern.setArg(i++, *inp_img_buf);
   kern.setArg(i, *res_img_buf);
 
-  start = ch::steady_clock::now();
   // and then calls the callback with whatever parameters were passed.
   std::invoke(callback, queue, kern,
               seedimg::utils::round_up(
                   inp_img->width() * inp_img->height(),
                   static_cast<std::size_t>(SIMG_OCL_LOCAL_WG_SIZE)),
               false, std::forward<Args>(kernel_args)...);
-  queue.finish();
-
-  end = ch::steady_clock::now();
-  std::cout << "exec:"
-            << ch::duration_cast<ch::milliseconds>(end - start).count()
-            << std::endl;
 
-  start = ch::steady_clock::now();
+  // mapping the result is blocking, and in order after the kernel.
   read_img_1d(queue, res_img, *res_img_buf);
-  queue.finish();
-  end = ch::steady_clock::now();
-  std::cout << "read:"
-            << ch::duration_cast<ch::milliseconds>(end - start).count()
-            << std::endl;
 
   if (inp_buf == nullptr)
     delete inp_img_buf;
@@ -188,11 +362,10 @@ void exec_ocl_callback_1d(simg &inp_img, simg &res_img, cl::Buffer *inp_buf,
 // is rounded up to SIMG_OCL_LOCAL_WG_SIZE, then passed to the kernel as the
 // global work size.
 template <typename Func, typename... Args>
-void exec_ocl_callback_1d(std::size_t amt_pixs, cl::Buffer *inp_buf,
-                          cl::Buffer *res_buf, const std::string &kernel_name,
-                          bool blocking, Func &&callback,
-                          Args &&... kernel_args) {
-  auto &queue = get_queue();
+void exec_ocl_callback_1d(cl::CommandQueue &queue, std::size_t amt_pixs,
+                          cl::Buffer *inp_buf, cl::Buffer *res_buf,
+                          const std::string &kernel_name, bool blocking,
+                          Func &&callback, Args &&... kernel_args) {
   cl::Buffer *inp_img_buf = inp_buf;
   cl::Buffer *res_img_buf = inp_buf;
   if (res_buf != nullptr) {
@@ -214,6 +387,183 @@ void exec_ocl_callback_1d(std::size_t amt_pixs, cl::Buffer *inp_buf,
     queue.finish();
 }
 
+// same, on the default queue.
+template <typename Func, typename... Args>
+void exec_ocl_callback_1d(std::size_t amt_pixs, cl::Buffer *inp_buf,
+                          cl::Buffer *res_buf, const std::string &kernel_name,
+                          bool blocking, Func &&callback,
+                          Args &&... kernel_args) {
+  exec_ocl_callback_1d(get_queue(), amt_pixs, inp_buf, res_buf, kernel_name,
+                       blocking, std::forward<Func>(callback),
+                       std::forward<Args>(kernel_args)...);
+}
+
+/**
+ * @brief Copy inp_img into res_img, which has the same dimensions, on the
+ * queue of res_img.
+ */
+static inline void copy(device_img &inp_img, device_img &res_img) {
+  if (&inp_img == &res_img)
+    return;
+  res_img.queue().enqueueCopyBuffer(inp_img.buffer(), res_img.buffer(), 0, 0,
+                                    sizeof(seedimg::pixel) * inp_img.pixels());
+  res_img.set_colourspace(inp_img.colourspace());
+}
+
+// runs a kernel on a device image. kernels write the colour channels of
+// their output only, so res is made a copy of inp first and the kernel runs
+// in place on it. it is enqueued on the queue of res, which inp must be
+// ready on.
+template <typename... Args>
+static inline void exec_device(device_img &inp, device_img &res,
+                               const std::string &kernel_name,
+                               Args &&... kernel_args) {
+  copy(inp, res);
+  exec_ocl_callback_1d(res.queue(), res.pixels(), &res.buffer(),
+                       &res.buffer(), kernel_name, false, default_exec_callback,
+                       std::forward<Args>(kernel_args)...);
+}
+
+} // namespace ocl
+} // namespace seedimg::filters
+
+namespace simgdetails {
+// work groups the autotuner settled on, keyed by device and kernel name.
+struct ocl_tuned_groups {
+  std::mutex mutex;
+  std::unordered_map<std::string, std::pair<std::size_t, std::size_t>> groups;
+};
+// not static, so that every translation unit reuses the same tuning.
+inline ocl_tuned_groups &ocl_tuned() {
+  static ocl_tuned_groups tuned;
+  return tuned;
+}
+
+// fastest time of kern over the candidate work groups which fit, measured
+// on the device if the queue profiles, otherwise on the host.
+template <typename SetArgs, typename TileBytes>
+std::pair<std::size_t, std::size_t>
+ocl_tune_2d(cl::CommandQueue &queue, cl::Kernel &kern,
+            const cl::Device &device, simg_int width, simg_int height,
+            SetArgs &set_args, TileBytes &tile_bytes) {
+  static constexpr std::size_t candidates[][2] = {
+      {SIMG_OCL_LOCAL_WG_X, SIMG_OCL_LOCAL_WG_Y},
+      {16, 16},
+      {32, 8},
+      {64, 4},
+      {8, 8},
+      {32, 4},
+      {16, 4},
+      {128, 1},
+      {64, 1},
+      {8, 4},
+      {4, 4},
+      {1, 1}};
+  const std::size_t max_group =
+      kern.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+  const cl_ulong local_mem = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+  std::vector<std::pair<std::size_t, std::size_t>> fits;
+  for (const auto &c : candidates)
+    if (c[0] * c[1] <= max_group && tile_bytes(c[0], c[1]) <= local_mem)
+      fits.push_back({c[0], c[1]});
+  if (fits.empty())
+    throw std::invalid_argument(
+        "Kernel does not fit in the local memory of the device");
+#ifdef SIMG_OCL_NO_AUTOTUNE
+  return fits.front();
+#else
+  namespace ch = std::chrono;
+  // whatever is still queued must not count against the first candidate.
+  queue.finish();
+  auto best = fits.front();
+  std::uint64_t best_ns = ~std::uint64_t{0};
+  for (const auto &[lw, lh] : fits) {
+    set_args(kern, lw, lh);
+    cl::Event event;
+    const auto start = ch::steady_clock::now();
+    if (queue.enqueueNDRangeKernel(
+            kern, cl::NullRange,
+            cl::NDRange(seedimg::utils::round_up(width, lw),
+                        seedimg::utils::round_up(height, lh)),
+            cl::NDRange(lw, lh), nullptr, &event) != CL_SUCCESS)
+      continue;
+    event.wait();
+    auto ns = static_cast<std::uint64_t>(
+        ch::duration_cast<ch::nanoseconds>(ch::steady_clock::now() - start)
+            .count());
+    cl_int err_start = CL_SUCCESS, err_end = CL_SUCCESS;
+    const cl_ulong dev_start =
+        event.getProfilingInfo<CL_PROFILING_COMMAND_START>(&err_start);
+    const cl_ulong dev_end =
+        event.getProfilingInfo<CL_PROFILING_COMMAND_END>(&err_end);
+    if (err_start == CL_SUCCESS && err_end == CL_SUCCESS &&
+        dev_end >= dev_start)
+      ns = dev_end - dev_start;
+    if (ns < best_ns) {
+      best_ns = ns;
+      best = {lw, lh};
+    }
+  }
+  return best;
+#endif
+}
+} // namespace simgdetails
+
+namespace seedimg::filters {
+namespace ocl {
+/**
+ * @brief Run a 2-D kernel over width * height work items, in work groups
+ * tuned for every device and kernel: the first time, the kernel is run
+ * once with every candidate group which fits and the fastest is kept.
+ * Kernels must thus give the same result with any group size and not read
+ * what they write. It is tuned again when a call needs more local memory
+ * than the group kept fits in.
+ * @param set_args called as set_args(kern, lw, lh) to set the arguments of
+ * the kernel, local memory tiles can be sized after the group.
+ * @param tile_bytes local memory a group of lw * lh needs, as
+ * tile_bytes(lw, lh).
+ * @param bytes what the kernel reads and writes, for profiling.
+ */
+template <typename SetArgs, typename TileBytes>
+static inline void exec_2d(cl::CommandQueue &queue,
+                           const std::string &kernel_name, simg_int width,
+                           simg_int height, SetArgs &&set_args,
+                           TileBytes &&tile_bytes, std::size_t bytes) {
+  cl::Kernel &kern = get_kernel(kernel_name);
+  const cl::Device device = queue.getInfo<CL_QUEUE_DEVICE>();
+  const std::string key =
+      device.getInfo<CL_DEVICE_NAME>() + '\n' + kernel_name;
+
+  auto &tuned = simgdetails::ocl_tuned();
+  std::pair<std::size_t, std::size_t> group{0, 0};
+  {
+    std::lock_guard<std::mutex> lock(tuned.mutex);
+    auto it = tuned.groups.find(key);
+    if (it != tuned.groups.end())
+      group = it->second;
+  }
+  // the tile of a group grows with the radius of the call, a group tuned
+  // for a smaller one may not fit in local memory anymore.
+  if (group.first != 0 &&
+      tile_bytes(group.first, group.second) >
+          device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+    group = {0, 0};
+  if (group.first == 0) {
+    group = simgdetails::ocl_tune_2d(queue, kern, device, width, height,
+                                     set_args, tile_bytes);
+    std::lock_guard<std::mutex> lock(tuned.mutex);
+    tuned.groups[key] = group;
+  }
+
+  const auto [lw, lh] = group;
+  set_args(kern, lw, lh);
+  enqueue_kernel(queue, kern,
+                 cl::NDRange(seedimg::utils::round_up(width, lw),
+                             seedimg::utils::round_up(height, lh)),
+                 cl::NDRange(lw, lh), bytes);
+}
+
 // same with filters-core. sepia and rotate_hue internally call this function.
 static inline void apply_mat(simg &inp_img, simg &res_img, const fsmat &mat,
                              cl::Buffer *inp_buf = nullptr,
@@ -232,6 +582,18 @@ static inline void apply_mat_i(simg &inp_img, const fsmat &mat,
   apply_mat(inp_img, inp_img, mat, inp_buf, res_buf);
 }
 
+static inline void apply_mat(device_img &inp_img, device_img &res_img,
+                             const fsmat &mat) {
+  cl_float16 matvec;
+  for (std::size_t i = 0; i < 16; i++)
+    matvec.s[i] = mat[i];
+  exec_device(inp_img, res_img, "apply_mat", matvec);
+}
+static inline void apply_mat(device_img &inp_img, device_img &res_img,
+                             const smat &mat) {
+  apply_mat(inp_img, res_img, to_fsmat(mat));
+}
+
 // stupid autoformatter keeps ruining my perfect alignment
 static inline void apply_mat(simg &inp_img, simg &res_img, const smat &mat,
                              cl::Buffer *inp_buf = nullptr,
@@ -251,6 +613,9 @@ static inline void grayscale(simg &inp_img, simg &res_img,
 static inline void grayscale_i(simg &inp_img, cl::Buffer *inp_buf = nullptr) {
   grayscale(inp_img, inp_img, inp_buf, inp_buf);
 }
+static inline void grayscale(device_img &inp_img, device_img &res_img) {
+  apply_mat(inp_img, res_img, GRAYSCALE_LUM_MAT);
+}
 
 static inline void sepia(simg &inp_img, simg &res_img,
                          cl::Buffer *inp_buf = nullptr,
@@ -260,6 +625,9 @@ static inline void sepia(simg &inp_img, simg &res_img,
 static inline void sepia_i(simg &inp_img, cl::Buffer *inp_buf = nullptr) {
   sepia(inp_img, inp_img, inp_buf, inp_buf);
 }
+static inline void sepia(device_img &inp_img, device_img &res_img) {
+  apply_mat(inp_img, res_img, SEPIA_MAT);
+}
 
 static inline void rotate_hue(simg &inp_img, simg &res_img, float angle,
                               cl::Buffer *inp_buf = nullptr,
@@ -271,6 +639,10 @@ static inline void rotate_hue_i(simg &inp_img, float angle,
                                 cl::Buffer *inp_buf = nullptr) {
   rotate_hue(inp_img, inp_img, angle, inp_buf, inp_buf);
 }
+static inline void rotate_hue(device_img &inp_img, device_img &res_img,
+                              float angle) {
+  apply_mat(inp_img, res_img, generate_hue_mat(angle));
+}
 
 static inline void saturation(simg &inp_img, simg &res_img, float mul,
                               cl::Buffer *inp_buf = nullptr,
@@ -286,6 +658,13 @@ static inline void saturation_i(simg &inp_img, float mul,
                                 cl::Buffer *inp_buf = nullptr) {
   saturation(inp_img, inp_img, mul, inp_buf, inp_buf);
 }
+static inline void saturation(device_img &inp_img, device_img &res_img,
+                              float mul) {
+  if (inp_img.colourspace() == seedimg::colourspaces::hsv)
+    exec_device(inp_img, res_img, "saturation_hsv", mul);
+  else
+    apply_mat(inp_img, res_img, generate_saturation_mat(mul));
+}
 
 static inline void contrast(simg &input, simg &output, float intensity,
                             cl::Buffer *inp_buf = nullptr,
@@ -296,6 +675,10 @@ static inline void contrast_i(simg &image, float intensity,
                               cl::Buffer *inp_buf = nullptr) {
   contrast(image, image, intensity, inp_buf, inp_buf);
 }
+static inline void contrast(device_img &input, device_img &output,
+                            float intensity) {
+  apply_mat(input, output, generate_contrast_mat(intensity));
+}
 
 static inline void brightness(simg &inp_img, simg &res_img, int intensity,
                               cl::Buffer *inp_buf = nullptr,
@@ -307,6 +690,10 @@ static inline void brightness_i(simg &inp_img, int intensity,
                                 cl::Buffer *inp_buf = nullptr) {
   brightness(inp_img, inp_img, intensity, inp_buf, inp_buf);
 }
+static inline void brightness(device_img &inp_img, device_img &res_img,
+                              int intensity) {
+  apply_mat(inp_img, res_img, generate_brightness_mat(intensity));
+}
 
 static inline void brightness_a(simg &inp_img, simg &res_img, int intensity,
                                 cl::Buffer *inp_buf = nullptr,
@@ -318,6 +705,10 @@ static inline void brightness_a_i(simg &inp_img, int intensity,
                                   cl::Buffer *inp_buf = nullptr) {
   brightness_a(inp_img, inp_img, intensity, inp_buf, inp_buf);
 }
+static inline void brightness_a(device_img &inp_img, device_img &res_img,
+                                int intensity) {
+  exec_device(inp_img, res_img, "brightness_a", intensity);
+}
 
 namespace cconv {
 static inline void rgb(simg &inp_img, simg &res_img,
@@ -339,6 +730,16 @@ static inline void rgb_i(simg &inp_img, cl::Buffer *inp_buf = nullptr) {
   rgb(inp_img, inp_img, inp_buf, inp_buf);
 }
 
+static inline void rgb(device_img &inp_img, device_img &res_img) {
+  if (inp_img.colourspace() == seedimg::colourspaces::rgb)
+    return;
+  else if (inp_img.colourspace() != seedimg::colourspaces::hsv)
+    throw std::invalid_argument("Colourspace is not HSV");
+
+  exec_device(inp_img, res_img, "hsv2rgb");
+  res_img.set_colourspace(seedimg::colourspaces::rgb);
+}
+
 static inline void hsv(simg &inp_img, simg &res_img,
                        cl::Buffer *inp_buf = nullptr,
                        cl::Buffer *res_buf = nullptr) {
@@ -357,7 +758,597 @@ static inline void hsv(simg &inp_img, simg &res_img,
 static inline void hsv_i(simg &inp_img, cl::Buffer *inp_buf = nullptr) {
   hsv(inp_img, inp_img, inp_buf, inp_buf);
 }
+
+static inline void hsv(device_img &inp_img, device_img &res_img) {
+  if (inp_img.colourspace() == seedimg::colourspaces::hsv)
+    return;
+  else if (inp_img.colourspace() != seedimg::colourspaces::rgb)
+    throw std::invalid_argument("Colourspace is not RGB");
+
+  exec_device(inp_img, res_img, "rgb2hsv");
+  res_img.set_colourspace(seedimg::colourspaces::hsv);
+}
 } // namespace cconv
+
+/**
+ * @brief Box blur, same as seedimg::filters::blur_i: it times a horizontal
+ * and a vertical pass over tiles in local memory.
+ */
+static inline void blur(device_img &inp_img, device_img &res_img,
+                        unsigned int blur_level, std::uint8_t it = 3) {
+  if (blur_level != 0)
+    blur_level = simgdetails::clamped_blur_level(
+        blur_level, inp_img.width(), inp_img.height());
+  if (blur_level == 0 || it == 0) {
+    copy(inp_img, res_img);
+    return;
+  }
+
+  const int width = static_cast<int>(inp_img.width());
+  const int height = static_cast<int>(inp_img.height());
+  const int r = static_cast<int>(blur_level);
+  cl::Buffer rows{get_context(), CL_MEM_READ_WRITE,
+                  sizeof(seedimg::pixel) * inp_img.pixels()};
+  cl::CommandQueue &queue = res_img.queue();
+  const std::size_t bytes = 2 * sizeof(seedimg::pixel) * inp_img.pixels();
+
+  cl::Buffer *src = &inp_img.buffer();
+  for (std::uint8_t i = 0; i < it; ++i) {
+    exec_2d(
+        queue, "box_blur_rows", width, height,
+        [&](cl::Kernel &kern, std::size_t lw, std::size_t lh) {
+          kern.setArg(0, width);
+          kern.setArg(1, height);
+          kern.setArg(2, r);
+          kern.setArg(3, cl::Local(sizeof(cl_uchar4) * lh * (lw + 2 * r - 1)));
+          kern.setArg(4, *src);
+          kern.setArg(5, rows);
+        },
+        [&](std::size_t lw, std::size_t lh) {
+          return sizeof(cl_uchar4) * lh * (lw + 2 * r - 1);
+        },
+        bytes);
+    exec_2d(
+        queue, "box_blur_cols", width, height,
+        [&](cl::Kernel &kern, std::size_t lw, std::size_t lh) {
+          kern.setArg(0, width);
+          kern.setArg(1, height);
+          kern.setArg(2, r);
+          kern.setArg(3, cl::Local(sizeof(cl_uchar4) * lw * (lh + 2 * r - 1)));
+          kern.setArg(4, rows);
+          kern.setArg(5, res_img.buffer());
+        },
+        [&](std::size_t lw, std::size_t lh) {
+          return sizeof(cl_uchar4) * lw * (lh + 2 * r - 1);
+        },
+        bytes);
+    src = &res_img.buffer();
+  }
+  res_img.set_colourspace(inp_img.colourspace());
+}
+
+static inline void blur_i(simg &inp_img, unsigned int blur_level,
+                          std::uint8_t it = 3) {
+  device_img dev(inp_img);
+  blur(dev, dev, blur_level, it);
+  dev.download(inp_img);
+}
+
+/**
+ * @brief Same as seedimg::filters::convolution for rank-1 kernels, which
+ * are applied as a horizontal and a vertical pass over tiles in local
+ * memory.
+ * @throws std::invalid_argument if the kernel is not separable.
+ */
+static inline void convolution(device_img &inp_img, device_img &res_img,
+                               const std::vector<std::vector<float>> &kernel) {
+  const auto k = simgdetails::conv::prepare_kernel(kernel);
+  if (!k) {
+    copy(inp_img, res_img);
+    return;
+  }
+  const auto vectors = simgdetails::conv::separate(*k);
+  if (!vectors)
+    throw std::invalid_argument("Kernel is not separable");
+  auto col = vectors->first, row = vectors->second;
+
+  const int width = static_cast<int>(inp_img.width());
+  const int height = static_cast<int>(inp_img.height());
+  const int kw = static_cast<int>(k->w), kh = static_cast<int>(k->h);
+  const int ox = static_cast<int>(k->ox), oy = static_cast<int>(k->oy);
+  const auto &context = get_context();
+  cl::Buffer row_taps{context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                      sizeof(float) * row.size(), row.data()};
+  cl::Buffer col_taps{context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                      sizeof(float) * col.size(), col.data()};
+  // OpenCL keeps buffers alive until the commands using them are done.
+  cl::Buffer rows{context, CL_MEM_READ_WRITE,
+                  sizeof(cl_float4) * inp_img.pixels()};
+  cl::CommandQueue &queue = res_img.queue();
+
+  exec_2d(
+      queue, "convolve_rows", width, height,
+      [&](cl::Kernel &kern, std::size_t lw, std::size_t lh) {
+        kern.setArg(0, width);
+        kern.setArg(1, height);
+        kern.setArg(2, kw);
+        kern.setArg(3, ox);
+        kern.setArg(4, row_taps);
+        kern.setArg(5, cl::Local(sizeof(cl_float4) * lh * (lw + kw - 1)));
+        kern.setArg(6, inp_img.buffer());
+        kern.setArg(7, rows);
+      },
+      [&](std::size_t lw, std::size_t lh) {
+        return sizeof(cl_float4) * lh * (lw + kw - 1);
+      },
+      (sizeof(seedimg::pixel) + sizeof(cl_float4)) * inp_img.pixels());
+  exec_2d(
+      queue, "convolve_cols", width, height,
+      [&](cl::Kernel &kern, std::size_t lw, std::size_t lh) {
+        kern.setArg(0, width);
+        kern.setArg(1, height);
+        kern.setArg(2, kh);
+        kern.setArg(3, oy);
+        kern.setArg(4, col_taps);
+        kern.setArg(5, cl::Local(sizeof(cl_float4) * lw * (lh + kh - 1)));
+        kern.setArg(6, rows);
+        kern.setArg(7, inp_img.buffer());
+        kern.setArg(8, res_img.buffer());
+      },
+      [&](std::size_t lw, std::size_t lh) {
+        return sizeof(cl_float4) * lw * (lh + kh - 1);
+      },
+      (2 * sizeof(seedimg::pixel) + sizeof(cl_float4)) * inp_img.pixels());
+  res_img.set_colourspace(inp_img.colourspace());
+}
+
+static inline void convolution(simg &input, simg &output,
+                               const std::vector<std::vector<float>> &kernel) {
+  device_img dev(input);
+  convolution(dev, dev, kernel);
+  dev.download(output);
+}
+
+/**
+ * @brief Resample inp_img to the dimensions of res_img, with the same
+ * weights as seedimg::filters::resize but kept in float.
+ */
+static inline void
+resize(device_img &inp_img, device_img &res_img,
+       resample_filter filter = resample_filter::bicubic) {
+  if (inp_img.pixels() == 0 || res_img.pixels() == 0)
+    return;
+  const auto xw = simgdetails::resample::weights(inp_img.width(),
+                                                 res_img.width(), filter);
+  const auto yw = simgdetails::resample::weights(inp_img.height(),
+                                                 res_img.height(), filter);
+  const int src_width = static_cast<int>(inp_img.width());
+  const int src_height = static_cast<int>(inp_img.height());
+  const int width = static_cast<int>(res_img.width());
+  const int height = static_cast<int>(res_img.height());
+  const int xtaps = static_cast<int>(xw.taps);
+  const int ytaps = static_cast<int>(yw.taps);
+
+  const auto &context = get_context();
+  auto buffer_of = [&](const auto &vec) {
+    void *data = const_cast<void *>(static_cast<const void *>(vec.data()));
+    return cl::Buffer{context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                      sizeof(vec[0]) * vec.size(), data};
+  };
+  cl::Buffer xfirst = buffer_of(xw.first), xweights = buffer_of(xw.weights);
+  cl::Buffer yfirst = buffer_of(yw.first), yweights = buffer_of(yw.weights);
+  cl::Buffer rows{context, CL_MEM_READ_WRITE,
+                  sizeof(cl_float4) * res_img.width() * inp_img.height()};
+  cl::CommandQueue &queue = res_img.queue();
+  auto no_tile = [](std::size_t, std::size_t) { return std::size_t{0}; };
+
+  exec_2d(
+      queue, "resample_rows", width, src_height,
+      [&](cl::Kernel &kern, std::size_t, std::size_t) {
+        kern.setArg(0, src_width);
+        kern.setArg(1, width);
+        kern.setArg(2, src_height);
+        kern.setArg(3, xtaps);
+        kern.setArg(4, xfirst);
+        kern.setArg(5, xweights);
+        kern.setArg(6, inp_img.buffer());
+        kern.setArg(7, rows);
+      },
+      no_tile,
+      sizeof(seedimg::pixel) * inp_img.pixels() +
+          sizeof(cl_float4) * width * src_height);
+  exec_2d(
+      queue, "resample_cols", width, height,
+      [&](cl::Kernel &kern, std::size_t, std::size_t) {
+        kern.setArg(0, width);
+        kern.setArg(1, src_height);
+        kern.setArg(2, height);
+        kern.setArg(3, ytaps);
+        kern.setArg(4, yfirst);
+        kern.setArg(5, yweights);
+        kern.setArg(6, rows);
+        kern.setArg(7, res_img.buffer());
+      },
+      no_tile,
+      sizeof(cl_float4) * width * src_height +
+          sizeof(seedimg::pixel) * res_img.pixels());
+  res_img.set_colourspace(inp_img.colourspace());
+}
+
+static inline void
+resize(simg &inp_img, simg &res_img,
+       resample_filter filter = resample_filter::bicubic) {
+  device_img inp(inp_img);
+  device_img res(res_img->width(), res_img->height(), inp.colourspace(),
+                 inp.queue());
+  resize(inp, res, filter);
+  res.download(res_img);
+}
+
+/**
+ * @brief Chain of OpenCL filters that keeps the image on the device: it is
+ * uploaded once, every filter is enqueued back to back on it in place, and
+ * it is downloaded once at the end.
+ *
+ * Filters are the device_img overloads of the ones in this namespace,
+ * called as func(img, img, args...).
+ */
+class filterchain {
+private:
+  std::vector<std::function<void(device_img &)>> filters;
+  // whether each filter reads the neighbours of a pixel.
+  std::vector<bool> neighbours;
+
+  template <class... Params>
+  static bool reads_neighbours(void (*func)(device_img &, device_img &,
+                                            Params...)) noexcept {
+    using blur_fn = void (*)(device_img &, device_img &, unsigned int,
+                             std::uint8_t);
+    using conv_fn = void (*)(device_img &, device_img &,
+                             const std::vector<std::vector<float>> &);
+    using resize_fn = void (*)(device_img &, device_img &, resample_filter);
+    const auto addr = reinterpret_cast<void (*)()>(func);
+    return addr == reinterpret_cast<void (*)()>(static_cast<blur_fn>(blur)) ||
+           addr == reinterpret_cast<void (*)()>(
+                       static_cast<conv_fn>(convolution)) ||
+           addr == reinterpret_cast<void (*)()>(static_cast<resize_fn>(resize));
+  }
+
+public:
+  /**
+   * @brief Push a device filter to the end of the queue, binding args to it.
+   * @note Default arguments of the filter must be specified too.
+   */
+  template <class... Params, class... Args>
+  filterchain &add(void (*func)(device_img &, device_img &, Params...),
+                   Args &&... args) {
+    filters.push_back(std::bind(func, std::placeholders::_1,
+                                std::placeholders::_1,
+                                std::forward<Args>(args)...));
+    neighbours.push_back(reads_neighbours(func));
+    return *this;
+  }
+
+  /**
+   * @brief Push a colour matrix to the end of the queue, same as adding
+   * apply_mat with it.
+   */
+  filterchain &add_mat(const fsmat &mat) {
+    filters.push_back([mat](device_img &img) { apply_mat(img, img, mat); });
+    neighbours.push_back(false);
+    return *this;
+  }
+
+  /**
+   * @brief Pop-off the most recently added filter in queue.
+   */
+  filterchain &pop() {
+    filters.pop_back();
+    neighbours.pop_back();
+    return *this;
+  }
+
+  /**
+   * @brief Whether every filter in the queue works on each pixel on its own,
+   * so that the chain can be run on any part of an image. blur, convolution
+   * and resize read the pixels around.
+   */
+  bool row_local() const noexcept {
+    return std::find(neighbours.begin(), neighbours.end(), true) ==
+           neighbours.end();
+  }
+
+  /**
+   * @brief Enqueue every filter on an image already on the device.
+   */
+  filterchain &eval(device_img &img) {
+    for (const auto &f : filters)
+      f(img);
+    return *this;
+  }
+
+  /**
+   * @brief Upload in, run the filters on it and download the result to out,
+   * which has the same dimensions.
+   */
+  filterchain &eval(simg &in, simg &out) {
+    device_img dev(in);
+    eval(dev);
+    dev.download(out);
+    return *this;
+  }
+
+  filterchain &eval(simg &img) { return eval(img, img); }
+
+  /**
+   * @brief Enqueue uploading in to dev, the filters and downloading the
+   * result to out, without waiting for any of it. in and out may be the same
+   * image, have the dimensions of dev and must stay alive until the
+   * returned event completes.
+   * @param wait events the upload waits for.
+   * @return event of the download, wait on it before using out.
+   */
+  cl::Event eval_async(simg &in, simg &out, device_img &dev,
+                       const std::vector<cl::Event> *wait = nullptr) {
+    dev.upload_async(in, wait);
+    eval(dev);
+    cl::Event done;
+    dev.download_async(out, nullptr, &done);
+    return done;
+  }
+
+  /**
+   * @brief Run the filters on every frame in place, with depth frames in
+   * flight at once, each on its own queue and buffer: while one frame runs
+   * through the filters the next is being uploaded and the previous one
+   * downloaded.
+   */
+  filterchain &eval(seedimg::anim &frames, std::size_t depth = 2) {
+    return eval_frames(frames.begin(), frames.end(), depth);
+  }
+
+  /**
+   * @brief Same as for animations, for a batch of images of any size.
+   */
+  filterchain &eval(std::vector<simg> &imgs, std::size_t depth = 2) {
+    return eval_frames(imgs.begin(), imgs.end(), depth);
+  }
+
+private:
+  template <class It>
+  filterchain &eval_frames(It first, It last, std::size_t depth) {
+    depth = std::max<std::size_t>(depth, 1);
+    std::vector<device_img> slots;
+    // last download of each slot, later ones on a slot are ordered by its
+    // queue.
+    std::vector<cl::Event> pending;
+    try {
+      for (std::size_t i = 0; first != last; ++first, ++i) {
+        simg &frame = *first;
+        const std::size_t slot = i % depth;
+        if (slot == slots.size()) {
+          slots.emplace_back(frame->width(), frame->height(),
+                             frame->colourspace(), make_queue());
+          pending.emplace_back();
+        } else if (slots[slot].width() != frame->width() ||
+                   slots[slot].height() != frame->height()) {
+          // the old buffer is kept alive by the commands still using it.
+          cl::CommandQueue queue = slots[slot].queue();
+          slots[slot] = device_img(frame->width(), frame->height(),
+                                   frame->colourspace(), std::move(queue));
+        }
+        pending[slot] = eval_async(frame, frame, slots[slot]);
+      }
+    } catch (...) {
+      // transfers in flight still point into the frames.
+      for (auto &dev : slots)
+        dev.queue().finish();
+      throw;
+    }
+    if (!pending.empty())
+      cl::WaitForEvents(pending);
+    return *this;
+  }
+};
+
+/**
+ * @brief Splits the work of a filterchain across several queues, by default
+ * one on every device: a large image in bands of rows, a batch image by
+ * image. Each queue gets a share of the pixels that follows the throughput
+ * measured on it, shares start out equal.
+ *
+ * Bands are only cut for chains which are row_local, a chain with a blur,
+ * convolution or resize runs on the whole image on a single queue instead.
+ * Throughput is measured with event profiling, the queues it makes itself
+ * have it enabled, the shares of given queues without it stay as they are.
+ */
+class splitter {
+public:
+  splitter() {
+    for (const auto &device : get_devices())
+      queues_.push_back(make_queue(device, true));
+    shares_.assign(queues_.size(), 1.0 / queues_.size());
+    slots_.resize(queues_.size());
+  }
+
+  /**
+   * @brief Split across the given queues, on any device of the context. A
+   * few queues on the same device overlap transfers with computation.
+   */
+  explicit splitter(std::vector<cl::CommandQueue> queues)
+      : queues_{std::move(queues)} {
+    if (queues_.empty())
+      throw std::invalid_argument("No queues to split across");
+    shares_.assign(queues_.size(), 1.0 / queues_.size());
+    slots_.resize(queues_.size());
+  }
+
+  std::size_t size() const noexcept { return queues_.size(); }
+
+  /**
+   * @brief Fraction of the work each queue gets, they add up to 1.
+   */
+  const std::vector<double> &shares() const noexcept { return shares_; }
+
+  /**
+   * @brief Run chain on in, a band of rows per queue, into out which has
+   * the same dimensions and may be in. Chains which aren't row_local would
+   * give wrong pixels along the edges of the bands, they run on the queue
+   * with the largest share.
+   */
+  splitter &eval(filterchain &chain, simg &in, simg &out) {
+    const simg_int width = in->width(), height = in->height();
+    std::vector<simg> ins, outs;
+    std::vector<cl::Event> first(size()), last(size());
+    std::vector<double> work(size(), 0.0);
+    if (!chain.row_local()) {
+      const auto q = static_cast<std::size_t>(
+          std::max_element(shares_.begin(), shares_.end()) - shares_.begin());
+      guarded([&] {
+        device_img &dev = slot(q, in);
+        dev.upload_async(in, nullptr, &first[q]);
+        chain.eval(dev);
+        dev.download_async(out, nullptr, &last[q]);
+        work[q] = static_cast<double>(width * height);
+      });
+      finish(work, first, last);
+      static_cast<seedimg::uimg *>(out.get())
+          ->set_colourspace(slots_[q]->colourspace());
+      return *this;
+    }
+    guarded([&] {
+      double cumulative = 0.0;
+      simg_int start = 0;
+      for (std::size_t q = 0; q < size(); ++q) {
+        cumulative += shares_[q];
+        const simg_int end =
+            q + 1 == size()
+                ? height
+                : std::min(height, static_cast<simg_int>(std::llround(
+                                       cumulative * height)));
+        if (end <= start)
+          continue;
+        // the bands are views, rows are contiguous.
+        ins.push_back(std::make_unique<seedimg::img>(
+            width, end - start, in->row(start),
+            seedimg::view_allocator::instance()));
+        outs.push_back(std::make_unique<seedimg::img>(
+            width, end - start, out->row(start),
+            seedimg::view_allocator::instance()));
+        static_cast<seedimg::uimg *>(ins.back().get())
+            ->set_colourspace(in->colourspace());
+        device_img &dev = slot(q, ins.back());
+        dev.upload_async(ins.back(), nullptr, &first[q]);
+        chain.eval(dev);
+        dev.download_async(outs.back(), nullptr, &last[q]);
+        work[q] = static_cast<double>(width * (end - start));
+        start = end;
+      }
+    });
+    finish(work, first, last);
+    if (!outs.empty())
+      static_cast<seedimg::uimg *>(out.get())
+          ->set_colourspace(outs.front()->colourspace());
+    return *this;
+  }
+
+  splitter &eval(filterchain &chain, simg &img) {
+    return eval(chain, img, img);
+  }
+
+  /**
+   * @brief Run chain on every image in place, each going to the queue that
+   * is expected to be done with it first.
+   */
+  splitter &eval(filterchain &chain, std::vector<simg> &imgs) {
+    std::vector<cl::Event> first(size()), last(size());
+    std::vector<double> work(size(), 0.0);
+    guarded([&] {
+      for (auto &img : imgs) {
+        const double pixels = static_cast<double>(img->width() * img->height());
+        std::size_t best = 0;
+        for (std::size_t q = 1; q < size(); ++q)
+          if ((work[q] + pixels) / shares_[q] <
+              (work[best] + pixels) / shares_[best])
+            best = q;
+        device_img &dev = slot(best, img);
+        // later images on a queue are ordered after the earlier ones.
+        dev.upload_async(img, nullptr,
+                         work[best] == 0 ? &first[best] : nullptr);
+        chain.eval(dev);
+        dev.download_async(img, nullptr, &last[best]);
+        work[best] += pixels;
+      }
+    });
+    finish(work, first, last);
+    return *this;
+  }
+
+private:
+  std::vector<cl::CommandQueue> queues_;
+  std::vector<double> shares_;
+  // device image of each queue, kept while the dimensions don't change.
+  std::vector<std::unique_ptr<device_img>> slots_;
+
+  device_img &slot(std::size_t q, const simg &img) {
+    auto &dev = slots_[q];
+    if (dev == nullptr || dev->width() != img->width() ||
+        dev->height() != img->height())
+      // the old buffer is kept alive by the commands still using it.
+      dev = std::make_unique<device_img>(img->width(), img->height(),
+                                         img->colourspace(), queues_[q]);
+    return *dev;
+  }
+
+  // transfers in flight point into host images, don't leave before they are
+  // done.
+  template <class F> void guarded(F &&enqueue) {
+    try {
+      enqueue();
+    } catch (...) {
+      for (auto &queue : queues_)
+        queue.finish();
+      throw;
+    }
+  }
+
+  // waits for the last download of every queue and moves the shares of the
+  // queues which did some work halfway to their measured throughput.
+  void finish(const std::vector<double> &work,
+              const std::vector<cl::Event> &first,
+              const std::vector<cl::Event> &last) {
+    std::vector<cl::Event> pending;
+    for (std::size_t q = 0; q < size(); ++q)
+      if (work[q] != 0)
+        pending.push_back(last[q]);
+    if (pending.empty())
+      return;
+    cl::WaitForEvents(pending);
+
+    std::vector<double> rate(size(), 0.0);
+    double measured_share = 0.0, measured_rate = 0.0;
+    for (std::size_t q = 0; q < size(); ++q) {
+      if (work[q] == 0)
+        continue;
+      cl_int err_start = CL_SUCCESS, err_end = CL_SUCCESS;
+      const cl_ulong start =
+          first[q].getProfilingInfo<CL_PROFILING_COMMAND_START>(&err_start);
+      const cl_ulong end =
+          last[q].getProfilingInfo<CL_PROFILING_COMMAND_END>(&err_end);
+      if (err_start != CL_SUCCESS || err_end != CL_SUCCESS || end <= start)
+        continue;
+      rate[q] = work[q] / static_cast<double>(end - start);
+      measured_share += shares_[q];
+      measured_rate += rate[q];
+    }
+    if (measured_rate <= 0.0)
+      return;
+    for (std::size_t q = 0; q < size(); ++q)
+      if (rate[q] > 0.0)
+        shares_[q] =
+            (shares_[q] + measured_share * rate[q] / measured_rate) / 2;
+  }
+};
 } // namespace ocl
 } // namespace seedimg::filters
 
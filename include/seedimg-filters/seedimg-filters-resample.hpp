@@ -0,0 +1,289 @@
+/***********************************************************************
+    seedimg - module based image manipulation library written in modern C++
+    Copyright (C) 2020 telugu-boy, tripulse
+
+    This program is free software : you can redistribute it and /
+    or modify it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation,
+    either version 3 of the License,
+    or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+************************************************************************/
+
+#ifndef SEEDIMG_FILTERS_RESAMPLE_H
+#define SEEDIMG_FILTERS_RESAMPLE_H
+
+// Resampling engine behind seedimg::filters::resize. Both axes are
+// resampled separately, each output pixel of a pass is a weighted sum of a
+// window of input pixels along one axis. The weights only depend on the
+// sizes, so they are computed once per axis, in float, then quantized to
+// fixed point for the integer kernels in seedimg-filters-simd.hpp. Windows
+// are clipped at the edges and renormalised, instead of extending the image.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <seedimg-filters/seedimg-filters-simd.hpp>
+#include <seedimg-utils.hpp>
+#include <seedimg.hpp>
+#include <vector>
+
+namespace seedimg::filters {
+/**
+ * @brief Filters resize can resample with, from the blurriest to the
+ * sharpest. area averages every input pixel an output pixel covers, which
+ * is the one to use when shrinking a lot.
+ */
+enum class resample_filter { bilinear, bicubic, lanczos, area };
+} // namespace seedimg::filters
+
+namespace simgdetails::resample {
+using seedimg::filters::resample_filter;
+
+/**
+ * @brief Output pixel i along an axis is the sum of
+ * weights[i * taps + t] * input(first[i] + t), t < taps.
+ */
+struct axis {
+  simg_int taps = 0;
+  std::vector<std::int32_t> first;
+  std::vector<float> weights;
+};
+
+// same as axis, with weights in fixed point.
+struct fixed_axis {
+  simg_int taps = 0;
+  std::vector<std::int32_t> first;
+  std::vector<std::int16_t> weights;
+};
+
+// radius of the filter, in input pixels, when not shrinking.
+static inline double support(resample_filter f) noexcept {
+  switch (f) {
+  case resample_filter::bilinear:
+    return 1.0;
+  case resample_filter::bicubic:
+    return 2.0;
+  case resample_filter::lanczos:
+    return 3.0;
+  default:
+    return 0.5;
+  }
+}
+
+static inline double sinc(double x) noexcept {
+  constexpr double pi = 3.14159265358979323846;
+  if (x == 0.0)
+    return 1.0;
+  x *= pi;
+  return std::sin(x) / x;
+}
+
+// value of the filter at distance x from the center. area isn't sampled,
+// weights takes the overlap of pixels instead.
+static inline double evaluate(resample_filter f, double x) noexcept {
+  x = std::abs(x);
+  switch (f) {
+  case resample_filter::bilinear:
+    return x < 1.0 ? 1.0 - x : 0.0;
+  case resample_filter::bicubic:
+    // Keys' cubic with a = -0.5, also known as Catmull-Rom.
+    if (x < 1.0)
+      return (1.5 * x - 2.5) * x * x + 1.0;
+    if (x < 2.0)
+      return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    return 0.0;
+  case resample_filter::lanczos:
+    return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+  default:
+    return 0.0;
+  }
+}
+
+/**
+ * @brief Weights resampling src pixels to dst, which must both be non zero.
+ * Pixel centers are aligned, output pixel i sits at (i + 0.5) * src / dst.
+ */
+static inline axis weights(simg_int src, simg_int dst, resample_filter f) {
+  const double scale = static_cast<double>(src) / static_cast<double>(dst);
+  // when shrinking the filter is stretched over scale input pixels, so
+  // that it also removes the frequencies the output can't hold.
+  const double stretch = std::max(scale, 1.0);
+  const double radius = support(f) * stretch;
+
+  std::vector<simg_int> lo(dst);
+  std::vector<std::vector<double>> windows(dst);
+  simg_int taps = 1;
+  for (simg_int i = 0; i < dst; ++i) {
+    const double center = (static_cast<double>(i) + 0.5) * scale;
+    simg_int a = seedimg::utils::clamp(
+        static_cast<simg_int>(std::max(std::floor(center - radius), 0.0)),
+        simg_int{0}, src);
+    const simg_int b = seedimg::utils::clamp(
+        static_cast<simg_int>(std::max(std::ceil(center + radius), 0.0)),
+        simg_int{0}, src);
+    auto &w = windows[i];
+    for (simg_int j = a; j < b; ++j) {
+      const double x = static_cast<double>(j);
+      if (f == resample_filter::area)
+        w.push_back(std::max(0.0, std::min(x + 1.0, center + stretch / 2) -
+                                      std::max(x, center - stretch / 2)));
+      else
+        w.push_back(evaluate(f, (x + 0.5 - center) / stretch));
+    }
+
+    // the window is rounded outwards, its ends are often zero.
+    while (!w.empty() && w.back() == 0.0)
+      w.pop_back();
+    simg_int skip = 0;
+    while (skip < static_cast<simg_int>(w.size()) && w[skip] == 0.0)
+      ++skip;
+    w.erase(w.begin(), w.begin() + skip);
+    a += skip;
+
+    double sum = 0.0;
+    for (auto e : w)
+      sum += e;
+    if (w.empty() || sum == 0.0) {
+      a = std::min(static_cast<simg_int>(center), src - 1);
+      w.assign(1, 1.0);
+      sum = 1.0;
+    }
+    for (auto &e : w)
+      e /= sum;
+    lo[i] = a;
+    taps = std::max(taps, static_cast<simg_int>(w.size()));
+  }
+
+  // every window gets the same amount of taps, shifted left at the right
+  // edge so that none reads past the input.
+  axis res;
+  res.taps = taps;
+  res.first.resize(dst);
+  res.weights.assign(dst * taps, 0.0f);
+  for (simg_int i = 0; i < dst; ++i) {
+    const simg_int first = std::min(lo[i], src - taps);
+    res.first[i] = static_cast<std::int32_t>(first);
+    for (std::size_t t = 0; t < windows[i].size(); ++t)
+      res.weights[i * taps + (lo[i] - first) + t] =
+          static_cast<float>(windows[i][t]);
+  }
+  return res;
+}
+
+static inline fixed_axis quantize(const axis &ax) {
+  constexpr std::int32_t one = 1 << simd::resample_bits;
+  fixed_axis res;
+  res.taps = ax.taps;
+  res.first = ax.first;
+  res.weights.resize(ax.weights.size());
+  for (std::size_t i = 0; i < ax.first.size(); ++i) {
+    const float *w = ax.weights.data() + i * ax.taps;
+    std::int16_t *q = res.weights.data() + i * ax.taps;
+    std::int32_t sum = 0;
+    simg_int biggest = 0;
+    for (simg_int t = 0; t < ax.taps; ++t) {
+      q[t] = static_cast<std::int16_t>(std::lround(w[t] * one));
+      sum += q[t];
+      if (std::abs(w[t]) > std::abs(w[biggest]))
+        biggest = t;
+    }
+    // rounding mustn't change the brightness, the weights add up to one
+    // exactly.
+    q[biggest] = static_cast<std::int16_t>(q[biggest] + one - sum);
+  }
+  return res;
+}
+
+// every row of inp resampled to the width of res, which is as high.
+static inline void horizontal(simg &inp, simg &res, const fixed_axis &ax) {
+  const auto bands = seedimg::utils::start_end_rows(res);
+  thread_pool::instance().parallel_for(bands.size(), [&](std::size_t b) {
+    for (simg_int y = bands[b].first; y < bands[b].second; ++y)
+      simd::resample_row(inp->row(y), res->row(y), res->width(), ax.taps,
+                         ax.first.data(), ax.weights.data());
+  });
+}
+
+// every column of inp resampled to the height of res, which is as wide.
+static inline void vertical(simg &inp, simg &res, const fixed_axis &ax) {
+  const auto bands = seedimg::utils::start_end_rows(res);
+  thread_pool::instance().parallel_for(bands.size(), [&](std::size_t b) {
+    std::vector<const seedimg::pixel *> rows(ax.taps);
+    for (simg_int y = bands[b].first; y < bands[b].second; ++y) {
+      for (simg_int t = 0; t < ax.taps; ++t)
+        rows[t] = inp->row(ax.first[y] + t);
+      simd::resample_col(rows.data(), ax.weights.data() + y * ax.taps,
+                         ax.taps, res->row(y), res->width());
+    }
+  });
+}
+
+// res is inp shrunk by factor on both axes, by averaging blocks.
+static inline void decimate(simg &inp, simg &res, simg_int factor) {
+  const auto bands = seedimg::utils::start_end_rows(res);
+  thread_pool::instance().parallel_for(bands.size(), [&](std::size_t b) {
+    for (simg_int y = bands[b].first; y < bands[b].second; ++y)
+      simd::decimate_row(inp->row(y * factor), inp->width(), factor,
+                         res->row(y), res->width());
+  });
+}
+
+static inline void resize(simg &inp, simg &res, resample_filter f) {
+  const simg_int sw = inp->width(), sh = inp->height();
+  const simg_int dw = res->width(), dh = res->height();
+  static_cast<seedimg::uimg *>(res.get())
+      ->set_colourspace(inp->colourspace());
+  if (sw == 0 || sh == 0 || dw == 0 || dh == 0)
+    return;
+  if (sw == dw && sh == dh) {
+    if (inp != res)
+      std::copy(inp->data(), inp->data() + sw * sh, res->data());
+    return;
+  }
+  // the area filter of an exact 2x or 4x shrink is the mean of each block.
+  if (f == resample_filter::area)
+    for (simg_int factor : {2, 4})
+      if (sw == dw * factor && sh == dh * factor) {
+        decimate(inp, res, factor);
+        return;
+      }
+
+  // an axis which keeps its size has identity weights, skip its pass.
+  if (sw == dw) {
+    vertical(inp, res, quantize(weights(sh, dh, f)));
+    return;
+  }
+  if (sh == dh) {
+    horizontal(inp, res, quantize(weights(sw, dw, f)));
+    return;
+  }
+
+  const auto x = quantize(weights(sw, dw, f));
+  const auto y = quantize(weights(sh, dh, f));
+  // a pass costs about its output pixels times its taps, the intermediate
+  // image is the size after the first pass.
+  const double rows_first = static_cast<double>(sh) * dw * x.taps +
+                            static_cast<double>(dh) * dw * y.taps;
+  const double cols_first = static_cast<double>(dh) * sw * y.taps +
+                            static_cast<double>(dh) * dw * x.taps;
+  if (rows_first <= cols_first) {
+    auto tmp = seedimg::make(dw, sh);
+    horizontal(inp, tmp, x);
+    vertical(tmp, res, y);
+  } else {
+    auto tmp = seedimg::make(sw, dh);
+    vertical(inp, tmp, y);
+    horizontal(tmp, res, x);
+  }
+}
+} // namespace simgdetails::resample
+
+#endif
@@ -0,0 +1,997 @@
+/***********************************************************************
+    seedimg - module based image manipulation library written in modern C++
+    Copyright (C) 2020 telugu-boy, tripulse
+
+    This program is free software : you can redistribute it and /
+    or modify it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation,
+    either version 3 of the License,
+    or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+************************************************************************/
+#ifndef SEEDIMG_FILTERS_SIMD_H
+#define SEEDIMG_FILTERS_SIMD_H
+
+// Vectorized kernels for the hottest filters. Each one works on a span of
+// contiguous pixels and has a scalar reference implementation; the vector
+// versions perform the exact same sequence of float multiplies and adds per
+// channel, in the same order, so their output is bit-identical to it.
+//
+// The best kernel is picked once, on first use, from what the CPU reports.
+// Define SIMG_NO_SIMD to always use the scalar kernels.
+
+#include <cstdint>
+#include <cstring>
+#include <seedimg-utils.hpp>
+#include <seedimg.hpp>
+
+#if !defined(SIMG_NO_SIMD) && defined(__SSE2__)
+#define SIMG_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#if !defined(SIMG_NO_SIMD) && defined(__GNUC__) &&                            \
+    (defined(__x86_64__) || defined(__i386__))
+#define SIMG_SIMD_AVX2
+#include <immintrin.h>
+#define SIMG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if !defined(SIMG_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define SIMG_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace simgdetails::simd {
+typedef void (*apply_mat_kernel)(const seedimg::pixel *inp,
+                                 seedimg::pixel *res, simg_int n,
+                                 const seedimg::fsmat &mat);
+typedef void (*apply_mat_lut_kernel)(const seedimg::pixel *inp,
+                                     seedimg::pixel *res, simg_int n,
+                                     const seedimg::slut<seedimg::smat> &lut,
+                                     const seedimg::lutvec &vec);
+
+static inline bool has_avx2() noexcept {
+#ifdef SIMG_SIMD_AVX2
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+// reference kernels. the alpha of res is left untouched.
+static inline void apply_mat_scalar(const seedimg::pixel *inp,
+                                    seedimg::pixel *res, simg_int n,
+                                    const seedimg::fsmat &mat) {
+  for (simg_int i = 0; i < n; ++i) {
+    seedimg::pixel pix = inp[i];
+    res[i].r = static_cast<std::uint8_t>(seedimg::utils::clamp(
+        mat[0] * pix.r + mat[4] * pix.g + mat[8] * pix.b + mat[12], 0,
+        seedimg::img::MAX_PIXEL_VALUE));
+    res[i].g = static_cast<std::uint8_t>(seedimg::utils::clamp(
+        mat[1] * pix.r + mat[5] * pix.g + mat[9] * pix.b + mat[13], 0,
+        seedimg::img::MAX_PIXEL_VALUE));
+    res[i].b = static_cast<std::uint8_t>(seedimg::utils::clamp(
+        mat[2] * pix.r + mat[6] * pix.g + mat[10] * pix.b + mat[14], 0,
+        seedimg::img::MAX_PIXEL_VALUE));
+  }
+}
+
+static inline void apply_mat_lut_scalar(const seedimg::pixel *inp,
+                                        seedimg::pixel *res, simg_int n,
+                                        const seedimg::slut<seedimg::smat> &lut,
+                                        const seedimg::lutvec &vec) {
+  for (simg_int i = 0; i < n; ++i) {
+    seedimg::pixel pix = inp[i];
+    res[i].r = static_cast<std::uint8_t>(seedimg::utils::clamp(
+        vec[0] + lut[0][pix.r] + lut[3][pix.g] + lut[6][pix.b], 0,
+        seedimg::img::MAX_PIXEL_VALUE));
+    res[i].g = static_cast<std::uint8_t>(seedimg::utils::clamp(
+        vec[1] + lut[1][pix.r] + lut[4][pix.g] + lut[7][pix.b], 0,
+        seedimg::img::MAX_PIXEL_VALUE));
+    res[i].b = static_cast<std::uint8_t>(seedimg::utils::clamp(
+        vec[2] + lut[2][pix.r] + lut[5][pix.g] + lut[8][pix.b], 0,
+        seedimg::img::MAX_PIXEL_VALUE));
+  }
+}
+
+#ifdef SIMG_SIMD_SSE2
+// 4 pixels per iteration, one float lane per pixel and one register per
+// channel.
+static inline void apply_mat_sse2(const seedimg::pixel *inp,
+                                  seedimg::pixel *res, simg_int n,
+                                  const seedimg::fsmat &mat) {
+  const __m128i lo = _mm_set1_epi32(0xFF);
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 max = _mm_set1_ps(seedimg::img::MAX_PIXEL_VALUE);
+  __m128 m[16];
+  for (std::size_t k = 0; k < 16; ++k)
+    m[k] = _mm_set1_ps(mat[k]);
+
+  simg_int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(inp + i));
+    __m128i keep = _mm_and_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(res + i)), alpha);
+    __m128 r = _mm_cvtepi32_ps(_mm_and_si128(px, lo));
+    __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), lo));
+    __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), lo));
+
+    __m128i out[3];
+    for (std::size_t c = 0; c < 3; ++c) {
+      __m128 v = _mm_add_ps(
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[c], r), _mm_mul_ps(m[c + 4], g)),
+                     _mm_mul_ps(m[c + 8], b)),
+          m[c + 12]);
+      out[c] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, zero), max));
+    }
+    __m128i packed = _mm_or_si128(
+        _mm_or_si128(out[0], _mm_slli_epi32(out[1], 8)),
+        _mm_or_si128(_mm_slli_epi32(out[2], 16), keep));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(res + i), packed);
+  }
+  apply_mat_scalar(inp + i, res + i, n - i, mat);
+}
+
+static inline void apply_mat_lut_sse2(const seedimg::pixel *inp,
+                                      seedimg::pixel *res, simg_int n,
+                                      const seedimg::slut<seedimg::smat> &lut,
+                                      const seedimg::lutvec &vec) {
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 max = _mm_set1_ps(seedimg::img::MAX_PIXEL_VALUE);
+
+  simg_int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const seedimg::pixel *p = inp + i;
+    __m128i keep = _mm_and_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(res + i)), alpha);
+    __m128i out[3];
+    for (std::size_t c = 0; c < 3; ++c) {
+      // SSE2 has no gathers, the table lookups are done one lane at a time.
+      __m128 lr = _mm_set_ps(lut[c][p[3].r], lut[c][p[2].r], lut[c][p[1].r],
+                             lut[c][p[0].r]);
+      __m128 lg = _mm_set_ps(lut[c + 3][p[3].g], lut[c + 3][p[2].g],
+                             lut[c + 3][p[1].g], lut[c + 3][p[0].g]);
+      __m128 lb = _mm_set_ps(lut[c + 6][p[3].b], lut[c + 6][p[2].b],
+                             lut[c + 6][p[1].b], lut[c + 6][p[0].b]);
+      __m128 v =
+          _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_set1_ps(vec[c]), lr), lg), lb);
+      out[c] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, zero), max));
+    }
+    __m128i packed = _mm_or_si128(
+        _mm_or_si128(out[0], _mm_slli_epi32(out[1], 8)),
+        _mm_or_si128(_mm_slli_epi32(out[2], 16), keep));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(res + i), packed);
+  }
+  apply_mat_lut_scalar(inp + i, res + i, n - i, lut, vec);
+}
+#endif
+
+#ifdef SIMG_SIMD_AVX2
+// 8 pixels per iteration, the lookup tables are read with gathers.
+SIMG_TARGET_AVX2 static inline void
+apply_mat_avx2(const seedimg::pixel *inp, seedimg::pixel *res, simg_int n,
+               const seedimg::fsmat &mat) {
+  const __m256i lo = _mm256_set1_epi32(0xFF);
+  const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 max = _mm256_set1_ps(seedimg::img::MAX_PIXEL_VALUE);
+  __m256 m[16];
+  for (std::size_t k = 0; k < 16; ++k)
+    m[k] = _mm256_set1_ps(mat[k]);
+
+  simg_int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i px =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(inp + i));
+    __m256i keep = _mm256_and_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(res + i)), alpha);
+    __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(px, lo));
+    __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), lo));
+    __m256 b =
+        _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), lo));
+
+    __m256i out[3];
+    for (std::size_t c = 0; c < 3; ++c) {
+      __m256 v = _mm256_add_ps(
+          _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[c], r),
+                                      _mm256_mul_ps(m[c + 4], g)),
+                        _mm256_mul_ps(m[c + 8], b)),
+          m[c + 12]);
+      out[c] = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(v, zero), max));
+    }
+    __m256i packed = _mm256_or_si256(
+        _mm256_or_si256(out[0], _mm256_slli_epi32(out[1], 8)),
+        _mm256_or_si256(_mm256_slli_epi32(out[2], 16), keep));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(res + i), packed);
+  }
+  apply_mat_scalar(inp + i, res + i, n - i, mat);
+}
+
+SIMG_TARGET_AVX2 static inline void
+apply_mat_lut_avx2(const seedimg::pixel *inp, seedimg::pixel *res, simg_int n,
+                   const seedimg::slut<seedimg::smat> &lut,
+                   const seedimg::lutvec &vec) {
+  const __m256i lo = _mm256_set1_epi32(0xFF);
+  const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 max = _mm256_set1_ps(seedimg::img::MAX_PIXEL_VALUE);
+
+  simg_int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i px =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(inp + i));
+    __m256i keep = _mm256_and_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(res + i)), alpha);
+    __m256i r = _mm256_and_si256(px, lo);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), lo);
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(px, 16), lo);
+
+    __m256i out[3];
+    for (std::size_t c = 0; c < 3; ++c) {
+      __m256 v = _mm256_add_ps(
+          _mm256_add_ps(
+              _mm256_add_ps(_mm256_set1_ps(vec[c]),
+                            _mm256_i32gather_ps(lut[c].data(), r, 4)),
+              _mm256_i32gather_ps(lut[c + 3].data(), g, 4)),
+          _mm256_i32gather_ps(lut[c + 6].data(), b, 4));
+      out[c] = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(v, zero), max));
+    }
+    __m256i packed = _mm256_or_si256(
+        _mm256_or_si256(out[0], _mm256_slli_epi32(out[1], 8)),
+        _mm256_or_si256(_mm256_slli_epi32(out[2], 16), keep));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(res + i), packed);
+  }
+  apply_mat_lut_scalar(inp + i, res + i, n - i, lut, vec);
+}
+#endif
+
+#ifdef SIMG_SIMD_NEON
+// widens 4 of the 16 lanes of a channel to floats.
+static inline float32x4_t neon_lanes_f32(uint8x16_t v, int quarter) {
+  uint16x8_t half =
+      vmovl_u8(quarter < 2 ? vget_low_u8(v) : vget_high_u8(v));
+  uint32x4_t quad = vmovl_u16(quarter % 2 == 0 ? vget_low_u16(half)
+                                               : vget_high_u16(half));
+  return vcvtq_f32_u32(quad);
+}
+
+static inline uint8x16_t neon_narrow_u8(const uint32x4_t (&q)[4]) {
+  return vcombine_u8(
+      vmovn_u16(vcombine_u16(vmovn_u32(q[0]), vmovn_u32(q[1]))),
+      vmovn_u16(vcombine_u16(vmovn_u32(q[2]), vmovn_u32(q[3]))));
+}
+
+// 16 pixels per iteration, vld4 splits the channels for free.
+static inline void apply_mat_neon(const seedimg::pixel *inp,
+                                  seedimg::pixel *res, simg_int n,
+                                  const seedimg::fsmat &mat) {
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t max = vdupq_n_f32(seedimg::img::MAX_PIXEL_VALUE);
+
+  simg_int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16x4_t px = vld4q_u8(reinterpret_cast<const std::uint8_t *>(inp + i));
+    uint8x16x4_t out = vld4q_u8(reinterpret_cast<const std::uint8_t *>(res + i));
+    for (int c = 0; c < 3; ++c) {
+      uint32x4_t q[4];
+      for (int k = 0; k < 4; ++k) {
+        float32x4_t v = vaddq_f32(
+            vaddq_f32(
+                vaddq_f32(vmulq_n_f32(neon_lanes_f32(px.val[0], k), mat[c]),
+                          vmulq_n_f32(neon_lanes_f32(px.val[1], k), mat[c + 4])),
+                vmulq_n_f32(neon_lanes_f32(px.val[2], k), mat[c + 8])),
+            vdupq_n_f32(mat[c + 12]));
+        q[k] = vcvtq_u32_f32(vminq_f32(vmaxq_f32(v, zero), max));
+      }
+      out.val[c] = neon_narrow_u8(q);
+    }
+    vst4q_u8(reinterpret_cast<std::uint8_t *>(res + i), out);
+  }
+  apply_mat_scalar(inp + i, res + i, n - i, mat);
+}
+
+static inline void apply_mat_lut_neon(const seedimg::pixel *inp,
+                                      seedimg::pixel *res, simg_int n,
+                                      const seedimg::slut<seedimg::smat> &lut,
+                                      const seedimg::lutvec &vec) {
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t max = vdupq_n_f32(seedimg::img::MAX_PIXEL_VALUE);
+
+  simg_int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const seedimg::pixel *p = inp + i;
+    uint8x16x4_t out = vld4q_u8(reinterpret_cast<const std::uint8_t *>(res + i));
+    for (int c = 0; c < 3; ++c) {
+      uint32x4_t q[4];
+      for (int k = 0; k < 4; ++k) {
+        float lr[4], lg[4], lb[4];
+        for (int l = 0; l < 4; ++l) {
+          lr[l] = lut[c][p[k * 4 + l].r];
+          lg[l] = lut[c + 3][p[k * 4 + l].g];
+          lb[l] = lut[c + 6][p[k * 4 + l].b];
+        }
+        float32x4_t v = vaddq_f32(
+            vaddq_f32(vaddq_f32(vdupq_n_f32(vec[c]), vld1q_f32(lr)),
+                      vld1q_f32(lg)),
+            vld1q_f32(lb));
+        q[k] = vcvtq_u32_f32(vminq_f32(vmaxq_f32(v, zero), max));
+      }
+      out.val[c] = neon_narrow_u8(q);
+    }
+    vst4q_u8(reinterpret_cast<std::uint8_t *>(res + i), out);
+  }
+  apply_mat_lut_scalar(inp + i, res + i, n - i, lut, vec);
+}
+#endif
+
+static inline apply_mat_kernel apply_mat_best() noexcept {
+  static const apply_mat_kernel kernel = [] {
+#ifdef SIMG_SIMD_AVX2
+    if (has_avx2())
+      return apply_mat_kernel{apply_mat_avx2};
+#endif
+#if defined(SIMG_SIMD_NEON)
+    return apply_mat_kernel{apply_mat_neon};
+#elif defined(SIMG_SIMD_SSE2)
+    return apply_mat_kernel{apply_mat_sse2};
+#else
+    return apply_mat_kernel{apply_mat_scalar};
+#endif
+  }();
+  return kernel;
+}
+
+static inline apply_mat_lut_kernel apply_mat_lut_best() noexcept {
+  static const apply_mat_lut_kernel kernel = [] {
+#ifdef SIMG_SIMD_AVX2
+    if (has_avx2())
+      return apply_mat_lut_kernel{apply_mat_lut_avx2};
+#endif
+#if defined(SIMG_SIMD_NEON)
+    return apply_mat_lut_kernel{apply_mat_lut_neon};
+#elif defined(SIMG_SIMD_SSE2)
+    return apply_mat_lut_kernel{apply_mat_lut_sse2};
+#else
+    return apply_mat_lut_kernel{apply_mat_lut_scalar};
+#endif
+  }();
+  return kernel;
+}
+
+// dst[j][i] = src[i][j] for a block of 4x4 pixels, src[i] and dst[j] point
+// at 4 consecutive pixels each. a pixel is moved as one 32-bit lane.
+static inline void transpose4(const seedimg::pixel *const (&src)[4],
+                              seedimg::pixel *const (&dst)[4]) noexcept {
+#if defined(SIMG_SIMD_NEON)
+  uint32x4_t r[4];
+  for (int i = 0; i < 4; ++i)
+    r[i] = vld1q_u32(reinterpret_cast<const std::uint32_t *>(src[i]));
+  const uint32x4x2_t t01 = vtrnq_u32(r[0], r[1]);
+  const uint32x4x2_t t23 = vtrnq_u32(r[2], r[3]);
+  vst1q_u32(reinterpret_cast<std::uint32_t *>(dst[0]),
+            vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])));
+  vst1q_u32(reinterpret_cast<std::uint32_t *>(dst[1]),
+            vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])));
+  vst1q_u32(
+      reinterpret_cast<std::uint32_t *>(dst[2]),
+      vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])));
+  vst1q_u32(
+      reinterpret_cast<std::uint32_t *>(dst[3]),
+      vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])));
+#elif defined(SIMG_SIMD_SSE2)
+  __m128i r[4];
+  for (int i = 0; i < 4; ++i)
+    r[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src[i]));
+  const __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+  const __m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+  const __m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+  const __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[0]),
+                   _mm_unpacklo_epi64(t0, t1));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[1]),
+                   _mm_unpackhi_epi64(t0, t1));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[2]),
+                   _mm_unpacklo_epi64(t2, t3));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst[3]),
+                   _mm_unpackhi_epi64(t2, t3));
+#else
+  for (int j = 0; j < 4; ++j)
+    for (int i = 0; i < 4; ++i)
+      dst[j][i] = src[i][j];
+#endif
+}
+
+// Box blur kernels. A window of pixels is summed per channel, alpha
+// included, and the sum is divided with truncation like the integer
+// division the scalar kernels do. The vector kernels divide in float and
+// correct the quotient by one where it was rounded, which is exact as long
+// as the sums fit in a float's mantissa, so they are bit-identical too.
+
+// window sizes past this go to the scalar kernels.
+constexpr simg_int box_max_count = 1 << 16;
+
+// out[x] is the mean of in[x - r + 1, x + r] clipped to [0, width), with
+// in's alpha. 2 * r + 1 must not exceed width, in and out must not overlap.
+static inline void box_blur_row_scalar(const seedimg::pixel *in,
+                                       seedimg::pixel *out, simg_int width,
+                                       simg_int r) {
+  std::uint32_t sum[3] = {0, 0, 0};
+  auto add = [&](const seedimg::pixel &p) {
+    sum[0] += p.r;
+    sum[1] += p.g;
+    sum[2] += p.b;
+  };
+  auto sub = [&](const seedimg::pixel &p) {
+    sum[0] -= p.r;
+    sum[1] -= p.g;
+    sum[2] -= p.b;
+  };
+  auto store = [&](simg_int x, std::uint32_t count) {
+    out[x] = {{static_cast<std::uint8_t>(sum[0] / count)},
+              {static_cast<std::uint8_t>(sum[1] / count)},
+              {static_cast<std::uint8_t>(sum[2] / count)},
+              in[x].a};
+  };
+
+  for (simg_int i = 0; i <= r; ++i)
+    add(in[i]);
+  store(0, r + 1);
+  for (simg_int x = 1; x < r; ++x) {
+    add(in[x + r]);
+    store(x, x + r + 1);
+  }
+  for (simg_int x = r; x < width - r; ++x) {
+    add(in[x + r]);
+    sub(in[x - r]);
+    store(x, 2 * r);
+  }
+  for (simg_int x = width - r; x < width; ++x) {
+    sub(in[x - r]);
+    store(x, width - x + r - 1);
+  }
+}
+
+// sums[x * 4 + c] += row[x].c, every channel of every pixel.
+static inline void box_sum_add_scalar(std::uint32_t *sums,
+                                      const seedimg::pixel *row,
+                                      simg_int width) {
+  const auto *bytes = reinterpret_cast<const std::uint8_t *>(row);
+  for (simg_int i = 0; i < width * 4; ++i)
+    sums[i] += bytes[i];
+}
+static inline void box_sum_sub_scalar(std::uint32_t *sums,
+                                      const seedimg::pixel *row,
+                                      simg_int width) {
+  const auto *bytes = reinterpret_cast<const std::uint8_t *>(row);
+  for (simg_int i = 0; i < width * 4; ++i)
+    sums[i] -= bytes[i];
+}
+// a row of sums divided by count, with the alpha of the pixels in alpha.
+static inline void box_sum_store_scalar(const std::uint32_t *sums,
+                                        std::uint32_t count,
+                                        const seedimg::pixel *alpha,
+                                        seedimg::pixel *out, simg_int width) {
+  for (simg_int x = 0; x < width; ++x)
+    out[x] = {{static_cast<std::uint8_t>(sums[x * 4] / count)},
+              {static_cast<std::uint8_t>(sums[x * 4 + 1] / count)},
+              {static_cast<std::uint8_t>(sums[x * 4 + 2] / count)},
+              alpha[x].a};
+}
+
+#ifdef SIMG_SIMD_SSE2
+// the 4 channels of a pixel widened to 32-bit lanes.
+static inline __m128i box_widen_sse2(const seedimg::pixel &p) {
+  std::uint32_t v;
+  std::memcpy(&v, &p, sizeof(v));
+  const __m128i zero = _mm_setzero_si128();
+  return _mm_unpacklo_epi16(
+      _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(v)), zero), zero);
+}
+
+// sum / count truncated, per lane.
+static inline __m128i box_divide_sse2(__m128i sum, __m128 count,
+                                      __m128 reciprocal) {
+  const __m128 s = _mm_cvtepi32_ps(sum);
+  __m128i q = _mm_cvttps_epi32(_mm_mul_ps(s, reciprocal));
+  const __m128 rem = _mm_sub_ps(s, _mm_mul_ps(_mm_cvtepi32_ps(q), count));
+  // compare masks are -1 where the quotient is off by one.
+  q = _mm_sub_epi32(q, _mm_castps_si128(_mm_cmpge_ps(rem, count)));
+  return _mm_add_epi32(q,
+                       _mm_castps_si128(_mm_cmplt_ps(rem, _mm_setzero_ps())));
+}
+
+// the running sum lives in one register, a lane per channel.
+static inline void box_blur_row_sse2(const seedimg::pixel *in,
+                                     seedimg::pixel *out, simg_int width,
+                                     simg_int r) {
+  if (2 * r >= box_max_count) {
+    box_blur_row_scalar(in, out, width, r);
+    return;
+  }
+  __m128i sum = _mm_setzero_si128();
+  auto store = [&](simg_int x, __m128 count, __m128 reciprocal) {
+    __m128i q = box_divide_sse2(sum, count, reciprocal);
+    q = _mm_packus_epi16(_mm_packs_epi32(q, q), q);
+    const auto v = static_cast<std::uint32_t>(_mm_cvtsi128_si32(q));
+    std::memcpy(&out[x], &v, sizeof(v));
+    out[x].a = in[x].a;
+  };
+  auto edge = [&](simg_int x, simg_int count) {
+    store(x, _mm_set1_ps(static_cast<float>(count)),
+          _mm_set1_ps(1.0f / static_cast<float>(count)));
+  };
+
+  for (simg_int i = 0; i <= r; ++i)
+    sum = _mm_add_epi32(sum, box_widen_sse2(in[i]));
+  edge(0, r + 1);
+  for (simg_int x = 1; x < r; ++x) {
+    sum = _mm_add_epi32(sum, box_widen_sse2(in[x + r]));
+    edge(x, x + r + 1);
+  }
+  const __m128 count = _mm_set1_ps(static_cast<float>(2 * r));
+  const __m128 reciprocal = _mm_set1_ps(1.0f / static_cast<float>(2 * r));
+  for (simg_int x = r; x < width - r; ++x) {
+    sum = _mm_add_epi32(sum, _mm_sub_epi32(box_widen_sse2(in[x + r]),
+                                           box_widen_sse2(in[x - r])));
+    store(x, count, reciprocal);
+  }
+  for (simg_int x = width - r; x < width; ++x) {
+    sum = _mm_sub_epi32(sum, box_widen_sse2(in[x - r]));
+    edge(x, width - x + r - 1);
+  }
+}
+
+// 4 pixels, 16 channels, per iteration. add is true to add the row, false
+// to subtract it.
+template <bool add>
+static inline void box_sum_row_sse2(std::uint32_t *sums,
+                                    const seedimg::pixel *row,
+                                    simg_int width) {
+  const __m128i zero = _mm_setzero_si128();
+  simg_int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const __m128i px =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+    const __m128i lo = _mm_unpacklo_epi8(px, zero);
+    const __m128i hi = _mm_unpackhi_epi8(px, zero);
+    const __m128i wide[4] = {
+        _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+        _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+    auto *dst = reinterpret_cast<__m128i *>(sums + x * 4);
+    for (int i = 0; i < 4; ++i) {
+      const __m128i s = _mm_loadu_si128(dst + i);
+      _mm_storeu_si128(dst + i, add ? _mm_add_epi32(s, wide[i])
+                                    : _mm_sub_epi32(s, wide[i]));
+    }
+  }
+  if (add)
+    box_sum_add_scalar(sums + x * 4, row + x, width - x);
+  else
+    box_sum_sub_scalar(sums + x * 4, row + x, width - x);
+}
+
+static inline void box_sum_store_sse2(const std::uint32_t *sums,
+                                      std::uint32_t count,
+                                      const seedimg::pixel *alpha,
+                                      seedimg::pixel *out, simg_int width) {
+  if (count >= box_max_count) {
+    box_sum_store_scalar(sums, count, alpha, out, width);
+    return;
+  }
+  const __m128 c = _mm_set1_ps(static_cast<float>(count));
+  const __m128 reciprocal = _mm_set1_ps(1.0f / static_cast<float>(count));
+  const __m128i amask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+  simg_int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const auto *src = reinterpret_cast<const __m128i *>(sums + x * 4);
+    __m128i q[4];
+    for (int i = 0; i < 4; ++i)
+      q[i] = box_divide_sse2(_mm_loadu_si128(src + i), c, reciprocal);
+    const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]),
+                                            _mm_packs_epi32(q[2], q[3]));
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(alpha + x));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                     _mm_or_si128(_mm_andnot_si128(amask, packed),
+                                  _mm_and_si128(amask, a)));
+  }
+  box_sum_store_scalar(sums + x * 4, count, alpha + x, out + x, width - x);
+}
+#endif
+
+static inline void box_blur_row(const seedimg::pixel *in, seedimg::pixel *out,
+                                simg_int width, simg_int r) {
+#ifdef SIMG_SIMD_SSE2
+  box_blur_row_sse2(in, out, width, r);
+#else
+  box_blur_row_scalar(in, out, width, r);
+#endif
+}
+static inline void box_sum_add(std::uint32_t *sums, const seedimg::pixel *row,
+                               simg_int width) {
+#ifdef SIMG_SIMD_SSE2
+  box_sum_row_sse2<true>(sums, row, width);
+#else
+  box_sum_add_scalar(sums, row, width);
+#endif
+}
+static inline void box_sum_sub(std::uint32_t *sums, const seedimg::pixel *row,
+                               simg_int width) {
+#ifdef SIMG_SIMD_SSE2
+  box_sum_row_sse2<false>(sums, row, width);
+#else
+  box_sum_sub_scalar(sums, row, width);
+#endif
+}
+static inline void box_sum_store(const std::uint32_t *sums,
+                                 std::uint32_t count,
+                                 const seedimg::pixel *alpha,
+                                 seedimg::pixel *out, simg_int width) {
+#ifdef SIMG_SIMD_SSE2
+  box_sum_store_sse2(sums, count, alpha, out, width);
+#else
+  box_sum_store_scalar(sums, count, alpha, out, width);
+#endif
+}
+
+// Conversion between pixels and the 16-bit big endian RGBA samples of
+// farbfeld. Going down keeps the high byte of every sample, which is at the
+// even offsets.
+static inline void narrow_u16be(const std::uint8_t *in, seedimg::pixel *out,
+                                simg_int n) {
+  auto *dst = reinterpret_cast<std::uint8_t *>(out);
+  simg_int i = 0;
+#if defined(SIMG_SIMD_SSE2)
+  const __m128i low = _mm_set1_epi16(0x00ff);
+  for (; i + 4 <= n; i += 4) {
+    // little endian 16-bit lanes hold the high byte of a sample in their
+    // low half.
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 16));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(dst),
+        _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+    in += 32;
+    dst += 16;
+  }
+#elif defined(SIMG_SIMD_NEON)
+  for (; i + 4 <= n; i += 4) {
+    vst1q_u8(dst, vld2q_u8(in).val[0]);
+    in += 32;
+    dst += 16;
+  }
+#endif
+  for (; i < n; ++i) {
+    for (int c = 0; c < 4; ++c)
+      dst[c] = in[2 * c];
+    in += 8;
+    dst += 4;
+  }
+}
+
+// going up repeats every byte, so that 0xff becomes 0xffff.
+static inline void widen_u16be(const seedimg::pixel *in, std::uint8_t *out,
+                               simg_int n) {
+  const auto *src = reinterpret_cast<const std::uint8_t *>(in);
+  simg_int i = 0;
+#if defined(SIMG_SIMD_SSE2)
+  for (; i + 4 <= n; i += 4) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     _mm_unpacklo_epi8(v, v));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16),
+                     _mm_unpackhi_epi8(v, v));
+    src += 16;
+    out += 32;
+  }
+#elif defined(SIMG_SIMD_NEON)
+  for (; i + 4 <= n; i += 4) {
+    const uint8x16_t v = vld1q_u8(src);
+    vst2q_u8(out, uint8x16x2_t{{v, v}});
+    src += 16;
+    out += 32;
+  }
+#endif
+  for (; i < n; ++i) {
+    for (int c = 0; c < 4; ++c)
+      out[2 * c] = out[2 * c + 1] = src[c];
+    src += 4;
+    out += 8;
+  }
+}
+
+// Resampling kernels. Weights are fixed point with resample_bits fraction
+// bits, sums are 32-bit, shifted back with rounding to nearest and clamped
+// to [0, 255]. Every path computes the exact same integers.
+constexpr int resample_bits = 14;
+
+static inline std::uint8_t resample_clamp(std::int32_t acc) noexcept {
+  acc = (acc + (1 << (resample_bits - 1))) >> resample_bits;
+  return static_cast<std::uint8_t>(acc < 0 ? 0 : acc > 255 ? 255 : acc);
+}
+
+// out[x] is the sum of weights[x * taps + t] * in[first[x] + t].
+static inline void resample_row_scalar(const seedimg::pixel *in,
+                                       seedimg::pixel *out, simg_int width,
+                                       simg_int taps,
+                                       const std::int32_t *first,
+                                       const std::int16_t *weights) {
+  for (simg_int x = 0; x < width; ++x) {
+    const auto *src = reinterpret_cast<const std::uint8_t *>(in + first[x]);
+    const std::int16_t *w = weights + x * taps;
+    std::int32_t acc[4] = {0, 0, 0, 0};
+    for (simg_int t = 0; t < taps; ++t)
+      for (int c = 0; c < 4; ++c)
+        acc[c] += w[t] * src[t * 4 + c];
+    auto *dst = reinterpret_cast<std::uint8_t *>(out + x);
+    for (int c = 0; c < 4; ++c)
+      dst[c] = resample_clamp(acc[c]);
+  }
+}
+
+// bytes [i, n) of out, each the sum of weights[t] * the same byte of
+// rows[t].
+static inline void resample_col_scalar(const seedimg::pixel *const *rows,
+                                       const std::int16_t *weights,
+                                       simg_int taps, seedimg::pixel *out,
+                                       simg_int i, simg_int n) {
+  auto *dst = reinterpret_cast<std::uint8_t *>(out);
+  for (; i < n; ++i) {
+    std::int32_t acc = 0;
+    for (simg_int t = 0; t < taps; ++t)
+      acc += weights[t] * reinterpret_cast<const std::uint8_t *>(rows[t])[i];
+    dst[i] = resample_clamp(acc);
+  }
+}
+
+// out[x] is the mean, rounded to nearest, of the factor * factor block at
+// column x * factor of the factor rows starting at in, stride pixels apart.
+static inline void decimate_row_scalar(const seedimg::pixel *in,
+                                       simg_int stride, simg_int factor,
+                                       seedimg::pixel *out, simg_int x,
+                                       simg_int width) {
+  const std::uint32_t area = static_cast<std::uint32_t>(factor * factor);
+  for (; x < width; ++x) {
+    std::uint32_t sum[4] = {0, 0, 0, 0};
+    for (simg_int j = 0; j < factor; ++j) {
+      const auto *src =
+          reinterpret_cast<const std::uint8_t *>(in + j * stride + x * factor);
+      for (simg_int i = 0; i < factor * 4; ++i)
+        sum[i % 4] += src[i];
+    }
+    auto *dst = reinterpret_cast<std::uint8_t *>(out + x);
+    for (int c = 0; c < 4; ++c)
+      dst[c] = static_cast<std::uint8_t>((sum[c] + area / 2) / area);
+  }
+}
+
+#ifdef SIMG_SIMD_SSE2
+// two 16-bit weights in every 32-bit lane, for _mm_madd_epi16.
+static inline __m128i resample_pair_sse2(std::int16_t a, std::int16_t b) {
+  return _mm_set1_epi32(static_cast<std::int32_t>(
+      (static_cast<std::uint32_t>(static_cast<std::uint16_t>(b)) << 16) |
+      static_cast<std::uint16_t>(a)));
+}
+
+static inline void resample_row_sse2(const seedimg::pixel *in,
+                                     seedimg::pixel *out, simg_int width,
+                                     simg_int taps, const std::int32_t *first,
+                                     const std::int16_t *weights) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi32(1 << (resample_bits - 1));
+  for (simg_int x = 0; x < width; ++x) {
+    const seedimg::pixel *src = in + first[x];
+    const std::int16_t *w = weights + x * taps;
+    __m128i acc = round;
+    simg_int t = 0;
+    for (; t + 2 <= taps; t += 2) {
+      // r0 r1 g0 g1 b0 b1 a0 a1, every pair against w0 w1.
+      const __m128i p =
+          _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + t));
+      const __m128i pairs =
+          _mm_unpacklo_epi8(_mm_unpacklo_epi8(p, _mm_srli_si128(p, 4)), zero);
+      acc = _mm_add_epi32(
+          acc, _mm_madd_epi16(pairs, resample_pair_sse2(w[t], w[t + 1])));
+    }
+    if (t < taps) {
+      std::int32_t v;
+      std::memcpy(&v, src + t, sizeof(v));
+      const __m128i p = _mm_unpacklo_epi16(
+          _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero);
+      acc = _mm_add_epi32(acc,
+                          _mm_madd_epi16(p, resample_pair_sse2(w[t], 0)));
+    }
+    acc = _mm_srai_epi32(acc, resample_bits);
+    const std::int32_t res = _mm_cvtsi128_si32(
+        _mm_packus_epi16(_mm_packs_epi32(acc, acc), zero));
+    std::memcpy(out + x, &res, sizeof(res));
+  }
+}
+
+static inline void resample_col_sse2(const seedimg::pixel *const *rows,
+                                     const std::int16_t *weights,
+                                     simg_int taps, seedimg::pixel *out,
+                                     simg_int width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi32(1 << (resample_bits - 1));
+  const simg_int n = width * 4;
+  simg_int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i acc[4] = {round, round, round, round};
+    for (simg_int t = 0; t < taps; t += 2) {
+      // the same byte of two rows next to each other, against their
+      // weights.
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+          reinterpret_cast<const std::uint8_t *>(rows[t]) + i));
+      const __m128i b =
+          t + 1 < taps
+              ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                    reinterpret_cast<const std::uint8_t *>(rows[t + 1]) + i))
+              : zero;
+      const __m128i wv =
+          resample_pair_sse2(weights[t], t + 1 < taps ? weights[t + 1] : 0);
+      const __m128i lo = _mm_unpacklo_epi8(a, b), hi = _mm_unpackhi_epi8(a, b);
+      acc[0] = _mm_add_epi32(
+          acc[0], _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), wv));
+      acc[1] = _mm_add_epi32(
+          acc[1], _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), wv));
+      acc[2] = _mm_add_epi32(
+          acc[2], _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), wv));
+      acc[3] = _mm_add_epi32(
+          acc[3], _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), wv));
+    }
+    for (auto &a : acc)
+      a = _mm_srai_epi32(a, resample_bits);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(reinterpret_cast<std::uint8_t *>(out) + i),
+        _mm_packus_epi16(_mm_packs_epi32(acc[0], acc[1]),
+                         _mm_packs_epi32(acc[2], acc[3])));
+  }
+  resample_col_scalar(rows, weights, taps, out, i, n);
+}
+
+static inline void decimate_row_sse2(const seedimg::pixel *in,
+                                     simg_int stride, simg_int factor,
+                                     seedimg::pixel *out, simg_int width) {
+  const __m128i zero = _mm_setzero_si128();
+  simg_int x = 0;
+  if (factor == 2) {
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 2 <= width; x += 2) {
+      const __m128i a =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * x));
+      const __m128i b = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(in + stride + 2 * x));
+      // p0 p1 and p2 p3 of both rows.
+      const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                       _mm_unpacklo_epi8(b, zero));
+      const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                       _mm_unpackhi_epi8(b, zero));
+      __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+                                  _mm_unpackhi_epi64(lo, hi));
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x),
+                       _mm_packus_epi16(sum, sum));
+    }
+  } else if (factor == 4) {
+    const __m128i eight = _mm_set1_epi16(8);
+    for (; x < width; ++x) {
+      __m128i lo = zero, hi = zero;
+      for (simg_int j = 0; j < 4; ++j) {
+        const __m128i v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(in + j * stride + 4 * x));
+        lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+      }
+      __m128i sum = _mm_add_epi16(lo, hi);
+      sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, eight), 4);
+      const std::int32_t res =
+          _mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+      std::memcpy(out + x, &res, sizeof(res));
+    }
+  }
+  decimate_row_scalar(in, stride, factor, out, x, width);
+}
+#endif
+
+#ifdef SIMG_SIMD_NEON
+static inline void resample_row_neon(const seedimg::pixel *in,
+                                     seedimg::pixel *out, simg_int width,
+                                     simg_int taps, const std::int32_t *first,
+                                     const std::int16_t *weights) {
+  for (simg_int x = 0; x < width; ++x) {
+    const seedimg::pixel *src = in + first[x];
+    const std::int16_t *w = weights + x * taps;
+    int32x4_t acc = vdupq_n_s32(1 << (resample_bits - 1));
+    for (simg_int t = 0; t < taps; ++t) {
+      std::uint32_t v;
+      std::memcpy(&v, src + t, sizeof(v));
+      const int16x4_t p = vreinterpret_s16_u16(
+          vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(v)))));
+      acc = vmlal_n_s16(acc, p, w[t]);
+    }
+    const uint16x4_t narrow = vqmovun_s32(vshrq_n_s32(acc, resample_bits));
+    const uint8x8_t res = vqmovn_u16(vcombine_u16(narrow, narrow));
+    vst1_lane_u32(reinterpret_cast<std::uint32_t *>(out + x),
+                  vreinterpret_u32_u8(res), 0);
+  }
+}
+
+static inline void resample_col_neon(const seedimg::pixel *const *rows,
+                                     const std::int16_t *weights,
+                                     simg_int taps, seedimg::pixel *out,
+                                     simg_int width) {
+  const simg_int n = width * 4;
+  simg_int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    int32x4_t acc[4];
+    for (auto &a : acc)
+      a = vdupq_n_s32(1 << (resample_bits - 1));
+    for (simg_int t = 0; t < taps; ++t) {
+      const uint8x16_t v =
+          vld1q_u8(reinterpret_cast<const std::uint8_t *>(rows[t]) + i);
+      const int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v)));
+      const int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v)));
+      acc[0] = vmlal_n_s16(acc[0], vget_low_s16(lo), weights[t]);
+      acc[1] = vmlal_n_s16(acc[1], vget_high_s16(lo), weights[t]);
+      acc[2] = vmlal_n_s16(acc[2], vget_low_s16(hi), weights[t]);
+      acc[3] = vmlal_n_s16(acc[3], vget_high_s16(hi), weights[t]);
+    }
+    uint16x4_t q[4];
+    for (int k = 0; k < 4; ++k)
+      q[k] = vqmovun_s32(vshrq_n_s32(acc[k], resample_bits));
+    vst1q_u8(reinterpret_cast<std::uint8_t *>(out) + i,
+             vcombine_u8(vqmovn_u16(vcombine_u16(q[0], q[1])),
+                         vqmovn_u16(vcombine_u16(q[2], q[3]))));
+  }
+  resample_col_scalar(rows, weights, taps, out, i, n);
+}
+#endif
+
+static inline void resample_row(const seedimg::pixel *in, seedimg::pixel *out,
+                                simg_int width, simg_int taps,
+                                const std::int32_t *first,
+                                const std::int16_t *weights) {
+#if defined(SIMG_SIMD_NEON)
+  resample_row_neon(in, out, width, taps, first, weights);
+#elif defined(SIMG_SIMD_SSE2)
+  resample_row_sse2(in, out, width, taps, first, weights);
+#else
+  resample_row_scalar(in, out, width, taps, first, weights);
+#endif
+}
+static inline void resample_col(const seedimg::pixel *const *rows,
+                                const std::int16_t *weights, simg_int taps,
+                                seedimg::pixel *out, simg_int width) {
+#if defined(SIMG_SIMD_NEON)
+  resample_col_neon(rows, weights, taps, out, width);
+#elif defined(SIMG_SIMD_SSE2)
+  resample_col_sse2(rows, weights, taps, out, width);
+#else
+  resample_col_scalar(rows, weights, taps, out, 0, width * 4);
+#endif
+}
+static inline void decimate_row(const seedimg::pixel *in, simg_int stride,
+                                simg_int factor, seedimg::pixel *out,
+                                simg_int width) {
+#ifdef SIMG_SIMD_SSE2
+  decimate_row_sse2(in, stride, factor, out, width);
+#else
+  decimate_row_scalar(in, stride, factor, out, 0, width);
+#endif
+}
+} // namespace simgdetails::simd
+#endif
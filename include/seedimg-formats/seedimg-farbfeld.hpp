@@ -21,19 +21,43 @@
 
 #include <cstring>
 #include <fstream>
+#include <seedimg-filters/seedimg-filters-simd.hpp>
+#include <seedimg-stream.hpp>
+#include <seedimg-threadpool.hpp>
+#include <seedimg-utils.hpp>
 #include <seedimg.hpp>
 
+// amount of encoded bytes farbfeld::to converts before handing them to the
+// sink in one write.
+#ifndef SIMG_FARBFELD_BLOCK
+#define SIMG_FARBFELD_BLOCK (4 * 1024 * 1024)
+#endif
+
 namespace simgdetails {
-// from unsigned 16 big endian
-static inline std::uint16_t from_u16_big_endian(uint8_t *cb) {
-  return static_cast<std::uint16_t>(cb[1] << 8) |
-         static_cast<std::uint16_t>(cb[0]);
-}
-static inline void to_u16_big_endian(std::uint16_t n, std::uint8_t *out) {
-  out[0] = n >> 8 & 0xff;
-  out[1] = n & 0xff;
+// converts rows [start, end) between pixels and 16-bit samples, bands of
+// them at once.
+template <bool Widen>
+static inline void farbfeld_convert(const std::uint8_t *samples,
+                                    std::uint8_t *out, seedimg::pixel *pixels,
+                                    simg_int width, simg_int start,
+                                    simg_int end) {
+  // a band of pixels and of samples fit in L2 together.
+  const simg_int rows = std::max<simg_int>(
+      SIMG_L2_CACHE_SIZE / (12 * std::max<simg_int>(width, 1)), 1);
+  const auto bands = seedimg::utils::split_range(end - start, rows);
+  thread_pool::instance().parallel_for(bands.size(), [&](std::size_t i) {
+    const simg_int first = start + bands[i].first;
+    const simg_int n = (bands[i].second - bands[i].first) * width;
+    if constexpr (Widen)
+      simd::widen_u16be(pixels + first * width,
+                        out + (first - start) * width * 8, n);
+    else
+      simd::narrow_u16be(samples + (first - start) * width * 8,
+                         pixels + first * width, n);
+  });
 }
-static inline simg_int from_u32_big_endien(uint8_t *cb) {
+
+static inline simg_int from_u32_big_endien(const uint8_t *cb) {
   return static_cast<simg_int>(cb[0] << 24) |
          static_cast<simg_int>(cb[1] << 16) |
          static_cast<simg_int>(cb[2] << 8) | static_cast<simg_int>(cb[3]);
@@ -44,22 +68,13 @@ static inline void to_u32_big_endian(simg_int n, std::uint8_t *out) {
   out[2] = (n >> 8) & 0xff;
   out[3] = n & 0xff;
 }
-
-// https://stackoverflow.com/a/41762509/10978642
-static inline std::uint8_t trunc_8b(std::uint16_t n) { return n >> 8; }
-// https://stackoverflow.com/a/6436100/10978642
-// NOTE: simple bitshifting could've solved but would
-//       be quite noisy, so an addition put.
-static inline std::uint16_t dup_8_to_16b(std::uint8_t n) {
-  return static_cast<std::uint16_t>(n << 8) + static_cast<std::uint16_t>(n);
-}
 } // namespace simgdetails
 
 namespace seedimg {
 namespace modules {
 namespace farbfeld {
 static inline bool check(const std::string &filename) {
-  std::ifstream input(filename);
+  std::ifstream input(filename, std::ios::binary);
   char sig[8];
 
   try {
@@ -67,78 +82,81 @@ static inline bool check(const std::string &filename) {
   } catch (std::iostream::failure) {
     return false;
   }
-  return std::memcmp(sig, "farbfeld", 8) == 0;
+  return input && std::memcmp(sig, "farbfeld", 8) == 0;
 }
-static inline bool to(const std::string &filename, const simg &inp_img) {
-  using namespace simgdetails;
-  std::ofstream output(filename);
 
-  std::uint8_t width_ser[4];
-  std::uint8_t height_ser[4];
-  to_u32_big_endian(inp_img->width(), width_ser);
-  to_u32_big_endian(inp_img->height(), height_ser);
-  try {
-    output.write("farbfeld", 8)
-        .write(reinterpret_cast<char *>(width_ser), 4)
-        .write(reinterpret_cast<char *>(height_ser), 4);
-  } catch (std::ios_base::failure) {
+static inline bool check(const std::uint8_t *data, std::size_t size) {
+  return size >= 8 && std::memcmp(data, "farbfeld", 8) == 0;
+}
+
+/**
+ * @brief Encode a farbfeld into a vector, which is appended to, or a stream.
+ */
+static inline bool to(seedimg::stream::byte_sink sink, const simg &inp_img) {
+  using namespace simgdetails;
+  std::uint8_t header[16];
+  std::memcpy(header, "farbfeld", 8);
+  to_u32_big_endian(inp_img->width(), header + 8);
+  to_u32_big_endian(inp_img->height(), header + 12);
+  if (!sink.write(header, sizeof(header)))
     return false;
-  }
 
-  uint8_t rawpixel[8];
-  for (simg_int y = 0; y < inp_img->height(); ++y) {
-    for (simg_int x = 0; x < inp_img->width(); ++x) {
-      auto px = inp_img->pixel(x, y);
-
-      to_u16_big_endian(dup_8_to_16b(px.r), rawpixel);
-      to_u16_big_endian(dup_8_to_16b(px.g), rawpixel + 2);
-      to_u16_big_endian(dup_8_to_16b(px.b), rawpixel + 4);
-      to_u16_big_endian(dup_8_to_16b(px.a), rawpixel + 6);
-
-      try {
-        output.write(reinterpret_cast<char *>(rawpixel), 8);
-      } catch (std::ios_base::failure) {
-        return false;
-      }
-    }
+  // rows are converted a block at a time, each block in parallel, and
+  // written out in one go.
+  const simg_int width = inp_img->width(), height = inp_img->height();
+  const simg_int row_bytes = std::max<simg_int>(width * 8, 1);
+  const simg_int block = std::max<simg_int>(SIMG_FARBFELD_BLOCK / row_bytes, 1);
+  std::vector<std::uint8_t> samples(
+      static_cast<std::size_t>(std::min(block, height) * width * 8));
+  for (simg_int y = 0; y < height; y += block) {
+    const simg_int end = std::min(y + block, height);
+    farbfeld_convert<true>(nullptr, samples.data(), inp_img->data(), width, y,
+                           end);
+    if (!sink.write(samples.data(),
+                    static_cast<std::size_t>((end - y) * width * 8)))
+      return false;
   }
 
-  return true;
+  return sink.flush();
 }
 
-static inline simg from(const std::string &filename) {
+static inline bool to(const std::string &filename, const simg &inp_img) {
+  std::ofstream output(filename, std::ios::binary);
+  return output && to(output, inp_img);
+}
+
+/**
+ * @brief Decode a farbfeld from memory.
+ */
+static inline simg from(const std::uint8_t *data, std::size_t size) {
   using namespace simgdetails;
-  if (!check(filename))
+  if (size < 16 || !check(data, size))
     return nullptr;
 
-  std::ifstream input(filename);
-  struct {
-    char sig[8];
-    uint8_t width[4];
-    uint8_t height[4];
-  } rawinfo;
-
-  auto result = seedimg::make(from_u32_big_endien(rawinfo.width),
-                              from_u32_big_endien(rawinfo.height));
-
-  uint8_t rawpixel[8];
-  for (simg_int y = 0; y < result->height(); ++y) {
-    for (simg_int x = 0; x < result->width(); ++x) {
-      try {
-        input.read(reinterpret_cast<char *>(rawpixel), 8);
-      } catch (std::ios_base::failure) {
-        return nullptr;
-      }
-
-      result->pixel(x, y) = {{trunc_8b(from_u16_big_endian(rawpixel))},
-                             {trunc_8b(from_u16_big_endian((rawpixel + 2)))},
-                             {trunc_8b(from_u16_big_endian((rawpixel + 4)))},
-                             trunc_8b(from_u16_big_endian((rawpixel + 6)))};
-    }
-  }
+  const auto width = from_u32_big_endien(data + 8);
+  const auto height = from_u32_big_endien(data + 12);
+  // every pixel is 8 bytes, reject truncated data before allocating.
+  if (width != 0 && height > (size - 16) / 8 / width)
+    return nullptr;
 
+  auto result = seedimg::make(width, height);
+  farbfeld_convert<false>(data + 16, nullptr, result->data(), width, 0,
+                          height);
   return result;
 }
+
+static inline simg from(const std::string &filename) {
+  // mapped, the samples are read straight from the page cache.
+  simgdetails::mapped_file file(filename);
+  if (file.good()) {
+    file.sequential();
+    return from(file.data(), file.size());
+  }
+  std::vector<std::uint8_t> data;
+  if (!seedimg::stream::read_file(filename, data))
+    return nullptr;
+  return from(data.data(), data.size());
+}
 } // namespace seedimg::modules::farbfeld
 } // namespace seedimg::modules
 } // namespace seedimg
@@ -1,11 +1,13 @@
 ﻿#ifndef SEEDIMG_IRDUMP_H
 #define SEEDIMG_IRDUMP_H
 
+#include <cstring>
 #include <fstream>
+#include <seedimg-stream.hpp>
 #include <seedimg.hpp>
 
 namespace simgdetails {
-static inline simg_int from_u32be(uint8_t *cb) {
+static inline simg_int from_u32be(const uint8_t *cb) {
   return static_cast<simg_int>(cb[0] << 24) |
          static_cast<simg_int>(cb[1] << 16) |
          static_cast<simg_int>(cb[2] << 8) | static_cast<simg_int>(cb[3]);
@@ -39,7 +41,7 @@ namespace irdump {
  */
 static inline bool to(const std::string &filename, const simg &input) {
   using namespace simgdetails;
-  std::ofstream output(filename);
+  std::ofstream output(filename, std::ios::binary);
 
   struct {
     char width[4];
@@ -70,19 +72,37 @@ static inline bool to(const std::string &filename, const simg &input) {
 
 /**
  * @brief Decode a image in the Seedimg IR dump format from a filepath.
+ * Where mmap is available the image is backed by the file, see
+ * seedimg::mmap_allocator.
  * @param filepath a valid filepath (with/without filextension).
  * @return a non-null image on success, null on failure.
  */
 static inline simg from(const std::string &filename) {
   using namespace simgdetails;
-  std::ifstream input(filename);
+  // the file is already laid out like an image, so it is mapped and the
+  // image points into the mapping instead of copying it.
+  mapped_file file(filename);
+  if (file.good()) {
+    if (file.size() < 8)
+      return nullptr;
+    const auto width = from_u32be(file.data());
+    const auto height = from_u32be(file.data() + 4);
+    if (width != 0 && height > (file.size() - 8) / sizeof(pixel) / width)
+      return nullptr;
+    auto &alloc = seedimg::mmap_allocator::instance();
+    auto *pixels = static_cast<seedimg::pixel *>(alloc.adopt(file, 8));
+    return std::make_unique<seedimg::img>(width, height, pixels, alloc);
+  }
+
+  std::ifstream input(filename, std::ios::binary);
 
   struct {
     char width[4];
     char height[4];
   } rawinfo;
 
-  input.read(rawinfo.width, 4).read(rawinfo.height, 4);
+  if (!input.read(rawinfo.width, 4).read(rawinfo.height, 4))
+    return nullptr;
 
   auto image = seedimg::make(
       from_u32be(reinterpret_cast<std::uint8_t *>(rawinfo.width)),
@@ -100,6 +120,45 @@ static inline simg from(const std::string &filename) {
 
   return image;
 }
+
+/**
+ * @brief Encode a given image in the Seedimg IR dump format into a vector,
+ * which is appended to, or a stream.
+ * @return true on success, false on failure.
+ */
+static inline bool to(seedimg::stream::byte_sink sink, const simg &input) {
+  using namespace simgdetails;
+  std::uint8_t rawinfo[8];
+  to_u32be(input->width(), rawinfo);
+  to_u32be(input->height(), rawinfo + 4);
+  if (!sink.write(rawinfo, sizeof(rawinfo)))
+    return false;
+
+  const auto rowstride = input->width() * sizeof(pixel);
+  for (simg_int r = 0; r < input->height(); ++r) {
+    if (!sink.write(input->row(r), rowstride))
+      return false;
+  }
+  return sink.flush();
+}
+
+/**
+ * @brief Decode a image in the Seedimg IR dump format from memory.
+ * @return a non-null image on success, null on failure.
+ */
+static inline simg from(const std::uint8_t *data, std::size_t size) {
+  using namespace simgdetails;
+  if (size < 8)
+    return nullptr;
+  const auto width = from_u32be(data);
+  const auto height = from_u32be(data + 4);
+  if (width != 0 && height > (size - 8) / sizeof(pixel) / width)
+    return nullptr;
+
+  auto image = seedimg::make(width, height);
+  std::memcpy(image->data(), data + 8, width * height * sizeof(pixel));
+  return image;
+}
 } // namespace seedimg::modules::irdump
 } // namespace seedimg::modules
 } // namespace seedimg
@@ -27,9 +27,15 @@
 extern "C" {
 #include <jconfig.h>
 #include <jpeglib.h>
+#include <jerror.h>
 }
 
+#include <algorithm>
+#include <cstdio>
+#include <optional>
+#include <seedimg-stream.hpp>
 #include <seedimg.hpp>
+#include <vector>
 
 namespace seedimg {
 namespace modules {
@@ -47,12 +53,36 @@ static char jpeg_last_error_msg[JMSG_LENGTH_MAX];
   (*(cinfo->err->format_message))(cinfo, jpeg_last_error_msg);
   std::longjmp(err->setjmp_buffer, 1);
 }
+
+// destination manager writing to a byte_sink through a fixed buffer.
+struct sink_destination_mgr {
+  struct jpeg_destination_mgr pub;
+  seedimg::stream::byte_sink *sink;
+  JOCTET buffer[65536];
+};
+
+static void sink_init_destination(j_compress_ptr cinfo) {
+  auto *dest = reinterpret_cast<sink_destination_mgr *>(cinfo->dest);
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer   = sizeof(dest->buffer);
+}
+
+static boolean sink_empty_output_buffer(j_compress_ptr cinfo) {
+  auto *dest = reinterpret_cast<sink_destination_mgr *>(cinfo->dest);
+  if (!dest->sink->write(dest->buffer, sizeof(dest->buffer)))
+    ERREXIT(cinfo, JERR_FILE_WRITE);
+  sink_init_destination(cinfo);
+  return TRUE;
+}
+
+static void sink_term_destination(j_compress_ptr cinfo) {
+  auto *dest = reinterpret_cast<sink_destination_mgr *>(cinfo->dest);
+  const auto n = sizeof(dest->buffer) - dest->pub.free_in_buffer;
+  if (!dest->sink->write(dest->buffer, n) || !dest->sink->flush())
+    ERREXIT(cinfo, JERR_FILE_WRITE);
+}
 }
 
-/**
- * @param quality quality of JPEG encoding (0-100)
- * @param progressive whether to make JPEG progresssive
- */
 bool check(const std::string &filename) noexcept {
     // SOI + APP0 marker, both are mandatory.
     static const std::uint8_t JFIF_MAGICCODE[] = {0xFF, 0xD8, 0xFF, 0xE0};
@@ -64,96 +94,369 @@ bool check(const std::string &filename) noexcept {
     return !std::memcmp(JFIF_MAGICCODE, magic, 4);
 }
 
-bool to(const std::string &filename, const simg &image, uint8_t quality = 100,
-        bool progressive = false) {
-    auto output = std::fopen(filename.c_str(), "wb");
-    if (output == nullptr)
-        return false;
+bool check(const std::uint8_t *data, std::size_t size) noexcept {
+    static const std::uint8_t JFIF_MAGICCODE[] = {0xFF, 0xD8, 0xFF, 0xE0};
+    return size >= 4 && !std::memcmp(JFIF_MAGICCODE, data, 4);
+}
+
+/**
+ * @brief Decodes a JPEG a few rows at a time, for seedimg::stream::pipe.
+ * With a size hint it is shrunk by 1/2, 1/4 or 1/8 while decoding, the
+ * IDCT only computes the pixels that are kept.
+ */
+class reader : public seedimg::stream::reader {
+public:
+  explicit reader(const std::string &filename,
+                  seedimg::stream::size_hint hint = {}) {
+    input_ = std::fopen(filename.c_str(), "rb");
+    if (input_ != nullptr)
+      good_ = open(hint);
+  }
+
+  /**
+   * @brief Decode from memory, which must outlive the reader.
+   */
+  reader(const std::uint8_t *data, std::size_t size,
+         seedimg::stream::size_hint hint = {})
+      : data_{data}, size_{size} {
+    good_ = open(hint);
+  }
 
-    jpeg_compress_struct jenc;
-    detail::seedimg_jpeg_error_mgr jerr;
-    int errcode = 0;
+  /**
+   * @brief Decode only the rectangle between the corners p1 and p2, as
+   * filters::crop would cut it. Rows above it are skipped without running
+   * the IDCT, rows below it aren't read at all, and columns outside of it
+   * are only decoded as far as they share an iMCU with it.
+   */
+  reader(const std::string &filename, seedimg::point p1, seedimg::point p2) {
+    input_ = std::fopen(filename.c_str(), "rb");
+    if (input_ != nullptr)
+      good_ = open({}) && crop(p1, p2);
+  }
 
-    jenc.err = jpeg_std_error(&jerr.pub);
-    jerr.pub.error_exit = detail::jpeg_error_exit;
+  reader(const std::uint8_t *data, std::size_t size, seedimg::point p1,
+         seedimg::point p2)
+      : data_{data}, size_{size} {
+    good_ = open({}) && crop(p1, p2);
+  }
 
-    if (setjmp(jerr.setjmp_buffer)) {
-        std::cerr << detail::jpeg_last_error_msg << std::endl;
-        errcode = -1;
-        goto finalise;
+  reader(reader const &) = delete;
+  void operator=(reader const &) = delete;
+
+  ~reader() override {
+    if (created_) {
+      // the remaining scanlines don't matter, abort instead of finishing.
+      jpeg_destroy_decompress(&jdec_);
     }
+    if (input_ != nullptr)
+      std::fclose(input_);
+  }
 
-    jpeg_create_compress(&jenc);
-    jpeg_stdio_dest(&jenc, output);
+  bool good() const noexcept override { return good_; }
+  simg_int width() const noexcept override { return width_; }
+  simg_int height() const noexcept override { return height_; }
 
-    jenc.image_width      = static_cast<JDIMENSION>(image->width());
-    jenc.image_height     = static_cast<JDIMENSION>(image->height());
-    jenc.input_components = 4;
-    jenc.in_color_space   = JCS_EXT_RGBA;
+  bool read(seedimg::pixel *rows, simg_int n) override {
+    if (!good_ || n > height_ - next_)
+      return false;
+    if (setjmp(jerr_.setjmp_buffer)) {
+      std::cerr << detail::jpeg_last_error_msg << std::endl;
+      return good_ = false;
+    }
+    // libjpeg hands out at most a few rows per call, as many as it decodes
+    // from one iMCU row. rows wider than the output go through line_.
+    const simg_int stride = jdec_.output_width;
+    const bool direct = left_ == 0 && stride == width_;
+    for (simg_int y = 0; y < n;) {
+      JSAMPROW row[16];
+      const simg_int want = std::min<simg_int>(16, n - y);
+      if (!direct)
+        line_.resize(16 * stride);
+      for (simg_int i = 0; i < want; ++i)
+        row[i] = reinterpret_cast<JSAMPLE *>(
+            direct ? rows + (y + i) * width_ : line_.data() + i * stride);
+      const simg_int done =
+          jpeg_read_scanlines(&jdec_, row, static_cast<JDIMENSION>(want));
+      if (done == 0)
+        return good_ = false;
+      if (!direct)
+        for (simg_int i = 0; i < done; ++i)
+          std::copy(line_.data() + i * stride + left_,
+                    line_.data() + i * stride + left_ + width_,
+                    rows + (y + i) * width_);
+      y += done;
+    }
+    next_ += n;
+    if (jdec_.output_scanline == jdec_.output_height)
+      jpeg_finish_decompress(&jdec_);
+    return true;
+  }
 
-    jpeg_set_defaults(&jenc);
-    jpeg_set_quality(&jenc, quality, TRUE);
-    if (progressive)
-        jpeg_simple_progression(&jenc);
-    jpeg_start_compress(&jenc, TRUE);
+private:
+  std::FILE *input_ = nullptr;
+  const std::uint8_t *data_ = nullptr;
+  std::size_t size_ = 0;
+  jpeg_decompress_struct jdec_{};
+  detail::seedimg_jpeg_error_mgr jerr_;
+  // dimensions of what is read, which starts left_ pixels into the rows
+  // libjpeg outputs. next_ is the next row to read.
+  simg_int width_ = 0, height_ = 0, left_ = 0, next_ = 0;
+  std::vector<seedimg::pixel> line_;
+  bool created_ = false;
+  bool good_ = false;
 
-    for (simg_int y = 0; y < image->height(); ++y) {
-        JSAMPROW row = reinterpret_cast<JSAMPLE*>(image->row(y));
-        if (jpeg_write_scanlines(&jenc, &row, 1) != 1)
-        return false;
+  bool open(seedimg::stream::size_hint hint) {
+    jdec_.err = jpeg_std_error(&jerr_.pub);
+    jerr_.pub.error_exit = detail::jpeg_error_exit;
+
+    if (setjmp(jerr_.setjmp_buffer)) {
+      std::cerr << detail::jpeg_last_error_msg << std::endl;
+      return false;
     }
 
-    finalise:
-    jpeg_finish_compress(&jenc);
-    jpeg_destroy_compress(&jenc);
-    std::fclose(output);
+    jpeg_create_decompress(&jdec_);
+    created_ = true;
+    if (input_ != nullptr)
+      jpeg_stdio_src(&jdec_, input_);
+    else
+      jpeg_mem_src(&jdec_, const_cast<unsigned char *>(data_),
+                   static_cast<unsigned long>(size_));
+    jpeg_read_header(&jdec_, TRUE);
 
-    return errcode == 0;
-}
-simg from(const std::string &filename) {
-      auto input = std::fopen(filename.c_str(), "rb");
-  if (input == nullptr)
-    return nullptr;
+    jdec_.scale_num = 1;
+    jdec_.scale_denom =
+        static_cast<unsigned int>(seedimg::stream::shrink_factor(
+            jdec_.image_width, jdec_.image_height, hint, 8));
+
+    jdec_.out_color_space      = JCS_EXT_RGBA;
+    jdec_.out_color_components = 4;
+
+    jpeg_start_decompress(&jdec_);
+    width_ = jdec_.output_width;
+    height_ = jdec_.output_height;
+    return true;
+  }
+
+  bool crop(seedimg::point p1, seedimg::point p2) {
+    if (std::max(p1.x, p2.x) > width_ || std::max(p1.y, p2.y) > height_) {
+      std::cerr << "Region is outside of the JPEG" << std::endl;
+      return false;
+    }
+    if (setjmp(jerr_.setjmp_buffer)) {
+      std::cerr << detail::jpeg_last_error_msg << std::endl;
+      return false;
+    }
+    const simg_int x = std::min(p1.x, p2.x), y = std::min(p1.y, p2.y);
+    width_ = std::max(p1.x, p2.x) - x;
+    height_ = std::max(p1.y, p2.y) - y;
+    if (width_ == 0 || height_ == 0)
+      return true;
+#ifdef LIBJPEG_TURBO_VERSION
+    // the left edge is rounded down to an iMCU. chroma upsampling treats
+    // the edges of the crop as the edges of the image, so it keeps a pixel
+    // more than asked on both sides for the kept ones to come out the same.
+    const simg_int left = x != 0 ? x - 1 : 0;
+    const simg_int right =
+        std::min<simg_int>(x + width_ + 1, jdec_.output_width);
+    auto xoffset = static_cast<JDIMENSION>(left);
+    auto cropped = static_cast<JDIMENSION>(right - left);
+    jpeg_crop_scanline(&jdec_, &xoffset, &cropped);
+    left_ = x - xoffset;
+    if (y != 0 && jpeg_skip_scanlines(&jdec_, static_cast<JDIMENSION>(y)) !=
+                      static_cast<JDIMENSION>(y))
+      return false;
+#else
+    // plain libjpeg can't skip anything, decode and drop.
+    left_ = x;
+    line_.resize(jdec_.output_width);
+    JSAMPROW row[1] = {reinterpret_cast<JSAMPLE *>(line_.data())};
+    while (jdec_.output_scanline < y)
+      if (jpeg_read_scanlines(&jdec_, row, 1) == 0)
+        return false;
+#endif
+    return true;
+  }
+};
+
+/**
+ * @brief Encodes a JPEG a few rows at a time, for seedimg::stream::pipe.
+ * @param quality quality of JPEG encoding (0-100)
+ * @param progressive whether to make JPEG progresssive
+ */
+class writer : public seedimg::stream::writer {
+public:
+  writer(const std::string &filename, simg_int width, simg_int height,
+         uint8_t quality = 100, bool progressive = false) {
+    output_ = std::fopen(filename.c_str(), "wb");
+    if (output_ != nullptr)
+      good_ = open(width, height, quality, progressive);
+  }
 
-  jpeg_decompress_struct jdec;
-  detail::seedimg_jpeg_error_mgr jerr;
-  simg res_img;
-  int errcode = 0;
+  writer(seedimg::stream::byte_sink sink, simg_int width, simg_int height,
+         uint8_t quality = 100, bool progressive = false)
+      : sink_{sink} {
+    good_ = open(width, height, quality, progressive);
+  }
 
-  jdec.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.error_exit = detail::jpeg_error_exit;
+  writer(writer const &) = delete;
+  void operator=(writer const &) = delete;
 
-  if (setjmp(jerr.setjmp_buffer)) {
-    std::cerr << detail::jpeg_last_error_msg << std::endl;
-    errcode = -1;
-    goto finalise;
+  ~writer() override {
+    if (created_)
+      jpeg_destroy_compress(&jenc_);
+    if (output_ != nullptr)
+      std::fclose(output_);
   }
 
-  jpeg_create_decompress(&jdec);
-  jpeg_stdio_src(&jdec, input);
-  jpeg_read_header(&jdec, TRUE);
+  bool good() const noexcept override { return good_; }
 
-  jdec.out_color_space      = JCS_EXT_RGBA;
-  jdec.out_color_components = 4;
+  bool write(const seedimg::pixel *rows, simg_int n) override {
+    if (!good_)
+      return false;
+    if (setjmp(jerr_.setjmp_buffer)) {
+      std::cerr << detail::jpeg_last_error_msg << std::endl;
+      return good_ = false;
+    }
+    for (simg_int y = 0; y < n;) {
+      JSAMPROW row[16];
+      const simg_int want = std::min<simg_int>(16, n - y);
+      for (simg_int i = 0; i < want; ++i)
+        row[i] = const_cast<JSAMPLE *>(
+            reinterpret_cast<const JSAMPLE *>(rows + (y + i) * width_));
+      const auto done =
+          jpeg_write_scanlines(&jenc_, row, static_cast<JDIMENSION>(want));
+      if (done == 0)
+        return good_ = false;
+      y += done;
+    }
+    return true;
+  }
 
-  jpeg_start_decompress(&jdec);
+  bool finish() override {
+    if (!good_)
+      return false;
+    if (setjmp(jerr_.setjmp_buffer)) {
+      std::cerr << detail::jpeg_last_error_msg << std::endl;
+      return good_ = false;
+    }
+    // the sink is flushed by the destination manager.
+    jpeg_finish_compress(&jenc_);
+    return output_ == nullptr || std::fflush(output_) == 0;
+  }
+
+private:
+  std::FILE *output_ = nullptr;
+  std::optional<seedimg::stream::byte_sink> sink_;
+  std::unique_ptr<detail::sink_destination_mgr> dest_;
+  jpeg_compress_struct jenc_{};
+  detail::seedimg_jpeg_error_mgr jerr_;
+  simg_int width_ = 0;
+  bool created_ = false;
+  bool good_ = false;
+
+  bool open(simg_int width, simg_int height, uint8_t quality,
+            bool progressive) {
+    jenc_.err = jpeg_std_error(&jerr_.pub);
+    jerr_.pub.error_exit = detail::jpeg_error_exit;
 
-  res_img = seedimg::make(jdec.output_width, jdec.output_height);
+    if (setjmp(jerr_.setjmp_buffer)) {
+      std::cerr << detail::jpeg_last_error_msg << std::endl;
+      return false;
+    }
+
+    jpeg_create_compress(&jenc_);
+    created_ = true;
+    if (output_ != nullptr) {
+      jpeg_stdio_dest(&jenc_, output_);
+    } else {
+      dest_ = std::make_unique<detail::sink_destination_mgr>();
+      dest_->sink                    = &*sink_;
+      dest_->pub.init_destination    = detail::sink_init_destination;
+      dest_->pub.empty_output_buffer = detail::sink_empty_output_buffer;
+      dest_->pub.term_destination    = detail::sink_term_destination;
+      jenc_.dest                     = &dest_->pub;
+    }
 
-  for (simg_int y = 0; y < res_img->height(); ++y) {
-    JSAMPROW row = reinterpret_cast<JSAMPLE*>(res_img->row(y));
-    if (jpeg_read_scanlines(&jdec, &row, 1) != 1)
-      return nullptr;
+    width_                 = width;
+    jenc_.image_width      = static_cast<JDIMENSION>(width);
+    jenc_.image_height     = static_cast<JDIMENSION>(height);
+    jenc_.input_components = 4;
+    jenc_.in_color_space   = JCS_EXT_RGBA;
+
+    jpeg_set_defaults(&jenc_);
+    jpeg_set_quality(&jenc_, quality, TRUE);
+    if (progressive)
+      jpeg_simple_progression(&jenc_);
+    jpeg_start_compress(&jenc_, TRUE);
+    return true;
   }
-finalise:
-  if (errcode != -1)
-    jpeg_finish_decompress(&jdec);
-  jpeg_destroy_decompress(&jdec);
-  std::fclose(input);
-  if (errcode == 0)
-    return res_img;
-  else
+};
+
+/**
+ * @param quality quality of JPEG encoding (0-100)
+ * @param progressive whether to make JPEG progresssive
+ */
+bool to(const std::string &filename, const simg &image, uint8_t quality = 100,
+        bool progressive = false) {
+  writer dst(filename, image->width(), image->height(), quality, progressive);
+  return dst.write(image->data(), image->height()) && dst.finish();
+}
+
+/**
+ * @brief Encode a JPEG into a vector, which is appended to, or a stream.
+ * @param quality quality of JPEG encoding (0-100)
+ * @param progressive whether to make JPEG progresssive
+ */
+bool to(seedimg::stream::byte_sink sink, const simg &image,
+        uint8_t quality = 100, bool progressive = false) {
+  writer dst(sink, image->width(), image->height(), quality, progressive);
+  return dst.write(image->data(), image->height()) && dst.finish();
+}
+
+template <typename... Source> static inline simg from_reader(Source &&... in) {
+  reader src(std::forward<Source>(in)...);
+  if (!src.good())
     return nullptr;
+  auto res_img = seedimg::make(src.width(), src.height());
+  if (!src.read(res_img->data(), src.height()))
+    return nullptr;
+  return res_img;
+}
+
+simg from(const std::string &filename) { return from_reader(filename); }
+
+/**
+ * @brief Decode a JPEG from memory.
+ */
+simg from(const std::uint8_t *data, std::size_t size) {
+  return from_reader(data, size);
+}
+
+/**
+ * @brief Decode a JPEG shrunk by 1/2, 1/4 or 1/8, as much as possible
+ * without getting smaller than hint.
+ */
+simg from(const std::string &filename, seedimg::stream::size_hint hint) {
+  return from_reader(filename, hint);
+}
+
+simg from(const std::uint8_t *data, std::size_t size,
+          seedimg::stream::size_hint hint) {
+  return from_reader(data, size, hint);
+}
+
+/**
+ * @brief Decode only the rectangle between the corners p1 and p2 of a JPEG,
+ * the result is as big as the rectangle.
+ * @return nullptr if the rectangle isn't inside the image.
+ */
+simg from(const std::string &filename, seedimg::point p1, seedimg::point p2) {
+  return from_reader(filename, p1, p2);
+}
+
+simg from(const std::uint8_t *data, std::size_t size, seedimg::point p1,
+          seedimg::point p2) {
+  return from_reader(data, size, p1, p2);
 }
 } // namespace seedimg::modules::jpeg
 } // namespace seedimg::modules
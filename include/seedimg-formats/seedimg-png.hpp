@@ -23,9 +23,17 @@ extern "C" {
 #include <png.h>
 }
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <seedimg-stream.hpp>
 #include <seedimg.hpp>
+#include <vector>
 
 namespace seedimg {
 namespace modules {
@@ -38,169 +46,399 @@ bool check(const std::string &filename) noexcept {
   return !std::memcmp(cmp, header, 8);
 }
 
-simg from(const std::string &filename) {
-  simg res_img = nullptr;
-  png_structp png_ptr = nullptr;
-  png_infop info_ptr = nullptr;
-  // chosen 127 as 0 is already taken as a type.
-  uint8_t color_type = 127;
-  uint8_t bit_depth = 0;
-  int interlace_passes = 1;
-  int errcode = 0;
-
-  auto fp = std::fopen(filename.c_str(), "rb");
-
-  if (!fp) {
-    std::cerr << "File " << filename << " could not be opened" << std::endl;
-    errcode = -1;
-    return nullptr;
+bool check(const std::uint8_t *data, std::size_t size) noexcept {
+  return size >= 8 && png_sig_cmp(data, 0, 8) == 0;
+}
+
+namespace detail {
+// io callbacks for reading from memory and writing to a byte_sink.
+static void read_source(png_structp png_ptr, png_bytep data, png_size_t n) {
+  auto *src =
+      static_cast<seedimg::stream::byte_source *>(png_get_io_ptr(png_ptr));
+  if (src->read(data, n) != n)
+    png_error(png_ptr, "unexpected end of data");
+}
+static void write_sink(png_structp png_ptr, png_bytep data, png_size_t n) {
+  auto *dst =
+      static_cast<seedimg::stream::byte_sink *>(png_get_io_ptr(png_ptr));
+  if (!dst->write(data, n))
+    png_error(png_ptr, "write failed");
+}
+static void flush_sink(png_structp png_ptr) {
+  static_cast<seedimg::stream::byte_sink *>(png_get_io_ptr(png_ptr))->flush();
+}
+} // namespace detail
+
+/**
+ * @brief Decodes a PNG a few rows at a time, for seedimg::stream::pipe.
+ * With a size hint it is shrunk by a power of two while reading, every
+ * output pixel being the mean of a block, so that only one row of the full
+ * image is in memory at a time.
+ * @note Interlaced images can't be decoded by row, they are decoded whole on
+ * the first read.
+ */
+class reader : public seedimg::stream::reader {
+public:
+  explicit reader(const std::string &filename,
+                  seedimg::stream::size_hint hint = {}) {
+    fp_ = std::fopen(filename.c_str(), "rb");
+    if (!fp_) {
+      std::cerr << "File " << filename << " could not be opened" << std::endl;
+      return;
+    }
+    if (!check(filename)) {
+      std::cerr << filename << " is not a valid PNG file" << std::endl;
+      return;
+    }
+    good_ = open(filename, hint);
   }
 
-  if (!check(filename)) {
-    std::cerr << filename << " is not a valid PNG file" << std::endl;
-    errcode = -1;
-    goto finalise;
+  /**
+   * @brief Decode from memory, which must outlive the reader.
+   */
+  reader(const std::uint8_t *data, std::size_t size,
+         seedimg::stream::size_hint hint = {})
+      : source_{data, size} {
+    if (!check(data, size)) {
+      std::cerr << "Data is not a valid PNG file" << std::endl;
+      return;
+    }
+    good_ = open("data", hint);
   }
 
-  // validation done: initialize info structs.
+  reader(reader const &) = delete;
+  void operator=(reader const &) = delete;
 
-  png_ptr =
-      png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-  if (!png_ptr) {
-    std::cerr << "Failed to create read struct for " << filename << std::endl;
-    errcode = -1;
-    goto finalise;
+  ~reader() override {
+    if (fp_ != nullptr)
+      std::fclose(fp_);
+    if (png_ptr_ != nullptr)
+      png_destroy_read_struct(&png_ptr_, &info_ptr_, nullptr);
   }
 
-  info_ptr = png_create_info_struct(png_ptr);
-  if (!info_ptr) {
-    std::cerr << "Failed to create info struct for " << filename << std::endl;
-    errcode = -1;
-    goto finalise;
+  bool good() const noexcept override { return good_; }
+  simg_int width() const noexcept override {
+    return (width_ + factor_ - 1) / factor_;
   }
-
-  // set jmp for errors, finalise is just for cleanup
-
-  if (setjmp(png_jmpbuf(png_ptr))) {
-    std::cerr << "Error during PNG processing for " << filename << std::endl;
-    errcode = -1;
-    goto finalise;
+  simg_int height() const noexcept override {
+    return (height_ + factor_ - 1) / factor_;
   }
 
-  png_init_io(png_ptr, fp);
-  png_read_info(png_ptr, info_ptr);
-
-  interlace_passes = png_set_interlace_handling(png_ptr);
-  color_type = png_get_color_type(png_ptr, info_ptr);
-  bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-  res_img = seedimg::make(png_get_image_width(png_ptr, info_ptr),
-                          png_get_image_height(png_ptr, info_ptr));
-
-  if (bit_depth == 16)
-    png_set_strip_16(png_ptr);
-
-  if (color_type == PNG_COLOR_TYPE_PALETTE)
-    png_set_palette_to_rgb(png_ptr);
-
-  if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
-    png_set_expand_gray_1_2_4_to_8(png_ptr);
-
-  if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
-    png_set_tRNS_to_alpha(png_ptr);
-
-  if (color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_GRAY ||
-      color_type == PNG_COLOR_TYPE_PALETTE)
-    png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
-
-  if (color_type == PNG_COLOR_TYPE_GRAY ||
-      color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
-    png_set_gray_to_rgb(png_ptr);
-
-  png_read_update_info(png_ptr, info_ptr);
-
-  // This will load the png into the vectors. (non interlaced pngs only)
-  for (int pass = 0; pass < interlace_passes; pass++) {
-    for (size_t y = 0; y < res_img->height(); y++)
-      png_read_row(png_ptr, reinterpret_cast<png_bytep>(res_img->row(y)),
+  bool read(seedimg::pixel *rows, simg_int n) override {
+    if (!good_ || n > height() - next_)
+      return false;
+    if (factor_ > 1)
+      return good_ = read_shrunk(rows, n);
+    if (passes_ > 1) {
+      // asked for everything, deinterlace straight into the caller's rows.
+      if (whole_ == nullptr && next_ == 0 && n == height_) {
+        good_ = read_passes(rows);
+        next_ = height_;
+        return good_;
+      }
+      if (whole_ == nullptr) {
+        whole_ = std::make_unique<seedimg::img>(width_, height_);
+        if (!(good_ = read_passes(whole_->data())))
+          return false;
+      }
+      std::copy(whole_->row(next_), whole_->row(next_ + n), rows);
+      next_ += n;
+      return true;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr_))) {
+      std::cerr << "Error during PNG processing" << std::endl;
+      return good_ = false;
+    }
+    for (simg_int y = 0; y < n; ++y)
+      png_read_row(png_ptr_, reinterpret_cast<png_bytep>(rows + y * width_),
                    nullptr);
+    next_ += n;
+    return true;
   }
 
-finalise:
-  if (fp != nullptr)
-    fclose(fp);
-  if (info_ptr != nullptr)
-    png_destroy_info_struct(png_ptr, &info_ptr);
-  if (png_ptr != nullptr)
-    png_destroy_read_struct(&png_ptr, nullptr, nullptr);
-
-  if (errcode != 0) {
-    return nullptr;
-  } else {
-    return res_img;
+private:
+  std::FILE *fp_ = nullptr;
+  png_structp png_ptr_ = nullptr;
+  png_infop info_ptr_ = nullptr;
+  // dimensions of the file, next_ is the next row of the output.
+  simg_int width_ = 0, height_ = 0, next_ = 0;
+  simg_int factor_ = 1;
+  int passes_ = 1;
+  std::unique_ptr<seedimg::img> whole_;
+  std::vector<seedimg::pixel> line_;
+  std::vector<std::uint32_t> sums_;
+  seedimg::stream::byte_source source_{nullptr, 0};
+  bool good_ = false;
+
+  // name is only used in messages.
+  bool open(const std::string &name, seedimg::stream::size_hint hint) {
+    // validation done: initialize info structs.
+
+    png_ptr_ = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr,
+                                      nullptr);
+    if (!png_ptr_) {
+      std::cerr << "Failed to create read struct for " << name << std::endl;
+      return false;
+    }
+
+    info_ptr_ = png_create_info_struct(png_ptr_);
+    if (!info_ptr_) {
+      std::cerr << "Failed to create info struct for " << name << std::endl;
+      return false;
+    }
+
+    // set jmp for errors, the destructor does the cleanup.
+    if (setjmp(png_jmpbuf(png_ptr_))) {
+      std::cerr << "Error during PNG processing for " << name << std::endl;
+      return false;
+    }
+
+    if (fp_ != nullptr)
+      png_init_io(png_ptr_, fp_);
+    else
+      png_set_read_fn(png_ptr_, &source_, detail::read_source);
+    png_read_info(png_ptr_, info_ptr_);
+
+    passes_ = png_set_interlace_handling(png_ptr_);
+    const auto color_type = png_get_color_type(png_ptr_, info_ptr_);
+    const auto bit_depth = png_get_bit_depth(png_ptr_, info_ptr_);
+    width_ = png_get_image_width(png_ptr_, info_ptr_);
+    height_ = png_get_image_height(png_ptr_, info_ptr_);
+
+    if (bit_depth == 16)
+      png_set_strip_16(png_ptr_);
+
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+      png_set_palette_to_rgb(png_ptr_);
+
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+      png_set_expand_gray_1_2_4_to_8(png_ptr_);
+
+    if (png_get_valid(png_ptr_, info_ptr_, PNG_INFO_tRNS))
+      png_set_tRNS_to_alpha(png_ptr_);
+
+    if (color_type == PNG_COLOR_TYPE_RGB ||
+        color_type == PNG_COLOR_TYPE_GRAY ||
+        color_type == PNG_COLOR_TYPE_PALETTE)
+      png_set_filler(png_ptr_, 0xFF, PNG_FILLER_AFTER);
+
+    if (color_type == PNG_COLOR_TYPE_GRAY ||
+        color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+      png_set_gray_to_rgb(png_ptr_);
+
+    png_read_update_info(png_ptr_, info_ptr_);
+    factor_ = seedimg::stream::shrink_factor(width_, height_, hint,
+                                             std::max(width_, height_));
+    return true;
   }
-}
 
-bool to(const std::string &filename, const simg &inp_img) {
-  png_structp png_ptr = nullptr;
-  png_infop info_ptr = nullptr;
-  int errcode = 0;
+  // every output pixel is the mean of a factor_ x factor_ block, or of what
+  // is left of it at the right and bottom edge.
+  bool read_shrunk(seedimg::pixel *rows, simg_int n) {
+    if (passes_ > 1 && whole_ == nullptr) {
+      whole_ = std::make_unique<seedimg::img>(width_, height_);
+      if (!read_passes(whole_->data()))
+        return false;
+    }
+    if (setjmp(png_jmpbuf(png_ptr_))) {
+      std::cerr << "Error during PNG processing" << std::endl;
+      return false;
+    }
+    const simg_int out_width = width();
+    line_.resize(width_);
+    sums_.resize(out_width * 4);
+    for (simg_int y = 0; y < n; ++y, ++next_) {
+      const simg_int first = next_ * factor_;
+      const simg_int count = std::min(factor_, height_ - first);
+      std::fill(sums_.begin(), sums_.end(), 0);
+      for (simg_int j = 0; j < count; ++j) {
+        const seedimg::pixel *src = line_.data();
+        if (whole_ != nullptr)
+          src = whole_->row(first + j);
+        else
+          png_read_row(png_ptr_, reinterpret_cast<png_bytep>(line_.data()),
+                       nullptr);
+        const auto *bytes = reinterpret_cast<const std::uint8_t *>(src);
+        std::uint32_t *sum = sums_.data();
+        for (simg_int x = 0; x < width_; x += factor_, sum += 4) {
+          const simg_int end = std::min(x + factor_, width_);
+          for (simg_int i = x; i < end; ++i)
+            for (simg_int c = 0; c < 4; ++c)
+              sum[c] += bytes[i * 4 + c];
+        }
+      }
+      auto *dst = reinterpret_cast<std::uint8_t *>(rows + y * out_width);
+      for (simg_int x = 0; x < out_width; ++x) {
+        const auto area = static_cast<std::uint32_t>(
+            std::min(factor_, width_ - x * factor_) * count);
+        for (simg_int c = 0; c < 4; ++c)
+          dst[x * 4 + c] =
+              static_cast<std::uint8_t>((sums_[x * 4 + c] + area / 2) / area);
+      }
+    }
+    return true;
+  }
 
-  auto fp = std::fopen(filename.c_str(), "wb");
+  // every pass goes over the whole image.
+  bool read_passes(seedimg::pixel *dst) {
+    if (setjmp(png_jmpbuf(png_ptr_))) {
+      std::cerr << "Error during PNG processing" << std::endl;
+      return false;
+    }
+    for (int pass = 0; pass < passes_; pass++)
+      for (simg_int y = 0; y < height_; y++)
+        png_read_row(png_ptr_, reinterpret_cast<png_bytep>(dst + y * width_),
+                     nullptr);
+    return true;
+  }
+};
+
+/**
+ * @brief Encodes an 8-bit RGBA PNG a few rows at a time, for
+ * seedimg::stream::pipe.
+ */
+class writer : public seedimg::stream::writer {
+public:
+  writer(const std::string &filename, simg_int width, simg_int height)
+      : width_{width} {
+    fp_ = std::fopen(filename.c_str(), "wb");
+    if (!fp_) {
+      std::cerr << "File " << filename << " could not be opened" << std::endl;
+      return;
+    }
+    good_ = open(filename, height);
+  }
 
-  if (!fp) {
-    std::cerr << "File " << filename << " could not be opened" << std::endl;
-    errcode = -1;
-    return false;
+  writer(seedimg::stream::byte_sink sink, simg_int width, simg_int height)
+      : width_{width}, sink_{sink} {
+    good_ = open("data", height);
   }
 
-  // validation done: initialize info structs.
+  writer(writer const &) = delete;
+  void operator=(writer const &) = delete;
+
+  ~writer() override {
+    if (png_ptr_ != nullptr)
+      png_destroy_write_struct(&png_ptr_, &info_ptr_);
+    if (fp_ != nullptr)
+      std::fclose(fp_);
+  }
 
-  png_ptr =
-      png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-  if (!png_ptr) {
-    std::cerr << "Failed to create write struct for " << filename << std::endl;
-    errcode = -1;
-    goto finalise;
+  bool good() const noexcept override { return good_; }
+
+  bool write(const seedimg::pixel *rows, simg_int n) override {
+    if (!good_)
+      return false;
+    if (setjmp(png_jmpbuf(png_ptr_))) {
+      std::cerr << "Error during PNG processing" << std::endl;
+      return good_ = false;
+    }
+    for (simg_int y = 0; y < n; ++y)
+      png_write_row(png_ptr_, reinterpret_cast<png_const_bytep>(
+                                  rows + y * width_));
+    return true;
   }
 
-  info_ptr = png_create_info_struct(png_ptr);
-  if (!info_ptr) {
-    std::cerr << "Failed to create info struct for " << filename << std::endl;
-    errcode = -1;
-    goto finalise;
+  bool finish() override {
+    if (!good_)
+      return false;
+    if (setjmp(png_jmpbuf(png_ptr_))) {
+      std::cerr << "Error during PNG processing" << std::endl;
+      return good_ = false;
+    }
+    png_write_end(png_ptr_, nullptr);
+    return fp_ != nullptr ? std::fflush(fp_) == 0 : sink_->flush();
   }
 
-  // set jmp for errors, finalise is just for cleanup
-  if (setjmp(png_jmpbuf(png_ptr))) {
-    std::cerr << "Error during PNG processing for " << filename << std::endl;
-    errcode = -1;
-    goto finalise;
+private:
+  std::FILE *fp_ = nullptr;
+  png_structp png_ptr_ = nullptr;
+  png_infop info_ptr_ = nullptr;
+  simg_int width_;
+  std::optional<seedimg::stream::byte_sink> sink_;
+  bool good_ = false;
+
+  // name is only used in messages.
+  bool open(const std::string &name, simg_int height) {
+    png_ptr_ = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr,
+                                       nullptr, nullptr);
+    if (!png_ptr_) {
+      std::cerr << "Failed to create write struct for " << name << std::endl;
+      return false;
+    }
+
+    info_ptr_ = png_create_info_struct(png_ptr_);
+    if (!info_ptr_) {
+      std::cerr << "Failed to create info struct for " << name << std::endl;
+      return false;
+    }
+
+    // set jmp for errors, the destructor does the cleanup.
+    if (setjmp(png_jmpbuf(png_ptr_))) {
+      std::cerr << "Error during PNG processing for " << name << std::endl;
+      return false;
+    }
+
+    if (fp_ != nullptr)
+      png_init_io(png_ptr_, fp_);
+    else
+      png_set_write_fn(png_ptr_, &*sink_, detail::write_sink,
+                       detail::flush_sink);
+
+    // Output is 8bit depth, RGBA format.
+    png_set_IHDR(png_ptr_, info_ptr_, static_cast<png_uint_32>(width_),
+                 static_cast<png_uint_32>(height), 8, PNG_COLOR_TYPE_RGBA,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr_, info_ptr_);
+    return true;
   }
+};
+
+template <typename... Source> static inline simg from_reader(Source &&... in) {
+  reader src(std::forward<Source>(in)...);
+  if (!src.good())
+    return nullptr;
+  auto res_img = seedimg::make(src.width(), src.height());
+  if (!src.read(res_img->data(), src.height()))
+    return nullptr;
+  return res_img;
+}
 
-  png_init_io(png_ptr, fp);
+simg from(const std::string &filename) { return from_reader(filename); }
 
-  // Output is 8bit depth, RGBA format.
-  png_set_IHDR(png_ptr, info_ptr, static_cast<png_uint_32>(inp_img->width()),
-               static_cast<png_uint_32>(inp_img->height()), 8,
-               PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
-               PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-  png_write_info(png_ptr, info_ptr);
+/**
+ * @brief Decode a PNG from memory.
+ */
+simg from(const std::uint8_t *data, std::size_t size) {
+  return from_reader(data, size);
+}
 
-  for (simg_int y = 0; y < inp_img->height(); ++y) {
-    png_write_row(png_ptr, reinterpret_cast<png_bytep>(inp_img->row(y)));
-  }
+/**
+ * @brief Decode a PNG shrunk by a power of two, as much as possible without
+ * getting smaller than hint.
+ */
+simg from(const std::string &filename, seedimg::stream::size_hint hint) {
+  return from_reader(filename, hint);
+}
 
-  png_write_end(png_ptr, nullptr);
+simg from(const std::uint8_t *data, std::size_t size,
+          seedimg::stream::size_hint hint) {
+  return from_reader(data, size, hint);
+}
 
-finalise:
-  if (fp != nullptr)
-    fclose(fp);
-  if (info_ptr != nullptr)
-    png_destroy_info_struct(png_ptr, &info_ptr);
-  if (png_ptr != nullptr)
-    png_destroy_write_struct(&png_ptr, nullptr);
+bool to(const std::string &filename, const simg &inp_img) {
+  writer dst(filename, inp_img->width(), inp_img->height());
+  return dst.write(inp_img->data(), inp_img->height()) && dst.finish();
+}
 
-  return errcode == 0;
+/**
+ * @brief Encode a PNG into a vector, which is appended to, or a stream.
+ */
+bool to(seedimg::stream::byte_sink sink, const simg &inp_img) {
+  writer dst(sink, inp_img->width(), inp_img->height());
+  return dst.write(inp_img->data(), inp_img->height()) && dst.finish();
 }
 } // namespace seedimg::modules::png
 } // namespace seedimg::modules
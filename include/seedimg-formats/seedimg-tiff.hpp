@@ -24,117 +24,561 @@ extern "C" {
 #include <tiffio.h>
 }
 
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <seedimg-stream.hpp>
+#include <seedimg-utils.hpp>
 #include <seedimg.hpp>
+#include <string>
+#include <vector>
+
+// width and height of the tiles TIFFs are written with.
+#ifndef SIMG_TIFF_TILE
+#define SIMG_TIFF_TILE 256
+#endif
+
+// zlib level the tiles are compressed with, from 1 to 9.
+#ifndef SIMG_TIFF_DEFLATE_LEVEL
+#define SIMG_TIFF_DEFLATE_LEVEL 6
+#endif
+
+// images with less pixels are decoded on one thread, they aren't worth
+// opening more handles on the file for.
+#ifndef SIMG_TIFF_PARALLEL_PIXELS
+#define SIMG_TIFF_PARALLEL_PIXELS (512 * 512)
+#endif
 
 namespace seedimg {
 namespace modules {
 namespace tiff {
-bool check(const std::string &filename) noexcept {
-  std::ifstream input(filename);
-  std::uint8_t intel[4] = {0x49, 0x49, 0x2A, 0x00};
-  std::uint8_t motorola[4] = {0x4D, 0x4D, 0x00, 0x2A};
-  char sig[4];
+namespace detail {
+// what TIFFClientOpen reads from or writes to when the TIFF is in memory.
+// libtiff seeks back to patch offsets while writing, so the output is
+// gathered here and only handed to the sink once it is closed.
+struct memory_handle {
+  const std::uint8_t *input = nullptr;
+  std::vector<std::uint8_t> output;
+  std::size_t size = 0, pos = 0;
+};
+
+// while writing, libtiff reads back what it wrote to link directories.
+static tsize_t memory_read(thandle_t fd, tdata_t buf, tsize_t n) {
+  auto *mem = static_cast<memory_handle *>(fd);
+  const std::uint8_t *data =
+      mem->input != nullptr ? mem->input : mem->output.data();
+  if (mem->pos >= mem->size)
+    return 0;
+  const auto len = std::min(static_cast<std::size_t>(n), mem->size - mem->pos);
+  std::memcpy(buf, data + mem->pos, len);
+  mem->pos += len;
+  return static_cast<tsize_t>(len);
+}
 
+static tsize_t memory_write(thandle_t fd, tdata_t buf, tsize_t n) {
+  auto *mem = static_cast<memory_handle *>(fd);
+  const auto len = static_cast<std::size_t>(n);
   try {
-    input.read(sig, 4);
-  } catch (std::iostream::failure) {
-    return false;
+    if (mem->pos + len > mem->output.size())
+      mem->output.resize(mem->pos + len);
+  } catch (...) {
+    return -1;
   }
-  return std::memcmp(sig, intel, 4) == 0 || std::memcmp(sig, motorola, 4) == 0;
+  std::memcpy(mem->output.data() + mem->pos, buf, len);
+  mem->pos += len;
+  mem->size = mem->output.size();
+  return n;
 }
 
-bool to(const std::string &filename, const anim &inp_anim) {
-  uint16 out[1] = {EXTRASAMPLE_ASSOCALPHA};
-  TIFF *img = TIFFOpen(filename.c_str(), "w");
-  if (img) {
-    for (std::size_t i = 0; i < inp_anim.size(); ++i) {
-      if (inp_anim[i]->width() > UINT32_MAX ||
-          inp_anim[i]->height() > UINT32_MAX)
-        return false;
-      TIFFSetField(img, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
-      TIFFSetField(img, TIFFTAG_IMAGEWIDTH, inp_anim[i]->width());
-      TIFFSetField(img, TIFFTAG_IMAGELENGTH, inp_anim[i]->height());
-      TIFFSetField(img, TIFFTAG_BITSPERSAMPLE, 8);
-      TIFFSetField(img, TIFFTAG_SAMPLESPERPIXEL, 4);
-      TIFFSetField(img, TIFFTAG_EXTRASAMPLES, 1, &out);
-
-      TIFFSetField(img, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-      TIFFSetField(img, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-
-      unsigned char *buf =
-          static_cast<unsigned char *>(_TIFFmalloc(static_cast<tmsize_t>(
-              inp_anim[i]->width() * sizeof(seedimg::pixel))));
-
-      for (simg_int y = 0; y < inp_anim[i]->height(); ++y) {
-        std::copy(inp_anim[i]->row(y), inp_anim[i]->row(y + 1),
-                  reinterpret_cast<seedimg::pixel *>(buf));
-        if (TIFFWriteScanline(img, buf, static_cast<uint32>(y), 0) < 0) {
-          return false;
-        }
-      }
+static toff_t memory_seek(thandle_t fd, toff_t off, int whence) {
+  auto *mem = static_cast<memory_handle *>(fd);
+  switch (whence) {
+  case SEEK_SET:
+    mem->pos = static_cast<std::size_t>(off);
+    break;
+  case SEEK_CUR:
+    mem->pos += static_cast<std::size_t>(off);
+    break;
+  case SEEK_END:
+    mem->pos = mem->size + static_cast<std::size_t>(off);
+    break;
+  default:
+    return static_cast<toff_t>(-1);
+  }
+  return static_cast<toff_t>(mem->pos);
+}
+
+static int memory_close(thandle_t) { return 0; }
 
-      _TIFFfree(buf);
-      TIFFWriteDirectory(img);
+static toff_t memory_size(thandle_t fd) {
+  return static_cast<toff_t>(static_cast<memory_handle *>(fd)->size);
+}
+
+static int memory_map(thandle_t, tdata_t *, toff_t *) { return 0; }
+static void memory_unmap(thandle_t, tdata_t, toff_t) {}
+
+static TIFF *memory_open(memory_handle &mem, const char *mode) {
+  return TIFFClientOpen("memory", mode, &mem, memory_read, memory_write,
+                        memory_seek, memory_close, memory_size, memory_map,
+                        memory_unmap);
+}
+
+// where the TIFF being read comes from, so that other threads can open
+// handles of their own on it: a libtiff handle can't be shared.
+struct source {
+  std::string filename;
+  const std::uint8_t *data = nullptr;
+  std::size_t size = 0;
+};
+
+// a handle on src positioned on directory dir, closed on destruction.
+class handle {
+public:
+  handle(const source &src, tdir_t dir) {
+    if (src.data != nullptr) {
+      mem_.input = src.data;
+      mem_.size = src.size;
+      tif_ = memory_open(mem_, "rm");
+    } else {
+      tif_ = TIFFOpen(src.filename.c_str(), "r");
+    }
+    if (tif_ != nullptr && !TIFFSetDirectory(tif_, dir)) {
+      TIFFClose(tif_);
+      tif_ = nullptr;
     }
   }
-  TIFFClose(img);
+
+  handle(handle const &) = delete;
+  void operator=(handle const &) = delete;
+
+  ~handle() {
+    if (tif_ != nullptr)
+      TIFFClose(tif_);
+  }
+
+  TIFF *get() const noexcept { return tif_; }
+
+private:
+  memory_handle mem_;
+  TIFF *tif_ = nullptr;
+};
+
+// tile i of inp_img, padded with zeros past the right and bottom edge,
+// horizontally differenced and deflated: what libtiff's deflate codec with
+// PREDICTOR_HORIZONTAL would have made of it.
+static bool compress_tile(const simg &inp_img, std::size_t i,
+                          std::size_t across, std::vector<std::uint8_t> &out) {
+  constexpr std::size_t tile = SIMG_TIFF_TILE;
+  constexpr std::size_t row_bytes = tile * sizeof(seedimg::pixel);
+  std::vector<std::uint8_t> raw(tile * row_bytes, 0);
+  const simg_int x0 = (i % across) * tile, y0 = (i / across) * tile;
+  const simg_int w = std::min<simg_int>(tile, inp_img->width() - x0);
+  const simg_int h = std::min<simg_int>(tile, inp_img->height() - y0);
+  for (simg_int y = 0; y < h; ++y) {
+    std::uint8_t *row = raw.data() + y * row_bytes;
+    std::memcpy(row, inp_img->row(y0 + y) + x0, w * sizeof(seedimg::pixel));
+    // every sample minus the same one of the pixel on its left.
+    constexpr std::size_t step = sizeof(seedimg::pixel);
+    for (std::size_t b = row_bytes - 1; b >= step; --b)
+      row[b] = static_cast<std::uint8_t>(row[b] - row[b - step]);
+  }
+  uLongf size = compressBound(static_cast<uLong>(raw.size()));
+  out.resize(size);
+  if (compress2(out.data(), &size, raw.data(), static_cast<uLong>(raw.size()),
+                SIMG_TIFF_DEFLATE_LEVEL) != Z_OK)
+    return false;
+  out.resize(size);
   return true;
 }
 
-bool to(const std::string &filename, const simg &inp_img) {
+// starts a directory for inp_img, written as deflated tiles.
+static void begin_frame(TIFF *img, const simg &inp_img) {
   uint16 out[1] = {EXTRASAMPLE_ASSOCALPHA};
-  TIFF *img = TIFFOpen(filename.c_str(), "w");
   TIFFSetField(img, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
-  TIFFSetField(img, TIFFTAG_IMAGEWIDTH, inp_img->width());
-  TIFFSetField(img, TIFFTAG_IMAGELENGTH, inp_img->height());
+  const auto width = static_cast<uint32>(inp_img->width());
+  const auto height = static_cast<uint32>(inp_img->height());
+  TIFFSetField(img, TIFFTAG_IMAGEWIDTH, width);
+  TIFFSetField(img, TIFFTAG_IMAGELENGTH, height);
   TIFFSetField(img, TIFFTAG_BITSPERSAMPLE, 8);
   TIFFSetField(img, TIFFTAG_SAMPLESPERPIXEL, 4);
   TIFFSetField(img, TIFFTAG_EXTRASAMPLES, 1, &out);
 
   TIFFSetField(img, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
   TIFFSetField(img, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  TIFFSetField(img, TIFFTAG_TILEWIDTH, static_cast<uint32>(SIMG_TIFF_TILE));
+  TIFFSetField(img, TIFFTAG_TILELENGTH, static_cast<uint32>(SIMG_TIFF_TILE));
+  TIFFSetField(img, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+  TIFFSetField(img, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+}
 
-  unsigned char *buf = static_cast<unsigned char *>(_TIFFmalloc(
-      static_cast<tmsize_t>(inp_img->width() * sizeof(seedimg::pixel))));
+// writes frames[0] to frames[n - 1] as deflated tiles, a directory each. the tiles of all of
+// them are compressed on the thread pool a batch at a time, so small pages
+// are compressed together, and written in order, libtiff only runs on this
+// thread.
+template <typename Frames>
+static bool write_frames(TIFF *img, const Frames &frames, std::size_t n) {
+  constexpr std::size_t tile = SIMG_TIFF_TILE;
+  // first[f] is the index of the first tile of frame f among all of them.
+  std::vector<std::size_t> across(n), first(n + 1, 0);
+  for (std::size_t f = 0; f < n; ++f) {
+    if (frames[f]->width() > UINT32_MAX || frames[f]->height() > UINT32_MAX)
+      return false;
+    across[f] = (frames[f]->width() + tile - 1) / tile;
+    first[f + 1] =
+        first[f] + across[f] * ((frames[f]->height() + tile - 1) / tile);
+  }
 
-  for (simg_int y = 0; y < inp_img->height(); ++y) {
-    std::copy(inp_img->row(y), inp_img->row(y + 1),
-              reinterpret_cast<seedimg::pixel *>(buf));
-    if (TIFFWriteScanline(img, buf, static_cast<uint32>(y), 0) < 0) {
+  auto &pool = simgdetails::thread_pool::instance();
+  const std::size_t count = first[n];
+  const std::size_t batch = std::max<std::size_t>(
+      std::min(pool.size() * 4, count), 1);
+  std::vector<std::vector<std::uint8_t>> packed(batch);
+  std::size_t f = 0;
+  if (n != 0)
+    begin_frame(img, frames[0]);
+  for (std::size_t start = 0; f < n; start += batch) {
+    const std::size_t len = std::min(batch, count - std::min(start, count));
+    std::atomic<bool> ok{true};
+    pool.parallel_for(len, [&](std::size_t i) {
+      const std::size_t t = start + i;
+      const std::size_t g = static_cast<std::size_t>(
+          std::upper_bound(first.begin(), first.end(), t) - first.begin() -
+          1);
+      if (!compress_tile(frames[g], t - first[g], across[g], packed[i]))
+        ok = false;
+    });
+    if (!ok)
       return false;
+    // every frame whose tiles are all written gets its directory, also the
+    // empty ones, which have no tiles at all.
+    for (std::size_t i = 0; i <= len; ++i) {
+      while (f < n && first[f + 1] == start + i) {
+        if (!TIFFWriteDirectory(img))
+          return false;
+        if (++f < n)
+          begin_frame(img, frames[f]);
+      }
+      if (i == len)
+        break;
+      if (TIFFWriteRawTile(img, static_cast<uint32>(start + i - first[f]),
+                           packed[i].data(),
+                           static_cast<tmsize_t>(packed[i].size())) < 0)
+        return false;
     }
   }
-  _TIFFfree(buf);
   return true;
 }
 
+// whether the current directory is 8-bit RGB, or RGBA with associated
+// alpha, top row first: strips and tiles of those are already laid out as
+// pixels, they don't have to go through TIFFRGBAImage.
+static bool plain_rgba(TIFF *img, uint16 &spp) {
+  uint16 bps = 0, planar = 0, photometric = 0, orientation = 0, format = 0;
+  TIFFGetFieldDefaulted(img, TIFFTAG_BITSPERSAMPLE, &bps);
+  TIFFGetFieldDefaulted(img, TIFFTAG_SAMPLESPERPIXEL, &spp);
+  TIFFGetFieldDefaulted(img, TIFFTAG_PLANARCONFIG, &planar);
+  TIFFGetFieldDefaulted(img, TIFFTAG_ORIENTATION, &orientation);
+  TIFFGetFieldDefaulted(img, TIFFTAG_SAMPLEFORMAT, &format);
+  if (!TIFFGetField(img, TIFFTAG_PHOTOMETRIC, &photometric) || bps != 8 ||
+      planar != PLANARCONFIG_CONTIG || photometric != PHOTOMETRIC_RGB ||
+      orientation != ORIENTATION_TOPLEFT || format != SAMPLEFORMAT_UINT)
+    return false;
+  if (spp == 3)
+    return true;
+  // TIFFRGBAImage premultiplies unassociated alpha, which has to stay so.
+  uint16 count = 0;
+  uint16 *types = nullptr;
+  return spp == 4 &&
+         TIFFGetFieldDefaulted(img, TIFFTAG_EXTRASAMPLES, &count, &types) &&
+         count == 1 && types[0] == EXTRASAMPLE_ASSOCALPHA;
+}
+
+// how the current directory is cut up: chunks, strips or tiles, of
+// width x height pixels, across of them per row of chunks.
+struct layout {
+  bool tiled;
+  uint16 spp;
+  uint32 width, height;
+  std::size_t across, count;
+};
+
+// decodes strip or tile i into res_img, through buf which has room for one.
+static bool read_chunk(TIFF *tif, const layout &lay, std::size_t i,
+                       std::vector<std::uint8_t> &buf, simg &res_img) {
+  const simg_int x0 = (i % lay.across) * lay.width;
+  const simg_int y0 = (i / lay.across) * lay.height;
+  const simg_int w = std::min<simg_int>(lay.width, res_img->width() - x0);
+  const simg_int h = std::min<simg_int>(lay.height, res_img->height() - y0);
+  const auto chunk = static_cast<uint32>(i);
+  // RGBA strips are whole rows of the image already.
+  if (!lay.tiled && lay.spp == 4)
+    return TIFFReadEncodedStrip(
+               tif, chunk, res_img->row(y0),
+               static_cast<tmsize_t>(h * w * sizeof(seedimg::pixel))) >= 0;
+
+  const tmsize_t size = static_cast<tmsize_t>(buf.size());
+  if ((lay.tiled ? TIFFReadEncodedTile(tif, chunk, buf.data(), size)
+                 : TIFFReadEncodedStrip(tif, chunk, buf.data(), size)) < 0)
+    return false;
+  for (simg_int y = 0; y < h; ++y) {
+    const std::uint8_t *src = buf.data() + y * lay.width * lay.spp;
+    seedimg::pixel *dst = res_img->row(y0 + y) + x0;
+    if (lay.spp == 4) {
+      std::memcpy(dst, src, w * sizeof(seedimg::pixel));
+    } else {
+      for (simg_int x = 0; x < w; ++x, src += 3)
+        dst[x] = {{src[0]}, {src[1]}, {src[2]}, 255};
+    }
+  }
+  return true;
+}
+
+// the rectangle between the corners p1 and p2 of the current directory.
+// libtiff only reads the strips or tiles that overlap it, and returns it
+// top to bottom, nothing has to be flipped.
+static simg read_region(TIFF *img, seedimg::point p1, seedimg::point p2) {
+  uint32 w, h;
+  TIFFGetField(img, TIFFTAG_IMAGEWIDTH, &w);
+  TIFFGetField(img, TIFFTAG_IMAGELENGTH, &h);
+  if (std::max(p1.x, p2.x) > w || std::max(p1.y, p2.y) > h)
+    return nullptr;
+  const simg_int x = std::min(p1.x, p2.x), y = std::min(p1.y, p2.y);
+  auto res_img = seedimg::make(std::max(p1.x, p2.x) - x,
+                               std::max(p1.y, p2.y) - y);
+  if (res_img->width() == 0 || res_img->height() == 0)
+    return res_img;
+
+  char emsg[1024];
+  TIFFRGBAImage rgba;
+  if (!TIFFRGBAImageOK(img, emsg) || !TIFFRGBAImageBegin(&rgba, img, 0, emsg))
+    return nullptr;
+  rgba.req_orientation = ORIENTATION_TOPLEFT;
+  rgba.col_offset = static_cast<int>(x);
+  rgba.row_offset = static_cast<int>(y);
+  const int ok = TIFFRGBAImageGet(
+      &rgba, reinterpret_cast<uint32 *>(res_img->data()),
+      static_cast<uint32>(res_img->width()),
+      static_cast<uint32>(res_img->height()));
+  TIFFRGBAImageEnd(&rgba);
+  if (!ok)
+    return nullptr;
+  return res_img;
+}
+// the current directory of img, which was opened from src. plain RGB(A)
+// strips or tiles are decoded straight into the image, in parallel through
+// up to max_parts handles, anything else goes through TIFFRGBAImage.
+static simg read_frame(TIFF *img, const source &src, std::size_t max_parts) {
+  uint32 w = 0, h = 0;
+  TIFFGetField(img, TIFFTAG_IMAGEWIDTH, &w);
+  TIFFGetField(img, TIFFTAG_IMAGELENGTH, &h);
+  layout lay{};
+  if (!plain_rgba(img, lay.spp))
+    return read_region(img, {0, 0}, {w, h});
+  auto res_img = seedimg::make(w, h);
+  if (w == 0 || h == 0)
+    return res_img;
+
+  lay.tiled = TIFFIsTiled(img) != 0;
+  if (lay.tiled) {
+    TIFFGetField(img, TIFFTAG_TILEWIDTH, &lay.width);
+    TIFFGetField(img, TIFFTAG_TILELENGTH, &lay.height);
+    lay.count = TIFFNumberOfTiles(img);
+  } else {
+    lay.width = w;
+    TIFFGetFieldDefaulted(img, TIFFTAG_ROWSPERSTRIP, &lay.height);
+    lay.height = std::min(lay.height, h);
+    lay.count = TIFFNumberOfStrips(img);
+  }
+  if (lay.width == 0 || lay.height == 0)
+    return nullptr;
+  lay.across = (w + lay.width - 1) / lay.width;
+
+  auto &pool = simgdetails::thread_pool::instance();
+  const std::size_t parts =
+      static_cast<simg_int>(w) * h < SIMG_TIFF_PARALLEL_PIXELS
+          ? 1
+          : std::max<std::size_t>(std::min(max_parts, lay.count), 1);
+  const auto ranges =
+      seedimg::utils::split_range(lay.count, (lay.count + parts - 1) / parts);
+  const tdir_t dir = TIFFCurrentDirectory(img);
+  std::atomic<bool> ok{true};
+  pool.parallel_for(ranges.size(), [&](std::size_t r) {
+    // the first range is read through img, the other ones open their own.
+    std::unique_ptr<handle> own;
+    TIFF *tif = img;
+    if (r != 0) {
+      own = std::make_unique<handle>(src, dir);
+      tif = own->get();
+    }
+    if (tif == nullptr) {
+      ok = false;
+      return;
+    }
+    std::vector<std::uint8_t> buf(static_cast<std::size_t>(
+        lay.tiled ? TIFFTileSize(tif) : TIFFStripSize(tif)));
+    for (std::size_t i = ranges[r].first; ok && i < ranges[r].second; ++i)
+      if (!read_chunk(tif, lay, i, buf, res_img))
+        ok = false;
+  });
+  if (!ok)
+    return nullptr;
+  return res_img;
+}
+
+// up to max_frames directories of img, from the current one on. pages are
+// decoded concurrently, a window of one per thread at a time through their
+// own handles, and the threads left over split up the pages.
+static anim read_frames(TIFF *img, const source &src, std::size_t max_frames) {
+  const tdir_t dir = TIFFCurrentDirectory(img);
+  std::size_t count = 1;
+  while (count < max_frames && TIFFReadDirectory(img))
+    ++count;
+  auto &pool = simgdetails::thread_pool::instance();
+  std::vector<simg> frames(count);
+  if (count == 1) {
+    frames[0] = read_frame(img, src, pool.size());
+  } else {
+    const std::size_t parts =
+        std::max<std::size_t>(pool.size() / std::min(pool.size(), count), 1);
+    seedimg::utils::frame_thread(0, count, [&](simg_int i) {
+      handle page(src, static_cast<tdir_t>(dir + i));
+      if (page.get() != nullptr)
+        frames[i] = read_frame(page.get(), src, parts);
+    });
+  }
+  anim res{};
+  for (auto &frame : frames) {
+    if (frame == nullptr)
+      return {};
+    res.add(std::move(frame));
+  }
+  return res;
+}
+
+} // namespace detail
+
+bool check(const std::string &filename) noexcept {
+  std::ifstream input(filename, std::ios::binary);
+  std::uint8_t intel[4] = {0x49, 0x49, 0x2A, 0x00};
+  std::uint8_t motorola[4] = {0x4D, 0x4D, 0x00, 0x2A};
+  char sig[4];
+
+  try {
+    input.read(sig, 4);
+  } catch (std::iostream::failure) {
+    return false;
+  }
+  return std::memcmp(sig, intel, 4) == 0 || std::memcmp(sig, motorola, 4) == 0;
+}
+
+bool check(const std::uint8_t *data, std::size_t size) noexcept {
+  std::uint8_t intel[4] = {0x49, 0x49, 0x2A, 0x00};
+  std::uint8_t motorola[4] = {0x4D, 0x4D, 0x00, 0x2A};
+  return size >= 4 && (std::memcmp(data, intel, 4) == 0 ||
+                       std::memcmp(data, motorola, 4) == 0);
+}
+
+bool to(const std::string &filename, const anim &inp_anim) {
+  TIFF *img = TIFFOpen(filename.c_str(), "w");
+  if (!img)
+    return false;
+  const bool success = detail::write_frames(img, inp_anim, inp_anim.size());
+  TIFFClose(img);
+  return success;
+}
+
+bool to(const std::string &filename, const simg &inp_img) {
+  TIFF *img = TIFFOpen(filename.c_str(), "w");
+  if (!img)
+    return false;
+  const bool success = detail::write_frames(img, &inp_img, 1);
+  TIFFClose(img);
+  return success;
+}
+
+/**
+ * @brief Encode every frame into a vector, which is appended to, or a stream.
+ */
+bool to(seedimg::stream::byte_sink sink, const anim &inp_anim) {
+  detail::memory_handle mem;
+  TIFF *img = detail::memory_open(mem, "w");
+  if (!img)
+    return false;
+  const bool success = detail::write_frames(img, inp_anim, inp_anim.size());
+  TIFFClose(img);
+  return success && sink.write(mem.output.data(), mem.output.size()) &&
+         sink.flush();
+}
+
+bool to(seedimg::stream::byte_sink sink, const simg &inp_img) {
+  detail::memory_handle mem;
+  TIFF *img = detail::memory_open(mem, "w");
+  if (!img)
+    return false;
+  const bool success = detail::write_frames(img, &inp_img, 1);
+  TIFFClose(img);
+  return success && sink.write(mem.output.data(), mem.output.size()) &&
+         sink.flush();
+}
+
 anim from(const std::string &filename, std::size_t max_frames = 1) {
   if (!std::filesystem::exists(filename))
     return {};
-  anim res{};
-  std::size_t cnt = 0;
   TIFF *img = TIFFOpen(filename.c_str(), "r");
-  if (img) {
-    do {
-      uint32 w, h;
-      TIFFGetField(img, TIFFTAG_IMAGEWIDTH, &w);
-      TIFFGetField(img, TIFFTAG_IMAGELENGTH, &h);
-      simg decompressed = seedimg::make(w, h);
-      TIFFReadRGBAImage(img, w, h,
-                        reinterpret_cast<uint32 *>(decompressed->data()), 0);
-      seedimg::pixel *row = new seedimg::pixel[w];
-      // TIFFReadRGBAImage reads the image in reverse. need to mirror it
-      // vertically
-      for (simg_int y = 0; y < h / 2; ++y) {
-        std::copy(decompressed->row(y), decompressed->row(y + 1), row);
-        std::copy(decompressed->row(h - y - 1), decompressed->row(h - y),
-                  decompressed->row(y));
-        std::copy(row, row + w, decompressed->row(h - y - 1));
-      }
-      delete[] row;
-      res.add(std::move(decompressed));
-    } while (TIFFReadDirectory(img) && ++cnt < max_frames);
-  }
+  if (!img)
+    return {};
+  anim res = detail::read_frames(img, {filename}, max_frames);
+  TIFFClose(img);
+  return res;
+}
+
+/**
+ * @brief Decode up to max_frames frames of a TIFF in memory.
+ */
+anim from(const std::uint8_t *data, std::size_t size,
+          std::size_t max_frames = 1) {
+  detail::memory_handle mem;
+  mem.input = data;
+  mem.size = size;
+  // 'm' keeps libtiff from trying to map the handle.
+  TIFF *img = detail::memory_open(mem, "rm");
+  if (!img)
+    return {};
+  anim res = detail::read_frames(img, {{}, data, size}, max_frames);
+  TIFFClose(img);
+  return res;
+}
+
+/**
+ * @brief Decode only the rectangle between the corners p1 and p2 of the
+ * first frame, the result is as big as the rectangle.
+ * @return nullptr if the rectangle isn't inside the image.
+ */
+simg from(const std::string &filename, seedimg::point p1, seedimg::point p2) {
+  if (!std::filesystem::exists(filename))
+    return nullptr;
+  TIFF *img = TIFFOpen(filename.c_str(), "r");
+  if (!img)
+    return nullptr;
+  simg res = detail::read_region(img, p1, p2);
+  TIFFClose(img);
+  return res;
+}
+
+simg from(const std::uint8_t *data, std::size_t size, seedimg::point p1,
+          seedimg::point p2) {
+  detail::memory_handle mem;
+  mem.input = data;
+  mem.size = size;
+  TIFF *img = detail::memory_open(mem, "rm");
+  if (!img)
+    return nullptr;
+  simg res = detail::read_region(img, p1, p2);
   TIFFClose(img);
   return res;
 }
@@ -19,6 +19,15 @@
 #ifndef SEEDIMG_WEBP_H
 #define SEEDIMG_WEBP_H
 
+#include <cstring>
+#include <fstream>
+
+extern "C" {
+#include <webp/decode.h>
+#include <webp/encode.h>
+}
+
+#include <seedimg-stream.hpp>
 #include <seedimg.hpp>
 
 namespace seedimg {
@@ -35,7 +44,16 @@ bool check(const std::string &filename) noexcept {
   return !std::memcmp("RIFFWEBP", header, 8);
 }
 
-bool to(const std::string &filename, const simg &inp_img, float quality = 100.0) {
+bool check(const std::uint8_t *data, std::size_t size) noexcept {
+  return size >= 12 && !std::memcmp("RIFF", data, 4) &&
+         !std::memcmp("WEBP", data + 8, 4);
+}
+
+/**
+ * @brief Encode a WebP into a vector, which is appended to, or a stream.
+ */
+bool to(seedimg::stream::byte_sink sink, const simg &inp_img,
+        float quality = 100.0) {
   std::uint8_t *output = nullptr;
   // this is the amount of bytes output has been allocated, 0 if failure
   std::size_t success = WebPEncodeRGBA(
@@ -46,37 +64,93 @@ bool to(const std::string &filename, const simg &inp_img, float quality = 100.0)
       quality, &output);
   if (success == 0)
     return false;
-  std::ofstream file(filename, std::ios::binary);
-  file.write(reinterpret_cast<char *>(output),
-             static_cast<std::streamsize>(success));
+  const bool written = sink.write(output, success) && sink.flush();
   WebPFree(output);
-  return true;
+  return written;
 }
 
-simg from(const std::string &filename) {
-  std::error_code ec;
-  std::size_t size = std::filesystem::file_size(filename, ec);
-  if (ec != std::error_code{})
-    return nullptr;
+bool to(const std::string &filename, const simg &inp_img,
+        float quality = 100.0) {
+  std::ofstream file(filename, std::ios::binary);
+  return file && to(file, inp_img, quality);
+}
+
+/**
+ * @brief Decode a WebP from memory.
+ */
+simg from(const std::uint8_t *data, std::size_t size) {
   int width, height;
-  std::uint8_t *data = new std::uint8_t[size];
+  if (!WebPGetInfo(data, size, &width, &height))
+    return nullptr;
 
-  // read into data
-  std::ifstream file(filename, std::ios::binary);
-  if (!file.read(reinterpret_cast<char *>(data), static_cast<long>(size)))
+  // decode straight into the image instead of a buffer of libwebp's.
+  auto res_img = seedimg::make(static_cast<simg_int>(width),
+                               static_cast<simg_int>(height));
+  const auto stride = static_cast<int>(res_img->width() *
+                                       static_cast<simg_int>(sizeof(pixel)));
+  if (WebPDecodeRGBAInto(data, size,
+                         reinterpret_cast<std::uint8_t *>(res_img->data()),
+                         static_cast<std::size_t>(stride) *
+                             static_cast<std::size_t>(height),
+                         stride) == nullptr)
     return nullptr;
+  return res_img;
+}
 
-  int success = WebPGetInfo(data, size, &width, &height);
-  if (!success)
+simg from(const std::string &filename) {
+  std::vector<std::uint8_t> data;
+  if (!seedimg::stream::read_file(filename, data))
     return nullptr;
+  return from(data.data(), data.size());
+}
 
-  auto *decoded = WebPDecodeRGBA(data, size, &width, &height);
+/**
+ * @brief Decode a WebP scaled down while decoding, to the smallest size with
+ * the same aspect ratio that is no smaller than hint.
+ */
+simg from(const std::uint8_t *data, std::size_t size,
+          seedimg::stream::size_hint hint) {
+  WebPDecoderConfig config;
+  if (!WebPInitDecoderConfig(&config) ||
+      WebPGetFeatures(data, size, &config.input) != VP8_STATUS_OK)
+    return nullptr;
+  const auto width = static_cast<simg_int>(config.input.width);
+  const auto height = static_cast<simg_int>(config.input.height);
+  // the axis the hint constrains most sets the scale, the other one is
+  // rounded up.
+  simg_int scaled_width, scaled_height;
+  if (hint.width * height >= hint.height * width) {
+    scaled_width = hint.width;
+    scaled_height = (height * hint.width + width - 1) / width;
+  } else {
+    scaled_height = hint.height;
+    scaled_width = (width * hint.height + height - 1) / height;
+  }
+  if (scaled_width == 0 || scaled_width >= width || scaled_height >= height)
+    return from(data, size);
 
-  delete[] data;
+  auto res_img = seedimg::make(scaled_width, scaled_height);
+  config.options.use_scaling = 1;
+  config.options.scaled_width = static_cast<int>(scaled_width);
+  config.options.scaled_height = static_cast<int>(scaled_height);
+  // decode straight into the image instead of a buffer of libwebp's.
+  config.output.colorspace = MODE_RGBA;
+  config.output.is_external_memory = 1;
+  config.output.u.RGBA.rgba = reinterpret_cast<std::uint8_t *>(res_img->data());
+  config.output.u.RGBA.stride = static_cast<int>(
+      scaled_width * static_cast<simg_int>(sizeof(pixel)));
+  config.output.u.RGBA.size = static_cast<std::size_t>(
+      scaled_width * scaled_height * static_cast<simg_int>(sizeof(pixel)));
+  if (WebPDecode(data, size, &config) != VP8_STATUS_OK)
+    return nullptr;
+  return res_img;
+}
 
-  return std::make_unique<seedimg::img>(
-      static_cast<simg_int>(width), static_cast<simg_int>(height),
-      reinterpret_cast<seedimg::pixel *>(decoded));
+simg from(const std::string &filename, seedimg::stream::size_hint hint) {
+  std::vector<std::uint8_t> data;
+  if (!seedimg::stream::read_file(filename, data))
+    return nullptr;
+  return from(data.data(), data.size(), hint);
 }
 } // namespace seedimg::modules::webp
 } // namespace seedimg::modules
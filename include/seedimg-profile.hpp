@@ -0,0 +1,179 @@
+/***********************************************************************
+    seedimg - module based image manipulation library written in modern C++
+    Copyright (C) 2020 telugu-boy, tripulse
+
+    This program is free software : you can redistribute it and /
+    or modify it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation,
+    either version 3 of the License,
+    or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+************************************************************************/
+
+#ifndef SEEDIMG_PROFILE_HPP
+#define SEEDIMG_PROFILE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace seedimg::profile {
+/**
+ * @brief What one filter, kernel or transfer cost.
+ */
+struct record {
+  // filter or kernel name, or upload/download for transfers.
+  const char *name;
+  // "cpu" or "ocl".
+  const char *backend;
+  // time the host spent on it, or waited for it.
+  std::uint64_t wall_ns;
+  // time the device spent on it from OpenCL event profiling, 0 on the CPU.
+  std::uint64_t device_ns;
+  // pixel bytes read and written, or moved between host and device.
+  std::size_t bytes;
+};
+
+typedef std::function<void(const record &)> sink;
+} // namespace seedimg::profile
+
+namespace simgdetails {
+// not static: a sink installed in one translation unit has to be seen by
+// code compiled in the others.
+inline std::atomic<bool> &profile_enabled() noexcept {
+  static std::atomic<bool> enabled{false};
+  return enabled;
+}
+
+inline std::shared_ptr<seedimg::profile::sink> &profile_sink() {
+  static std::shared_ptr<seedimg::profile::sink> sink;
+  return sink;
+}
+} // namespace simgdetails
+
+namespace seedimg::profile {
+/**
+ * @brief Whether records are being collected. Instrumented code checks this
+ * first, so profiling costs an atomic load when it is off.
+ */
+inline bool enabled() noexcept {
+  return simgdetails::profile_enabled().load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Send every record to func from now on, or stop collecting them if
+ * it is empty. func is called from whichever thread ran the work, possibly
+ * several at once.
+ * @note Device times need the OpenCL queue to have profiling enabled, which
+ * queues made while a sink is installed have. While collecting, OpenCL
+ * filters wait for each kernel to finish.
+ */
+inline void set_sink(sink func) {
+  auto ptr = func ? std::make_shared<sink>(std::move(func)) : nullptr;
+  std::atomic_store(&simgdetails::profile_sink(), ptr);
+  simgdetails::profile_enabled().store(ptr != nullptr,
+                                       std::memory_order_relaxed);
+}
+
+inline void emit(const record &rec) {
+  auto ptr = std::atomic_load(&simgdetails::profile_sink());
+  if (ptr != nullptr)
+    (*ptr)(rec);
+}
+
+/**
+ * @brief Sink that sums the records up per backend and name, pass it with
+ * set_sink(std::ref(c)).
+ */
+class counters {
+public:
+  struct total {
+    std::size_t calls = 0;
+    std::uint64_t wall_ns = 0, device_ns = 0;
+    std::size_t bytes = 0;
+  };
+
+  void operator()(const record &rec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &t = totals_[std::string(rec.backend) + ":" + rec.name];
+    ++t.calls;
+    t.wall_ns += rec.wall_ns;
+    t.device_ns += rec.device_ns;
+    t.bytes += rec.bytes;
+  }
+
+  /**
+   * @brief Totals so far, keyed by "backend:name".
+   */
+  std::map<std::string, total> totals() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return totals_;
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    totals_.clear();
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::map<std::string, total> totals_;
+};
+} // namespace seedimg::profile
+
+namespace simgdetails {
+/**
+ * @brief Emits a record with the wall time of its lifetime, if profiling was
+ * on when it was created.
+ */
+class profile_scope {
+public:
+  profile_scope(const char *name, std::size_t bytes,
+                const char *backend = "cpu") noexcept
+      : name_{name}, backend_{backend}, bytes_{bytes},
+        active_{seedimg::profile::enabled()} {
+    if (active_)
+      start_ = std::chrono::steady_clock::now();
+  }
+
+  profile_scope(profile_scope const &) = delete;
+  void operator=(profile_scope const &) = delete;
+
+  ~profile_scope() {
+    if (!active_)
+      return;
+    const auto wall = std::chrono::steady_clock::now() - start_;
+    try {
+      seedimg::profile::emit(
+          {name_, backend_,
+           static_cast<std::uint64_t>(
+               std::chrono::duration_cast<std::chrono::nanoseconds>(wall)
+                   .count()),
+           0, bytes_});
+    } catch (...) {
+      // a throwing sink must not take the filter down with it.
+    }
+  }
+
+private:
+  const char *name_;
+  const char *backend_;
+  std::size_t bytes_;
+  bool active_;
+  std::chrono::steady_clock::time_point start_;
+};
+} // namespace simgdetails
+#endif
@@ -0,0 +1,263 @@
+/***********************************************************************
+    seedimg - module based image manipulation library written in modern C++
+    Copyright (C) 2020 telugu-boy, tripulse
+
+    This program is free software : you can redistribute it and /
+    or modify it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation,
+    either version 3 of the License,
+    or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+************************************************************************/
+
+#ifndef SEEDIMG_STREAM_HPP
+#define SEEDIMG_STREAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <seedimg.hpp>
+#include <vector>
+
+// amount of rows a strip of seedimg::stream::pipe has by default.
+#ifndef SIMG_STREAM_ROWS
+#define SIMG_STREAM_ROWS 64
+#endif
+
+namespace seedimg::stream {
+/**
+ * @brief Source of rows, top to bottom, implemented by the modules which can
+ * decode an image a few scanlines at a time.
+ */
+class reader {
+public:
+  virtual ~reader() = default;
+
+  /**
+   * @brief Whether the source was opened and no error happened since.
+   */
+  virtual bool good() const noexcept = 0;
+  virtual simg_int width() const noexcept = 0;
+  virtual simg_int height() const noexcept = 0;
+
+  /**
+   * @brief Read the next n rows into rows, which has room for
+   * n * width() pixels.
+   * @return false on error or if there are less than n rows left.
+   */
+  virtual bool read(seedimg::pixel *rows, simg_int n) = 0;
+};
+
+/**
+ * @brief Sink of rows, top to bottom. The dimensions are given to the
+ * constructor of the implementation.
+ */
+class writer {
+public:
+  virtual ~writer() = default;
+
+  virtual bool good() const noexcept = 0;
+
+  /**
+   * @brief Write the next n rows, n * width pixels.
+   */
+  virtual bool write(const seedimg::pixel *rows, simg_int n) = 0;
+
+  /**
+   * @brief Write whatever comes after the last row, must be called once all
+   * of them were written.
+   */
+  virtual bool finish() = 0;
+};
+
+/**
+ * @brief Where encoders write to when it isn't a file: a vector the bytes
+ * are appended to, or any std::ostream.
+ */
+class byte_sink {
+public:
+  byte_sink(std::vector<std::uint8_t> &vec) noexcept : vec_{&vec} {}
+  byte_sink(std::ostream &os) noexcept : os_{&os} {}
+
+  // never throws, so that it can be called back from C libraries.
+  bool write(const void *data, std::size_t n) noexcept {
+    const auto *bytes = static_cast<const std::uint8_t *>(data);
+    if (vec_ != nullptr) {
+      try {
+        vec_->insert(vec_->end(), bytes, bytes + n);
+      } catch (...) {
+        return false;
+      }
+      return true;
+    }
+    try {
+      return static_cast<bool>(
+          os_->write(reinterpret_cast<const char *>(bytes),
+                     static_cast<std::streamsize>(n)));
+    } catch (...) {
+      return false;
+    }
+  }
+
+  bool flush() noexcept {
+    try {
+      return os_ == nullptr || static_cast<bool>(os_->flush());
+    } catch (...) {
+      return false;
+    }
+  }
+
+private:
+  std::vector<std::uint8_t> *vec_ = nullptr;
+  std::ostream *os_ = nullptr;
+};
+
+/**
+ * @brief Encoded bytes in memory that decoders read front to back. The
+ * memory must outlive the decoder.
+ */
+class byte_source {
+public:
+  byte_source(const std::uint8_t *data, std::size_t size) noexcept
+      : data_{data}, size_{size} {}
+
+  // reads at most n bytes, returns how many were read.
+  std::size_t read(void *dst, std::size_t n) noexcept {
+    n = std::min(n, size_ - pos_);
+    std::memcpy(dst, data_ + pos_, n);
+    pos_ += n;
+    return n;
+  }
+
+  const std::uint8_t *data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+
+private:
+  const std::uint8_t *data_;
+  std::size_t size_;
+  std::size_t pos_ = 0;
+};
+
+/**
+ * @brief Size an image is wanted at, for decoders which can shrink it while
+ * decoding, which is much cheaper than decoding it whole and resizing.
+ * They return the smallest image they can make that is still at least
+ * width x height, with the same aspect ratio, so it usually still has to be
+ * resized but from far fewer pixels. An axis of 0 doesn't constrain the
+ * size, and a hint of 0 x 0 decodes at full size.
+ */
+struct size_hint {
+  simg_int width = 0;
+  simg_int height = 0;
+};
+
+/**
+ * @brief Largest power of two, up to max_factor, that a width x height
+ * image can be divided by, rounding up, without getting smaller than hint.
+ */
+static inline simg_int shrink_factor(simg_int width, simg_int height,
+                                     size_hint hint,
+                                     simg_int max_factor) noexcept {
+  if (hint.width == 0 && hint.height == 0)
+    return 1;
+  simg_int factor = 1;
+  while (factor * 2 <= max_factor &&
+         (width + factor * 2 - 1) / (factor * 2) >= hint.width &&
+         (height + factor * 2 - 1) / (factor * 2) >= hint.height &&
+         factor * 2 <= std::max(width, height))
+    factor *= 2;
+  return factor;
+}
+
+/**
+ * @brief Read all of a file into out, for decoders that work on memory.
+ */
+static inline bool read_file(const std::string &filename,
+                             std::vector<std::uint8_t> &out) {
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file)
+    return false;
+  const auto size = file.tellg();
+  if (size < 0)
+    return false;
+  out.resize(static_cast<std::size_t>(size));
+  file.seekg(0);
+  return static_cast<bool>(
+      file.read(reinterpret_cast<char *>(out.data()), size));
+}
+
+/**
+ * @brief Pull rows from src, run func on strips of them and push the result
+ * to dst, so that only a strip of the image is in memory at once.
+ *
+ * func is called as func(simg &strip) and works in place. With halo > 0 the
+ * strip also holds up to halo rows above and below the ones written out, for
+ * filters that read their neighbours, e.g. a blur of that radius. The first
+ * and last strip end at the edges of the image, other ones end at their
+ * halo, so filters which wrap around the image behave differently there.
+ * func may replace the strip with another image of the same dimensions.
+ *
+ * @param rows amount of rows written out per strip.
+ * @return false if reading, writing or finishing dst failed.
+ */
+template <typename F>
+bool pipe(reader &src, writer &dst, F &&func,
+          simg_int rows = SIMG_STREAM_ROWS, simg_int halo = 0) {
+  if (!src.good() || !dst.good())
+    return false;
+  const simg_int width = src.width(), height = src.height();
+  rows = std::max<simg_int>(rows, 1);
+  const simg_int capacity = std::min(rows + 2 * halo, height);
+  if (capacity == 0)
+    return dst.finish();
+
+  // strips are views over work, which func overwrites. with a halo the
+  // rows read from src are kept in input, since the next strip needs some
+  // of them again.
+  seedimg::img work(width, capacity);
+  std::unique_ptr<seedimg::img> input;
+  if (halo != 0)
+    input = std::make_unique<seedimg::img>(width, capacity);
+  seedimg::img &buffer = halo != 0 ? *input : work;
+
+  // buffer holds input rows [first, last).
+  simg_int first = 0, last = 0;
+  for (simg_int start = 0; start < height; start += rows) {
+    const simg_int end = std::min(start + rows, height);
+    const simg_int want_first = start > halo ? start - halo : 0;
+    const simg_int want_last = std::min(end + halo, height);
+
+    if (want_first < last) {
+      std::memmove(buffer.row(0), buffer.row(want_first - first),
+                   (last - want_first) * width * sizeof(seedimg::pixel));
+    } else {
+      last = want_first;
+    }
+    first = want_first;
+    if (!src.read(buffer.row(last - first), want_last - last))
+      return false;
+    last = want_last;
+
+    if (halo != 0)
+      std::copy(input->row(0), input->row(last - first), work.data());
+    simg strip = std::make_unique<seedimg::img>(
+        width, last - first, work.data(), seedimg::view_allocator::instance());
+    func(strip);
+    // in place filters may have swapped the strip for another image.
+    if (!dst.write(strip->row(start - first), end - start))
+      return false;
+  }
+  return dst.finish();
+}
+} // namespace seedimg::stream
+#endif
@@ -0,0 +1,272 @@
+/***********************************************************************
+    seedimg - module based image manipulation library written in modern C++
+    Copyright (C) 2020 telugu-boy, tripulse
+
+    This program is free software : you can redistribute it and /
+    or modify it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation,
+    either version 3 of the License,
+    or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+************************************************************************/
+
+#ifndef SEEDIMG_THREADPOOL_HPP
+#define SEEDIMG_THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// amount of workers the pool is started with, 0 means one per hardware
+// thread. can be changed at runtime with seedimg::utils::set_thread_count.
+#ifndef SIMG_THREAD_POOL_SIZE
+#define SIMG_THREAD_POOL_SIZE 0
+#endif
+
+namespace simgdetails {
+/**
+ * @brief Process-wide work-stealing pool every multithreaded filter is
+ * dispatched on. Workers are spawned lazily the first time work is
+ * submitted and are kept alive until the pool is resized or the process
+ * exits, so running a filter costs a task submission instead of a thread
+ * creation.
+ *
+ * Every thread owns a deque. A batch is dealt out in contiguous blocks, one
+ * per deque; owners pop from the front of their own deque and idle threads
+ * steal from the back of the others', so a slow or preempted core only
+ * delays the tasks it is currently running.
+ */
+class thread_pool {
+public:
+  static thread_pool &instance() {
+    static thread_pool pool(SIMG_THREAD_POOL_SIZE);
+    return pool;
+  }
+
+  thread_pool(thread_pool const &) = delete;
+  void operator=(thread_pool const &) = delete;
+
+  ~thread_pool() { stop(); }
+
+  /**
+   * @brief Amount of threads taking part in a parallel_for, which includes
+   * the thread that called it.
+   */
+  std::size_t size() const noexcept { return size_; }
+
+  /**
+   * @brief Change the amount of threads. Running workers are joined and new
+   * ones are spawned on the next submission.
+   * @note Must not be called while work is in flight.
+   * @param n new amount of threads, 0 means one per hardware thread.
+   */
+  void resize(std::size_t n) {
+    stop();
+    size_ = n == 0 ? default_size() : n;
+  }
+
+  /**
+   * @brief Invoke task(i) for every i in [0, n) across the pool and block
+   * until all of them are done. The calling thread executes queued tasks
+   * while it waits, so nested calls from inside a task never deadlock.
+   * @note The first exception thrown by a task is rethrown here.
+   */
+  template <typename F> void parallel_for(std::size_t n, F &&task) {
+    if (n == 0)
+      return;
+    if (n == 1 || size_ <= 1) {
+      for (std::size_t i = 0; i < n; ++i)
+        task(i);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      spawn();
+    }
+
+    batch b{n};
+    const std::size_t self = own_queue();
+    const std::size_t nqueues = queues_.size();
+    pending_.fetch_add(n, std::memory_order_release);
+    // deal out contiguous blocks, starting at our own deque so the rows
+    // this thread works on first are the ones it already has in cache.
+    for (std::size_t q = 0; q < nqueues; ++q) {
+      auto &dst = *queues_[(self + q) % nqueues];
+      std::lock_guard<std::mutex> lock(dst.mutex);
+      for (std::size_t i = q * n / nqueues; i < (q + 1) * n / nqueues; ++i)
+        dst.tasks.push_back([this, &b, &task, i] {
+          try {
+            task(i);
+          } catch (...) {
+            std::lock_guard<std::mutex> elock(b.error_mutex);
+            if (!b.error)
+              b.error = std::current_exception();
+          }
+          if (b.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // taking the lock orders the decrement before a waiter's check.
+            std::lock_guard<std::mutex> slock(sleep_mutex_);
+            wake_.notify_all();
+          }
+        });
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      wake_.notify_all();
+    }
+
+    while (b.remaining.load(std::memory_order_acquire) != 0) {
+      std::function<void()> job;
+      if (take(self, job)) {
+        job();
+        continue;
+      }
+      // everything left of the batch is being run by other threads.
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_.wait(lock, [&] {
+        return pending_.load(std::memory_order_acquire) != 0 ||
+               b.remaining.load(std::memory_order_acquire) == 0;
+      });
+    }
+
+    if (b.error)
+      std::rethrow_exception(b.error);
+  }
+
+private:
+  struct batch {
+    std::atomic<std::size_t> remaining;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    explicit batch(std::size_t n) : remaining{n}, error{nullptr} {}
+  };
+
+  struct work_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::size_t size_;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+  // queues_[0] is shared by threads outside of the pool, queues_[i] belongs
+  // to workers_[i - 1].
+  std::vector<std::unique_ptr<work_queue>> queues_;
+  std::atomic<std::size_t> pending_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+
+  explicit thread_pool(std::size_t n) : size_{n == 0 ? default_size() : n} {}
+
+  static std::size_t default_size() noexcept {
+    auto n = static_cast<std::size_t>(std::thread::hardware_concurrency());
+    return n == 0 ? 1 : n;
+  }
+
+  static std::size_t &queue_index() noexcept {
+    static thread_local std::size_t index = 0;
+    return index;
+  }
+
+  std::size_t own_queue() const noexcept {
+    return queue_index() < queues_.size() ? queue_index() : 0;
+  }
+
+  // pops from the front of our own deque, or steals from the back of
+  // another one.
+  bool take(std::size_t self, std::function<void()> &job) {
+    if (pending_.load(std::memory_order_acquire) == 0)
+      return false;
+    const std::size_t nqueues = queues_.size();
+    for (std::size_t q = 0; q < nqueues; ++q) {
+      auto &src = *queues_[(self + q) % nqueues];
+      std::lock_guard<std::mutex> lock(src.mutex);
+      if (src.tasks.empty())
+        continue;
+      if (q == 0) {
+        job = std::move(src.tasks.front());
+        src.tasks.pop_front();
+      } else {
+        job = std::move(src.tasks.back());
+        src.tasks.pop_back();
+      }
+      pending_.fetch_sub(1, std::memory_order_acq_rel);
+      return true;
+    }
+    return false;
+  }
+
+  // must be called with sleep_mutex_ held.
+  void spawn() {
+    if (!workers_.empty())
+      return;
+    stopping_ = false;
+    queues_.clear();
+    for (std::size_t i = 0; i < size_; ++i)
+      queues_.push_back(std::make_unique<work_queue>());
+    // the caller of parallel_for counts as one of the threads.
+    for (std::size_t i = 1; i < size_; ++i)
+      workers_.emplace_back([this, i] {
+        queue_index() = i;
+        work(i);
+      });
+  }
+
+  void work(std::size_t self) {
+    for (;;) {
+      std::function<void()> job;
+      if (take(self, job)) {
+        job();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_.wait(lock, [this] {
+        return stopping_ || pending_.load(std::memory_order_acquire) != 0;
+      });
+      if (stopping_ && pending_.load(std::memory_order_acquire) == 0)
+        return;
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stopping_ = true;
+      wake_.notify_all();
+    }
+    for (auto &worker : workers_)
+      worker.join();
+    workers_.clear();
+  }
+};
+} // namespace simgdetails
+
+namespace seedimg::utils {
+/**
+ * @brief Set the amount of threads filters are run on.
+ * @param n amount of threads, 0 means one per hardware thread.
+ */
+static inline void set_thread_count(std::size_t n) {
+  simgdetails::thread_pool::instance().resize(n);
+}
+
+static inline std::size_t thread_count() noexcept {
+  return simgdetails::thread_pool::instance().size();
+}
+} // namespace seedimg::utils
+#endif
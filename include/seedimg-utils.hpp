@@ -22,9 +22,15 @@
 
 #include <array>
 #include <seedimg.hpp>
+#include <seedimg-threadpool.hpp>
 #include <algorithm>
 #include <thread>
 
+// size of the per-core cache the row and column bands are sized against.
+#ifndef SIMG_L2_CACHE_SIZE
+#define SIMG_L2_CACHE_SIZE 262144
+#endif
+
 namespace seedimg {
 namespace utils {
 constexpr bool is_on_rect(seedimg::point xy1, seedimg::point xy2,
@@ -59,65 +65,75 @@ constexpr auto clamp(I a, MinT min, MaxT max) {
     return a > max ? max : a < min ? min : a;
 }
 
-std::vector<std::pair<simg_int, simg_int>> start_end_rows(const simg& inp_img) noexcept {
+// splits [0, total) into consecutive ranges of at most chunk elements.
+static inline std::vector<std::pair<simg_int, simg_int>>
+split_range(simg_int total, simg_int chunk) noexcept {
   std::vector<std::pair<simg_int, simg_int>> res;
-  auto processor_count =
-      std::min(inp_img->height(),
-               static_cast<simg_int>(std::thread::hardware_concurrency()));
-  if (processor_count == 0)
-    processor_count = 1;
-  res.reserve(static_cast<std::size_t>(processor_count));
-  simg_int rows_per_thread = inp_img->height() / processor_count;
-  for (simg_int i = 0; i < processor_count * rows_per_thread;
-       i += rows_per_thread)
-    res.push_back({i, i + rows_per_thread});
-  res[res.size() - 1].second += inp_img->height() % processor_count;
+  if (chunk == 0)
+    chunk = 1;
+  res.reserve(static_cast<std::size_t>((total + chunk - 1) / chunk));
+  for (simg_int i = 0; i < total; i += chunk)
+    res.push_back({i, std::min(i + chunk, total)});
   return res;
 }
 
-std::vector<std::pair<simg_int, simg_int>> start_end_cols(const simg& inp_img) noexcept {
-  std::vector<std::pair<simg_int, simg_int>> res;
-  auto processor_count =
-      std::min(inp_img->width(),
-               static_cast<simg_int>(std::thread::hardware_concurrency()));
-  if (processor_count == 0)
-    processor_count = 1;
-  res.reserve(static_cast<std::size_t>(processor_count));
-  simg_int cols_per_thread = inp_img->width() / processor_count;
-  for (simg_int i = 0; i < processor_count * cols_per_thread;
-       i += cols_per_thread)
-    res.push_back({i, i + cols_per_thread});
-  res[res.size() - 1].second += inp_img->width() % processor_count;
-  return res;
+// splits the image into bands of rows small enough that a band of the input
+// and of the output fit in L2 together. there are usually many more bands
+// than threads, the pool balances them between its workers.
+static inline std::vector<std::pair<simg_int, simg_int>>
+start_end_rows(const simg &inp_img) noexcept {
+  const simg_int row_bytes =
+      std::max<simg_int>(inp_img->width() * sizeof(seedimg::pixel), 1);
+  const simg_int rows = SIMG_L2_CACHE_SIZE / (4 * row_bytes);
+  return split_range(inp_img->height(), std::max<simg_int>(rows, 1));
+}
+
+// same as start_end_rows for bands of columns. bands are a multiple of a
+// cache line wide so that no two of them write to the same line.
+static inline std::vector<std::pair<simg_int, simg_int>>
+start_end_cols(const simg &inp_img) noexcept {
+  constexpr simg_int line_pixels = 64 / sizeof(seedimg::pixel);
+  const simg_int col_bytes =
+      std::max<simg_int>(inp_img->height() * sizeof(seedimg::pixel), 1);
+  simg_int cols = SIMG_L2_CACHE_SIZE / (4 * col_bytes);
+  cols = std::max(cols - cols % line_pixels, line_pixels);
+  return split_range(inp_img->width(), cols);
 }
 
+// runs func on every band of rows on the thread pool and waits for all of
+// them, func gets (inp_img, res_img, start, end, args...).
 template <typename T, typename... Args>
 void hrz_thread(T &&func, simg &inp_img, simg &res_img, Args &... args) {
   auto start_end = start_end_rows(inp_img);
-  std::vector<std::thread> workers(start_end.size());
-  for (std::size_t i = 0; i < workers.size(); i++) {
-    workers.at(i) =
-        std::thread(std::forward<T>(func), std::ref(inp_img), std::ref(res_img),
-                    start_end.at(i).first, start_end.at(i).second,
-                    std::forward<Args>(args)...);
-  }
-  for (auto &&worker : workers) {
-    worker.join();
-  }
+  simgdetails::thread_pool::instance().parallel_for(
+      start_end.size(), [&](std::size_t i) {
+        std::invoke(func, inp_img, res_img, start_end[i].first,
+                    start_end[i].second, args...);
+      });
 }
 
+// same as hrz_thread, but splits the image into bands of columns.
 template <typename T, typename... Args>
 void vrt_thread(T &&func, simg &inp_img, simg &res_img, Args &&... args) {
-  auto &&start_end = start_end_cols(inp_img);
-  std::vector<std::thread> workers(start_end.size());
-  for (std::size_t i = 0; i < workers.size(); i++) {
-    workers.at(i) =
-        std::thread(std::forward<T>(func), std::ref(inp_img), std::ref(res_img),
-                    start_end.at(i).first, start_end.at(i).second,
-                    std::forward<Args>(args)...);
-  }
-  for (auto &&worker : workers) {
-    worker.join();
+  auto start_end = start_end_cols(inp_img);
+  simgdetails::thread_pool::instance().parallel_for(
+      start_end.size(), [&](std::size_t i) {
+        std::invoke(func, inp_img, res_img, start_end[i].first,
+                    start_end[i].second, args...);
+      });
+}
+
+// runs func(i) for every i in [start, end) on the thread pool, a window of
+// one per thread at a time, for whole frames of an animation. a thread
+// waiting on the bands of its own frame picks up queued work, which would
+// otherwise be more frames, and have all of them in flight at once.
+template <typename F>
+void frame_thread(simg_int start, simg_int end, F &&func) {
+  auto &pool = simgdetails::thread_pool::instance();
+  const simg_int window = std::max<simg_int>(pool.size(), 1);
+  for (simg_int first = start; first < end; first += window) {
+    const simg_int n = std::min(window, end - first);
+    pool.parallel_for(n, [&](std::size_t i) { func(first + i); });
   }
 }
 
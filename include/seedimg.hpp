@@ -30,6 +30,8 @@
 #include <thread>
 #include <vector>
 
+#include <seedimg-allocator.hpp>
+
 typedef std::size_t simg_int;
 
 namespace seedimg {
@@ -91,6 +93,17 @@ protected:
   // width_ amount of pixels per row.
   // height_ amount of rows.
   seedimg::pixel *data_;
+
+  // where data_ came from, it is given back there on destruction.
+  seedimg::allocator *alloc_;
+
+  std::size_t bytes() const noexcept {
+    return static_cast<std::size_t>(width_ * height_) * sizeof(seedimg::pixel);
+  }
+  void release() noexcept {
+    if (data_ != nullptr)
+      alloc_->deallocate(data_, bytes());
+  }
 public:
   static constexpr std::uint8_t MIN_PIXEL_VALUE = 0;
   static constexpr std::uint8_t MAX_PIXEL_VALUE = UINT8_MAX;
@@ -99,29 +112,44 @@ public:
       : colourspace_{space},
         width_{0},
         height_{0},
-        data_{nullptr} {}
+        data_{nullptr},
+        alloc_{&seedimg::default_allocator()} {}
 
   img(simg_int w, simg_int h, colourspaces space = colourspaces::rgb)
+      : img(w, h, seedimg::default_allocator(), space) {}
+
+  img(simg_int w, simg_int h, seedimg::allocator &alloc,
+      colourspaces space = colourspaces::rgb)
       : colourspace_{space},
         width_{w},
-        height_{h}
+        height_{h},
+        data_{nullptr},
+        alloc_{&alloc}
   {
-    data_ = static_cast<seedimg::pixel *>(std::malloc(
-        static_cast<std::size_t>(height_ * width_) * sizeof(seedimg::pixel *)));
-    if (data_ == nullptr)
-      throw std::bad_alloc();
+    if (bytes() != 0)
+      data_ = static_cast<seedimg::pixel *>(alloc_->allocate(bytes()));
   }
 
+  // takes ownership of u_data, which must have been allocated with
+  // std::malloc.
   img(simg_int w, simg_int h, seedimg::pixel *u_data,
       colourspaces space = colourspaces::rgb)
+      : img(w, h, u_data, seedimg::malloc_allocator::instance(), space) {}
+
+  // takes ownership of u_data, which is given back to owner on destruction.
+  // pass seedimg::view_allocator::instance() to only borrow it.
+  img(simg_int w, simg_int h, seedimg::pixel *u_data,
+      seedimg::allocator &owner, colourspaces space = colourspaces::rgb)
       : colourspace_{space},
         width_{w},
         height_{h},
-        data_{u_data} {}
+        data_{u_data},
+        alloc_{&owner} {}
 
   img(img const &img_)
       : img{img_.width_,
-            img_.height_}
+            img_.height_,
+            img_.colourspace_}
   {
     std::copy(img_.data_,
               img_.data_ + img_.width_ * img_.height_,
@@ -133,31 +161,34 @@ public:
     height_      = other.height_;
     data_        = other.data_;
     colourspace_ = other.colourspace_;
+    alloc_       = other.alloc_;
 
     other.width_  = 0;
     other.height_ = 0;
     other.data_   = nullptr;
   }
 
-  ~img() { std::free(data_); }
+  ~img() { release(); }
 
   img &operator=(img other) noexcept {
     std::swap(data_,        other.data_);
     std::swap(width_,       other.width_);
     std::swap(height_,      other.height_);
     std::swap(colourspace_, other.colourspace_);
+    std::swap(alloc_,       other.alloc_);
 
     return *this;
   }
 
   img &operator=(img &&other) noexcept {  
     if(&other != this) {
-      std::free(data_);
+      release();
 
       data_        = other.data_;
       width_       = other.width_;
       height_      = other.height_;
       colourspace_ = other.colourspace_;
+      alloc_       = other.alloc_;
 
       other.data_   = nullptr;
       other.width_  = 0;
@@ -200,6 +231,8 @@ public:
   simg_int        height()      const noexcept { return height_;      }
   colourspaces    colourspace() const noexcept { return colourspace_; }
 
+  seedimg::allocator &get_allocator() const noexcept { return *alloc_; }
+
 #ifdef SEEDIMG_SUBIMAGE_API
   inline img_view sub(simg_int x,
                       simg_int y,
@@ -208,9 +241,13 @@ public:
 #endif
 };
 
+// the caller is responsible for keeping data, dimensions and allocator in
+// step: the buffer is given back to the allocator with the size of the
+// image at the time of destruction.
 class uimg : public img {
 public:
   void set_data(seedimg::pixel *d)     noexcept { data_        = d; }
+  void set_allocator(allocator &a)     noexcept { alloc_       = &a; }
   void set_width(simg_int w)           noexcept { width_       = w; }
   void set_height(simg_int h)          noexcept { height_      = h; }
   void set_colourspace(colourspaces c) noexcept { colourspace_ = c; }